@@ -0,0 +1,835 @@
+/** @file
+ * @brief Load generator and throughput benchmark of the TFTP server.
+ *
+ * Starts the server with tftp_server_start() in a child process on
+ * loopback and runs a number of client threads against it, each
+ * reading (or writing) a file a number of times with the block and
+ * window size given. Clients drop packets and delay their replies
+ * in user space to emulate lossy and distant links. Reports payload
+ * throughput, packet rate, median and tail transfer time and CPU time
+ * the server spent per GB. With -a the server serves a tar archive of
+ * that many files of the size given, clients read them in turn, and
+ * the time to index the archive and to look a file up in it is
+ * reported as well.
+ *
+ * Usage: tftp_bench [-c clients] [-n transfers] [-s size[K|M|G]]
+ *                   [-b blksize] [-w windowsize] [-l loss%] [-d delay_us]
+ *                   [-j workers] [-i epoll|uring] [-p port] [-u]
+ *                   [-a files]
+ *
+ * @author Ivan Morozko <Ivan.Morozko@oktetlabs.ru>
+ *
+ * $Id: $
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <signal.h>
+#include <poll.h>
+#include <pthread.h>
+#include <arpa/inet.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+#include "include/tftp_server.h"
+
+#define BENCH_FILE          "bench.bin"
+#define BENCH_ARCHIVE       "bench.tar"
+#define BENCH_MEMBER        "board-%u/file.bin"
+#define BENCH_TIMEOUT       50      /* ms to wait for a packet        */
+#define BENCH_RETRIES       100     /* timeouts before giving up      */
+
+typedef struct bench_options {
+    unsigned int    clients;
+    unsigned int    transfers;      /* per client                     */
+    size_t          size;           /* bytes of the file              */
+    unsigned int    blksize;
+    unsigned int    windowsize;
+    double          loss;           /* share of packets dropped       */
+    long            delay;          /* us before each ACK or window   */
+    unsigned int    workers;        /* server threads                 */
+    const char      *io;            /* server I/O engine              */
+    int             port;
+    int             upload;         /* write the file instead of
+                                     * reading it                     */
+    unsigned int    members;        /* files of the archive served,
+                                     * 0 to serve the directory       */
+} bench_options;
+
+typedef struct bench_client {
+    pthread_t           thread;
+    unsigned int        id;
+    unsigned int        seed;       /* of dropped packets             */
+    int                 sock;
+    struct sockaddr_in  peer;       /* transfer port of the server    */
+    unsigned long       packets;    /* sent and received              */
+    unsigned int        done;       /* transfers completed            */
+    long                *times;     /* of completed transfers, us     */
+} bench_client;
+
+static bench_options opts = {
+    .clients    = 8,
+    .transfers  = 4,
+    .size       = 16 * 1024 * 1024,
+    .blksize    = 1428,
+    .windowsize = 16,
+    .loss       = 0,
+    .delay      = 0,
+    .workers    = 1,
+    .io         = "epoll",
+    .port       = 12399,
+    .upload     = 0,
+    .members    = 0,
+};
+
+static uint8_t              *content;       /* of the file read or written */
+static struct sockaddr_in   server;
+static double               index_time;     /* ms to index the archive */
+static double               lookup_time;    /* ns to find a file in it */
+
+static long bench_time_us(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec * 1000000L + ts.tv_nsec / 1000;
+}
+
+/** Check if client 'c' drops the next packet. */
+static int bench_lost(bench_client *c)
+{
+    return opts.loss > 0 && rand_r(&c->seed) < opts.loss * RAND_MAX;
+}
+
+/** Send 'len' bytes of 'msg' to 'to', unless the packet is dropped. */
+static void bench_send(bench_client *c, const void *msg, size_t len,
+                       struct sockaddr_in *to)
+{
+    c->packets++;
+
+    if (!bench_lost(c))
+        sendto(c->sock, msg, len, 0, (struct sockaddr *)to, sizeof(*to));
+}
+
+/**
+ * Receive packet that is not dropped into 'msg'.
+ *
+ * @return
+ *      Length of the packet, or zero, if nothing arrived in time.
+ */
+static ssize_t bench_recv(bench_client *c, tftp_message *msg,
+                          struct sockaddr_in *from)
+{
+    struct pollfd   pfd = { .fd = c->sock, .events = POLLIN };
+    socklen_t       slen;
+    ssize_t         len;
+
+    while (poll(&pfd, 1, BENCH_TIMEOUT) > 0)
+    {
+        slen = sizeof(*from);
+        len  = recvfrom(c->sock, msg, sizeof(*msg), 0,
+                        (struct sockaddr *)from, &slen);
+        if (len < TFTP_MSG_MIN_SIZE)
+            continue;
+
+        c->packets++;
+
+        if (!bench_lost(c))
+            return len;
+    }
+
+    return 0;
+}
+
+/** Send ACK of 'block' to the server transfer port. */
+static void bench_ack(bench_client *c, uint16_t block)
+{
+    tftp_message msg;
+
+    msg.ack.opcode       = htons(ACK);
+    msg.ack.block_number = htons(block);
+
+    bench_send(c, &msg, 4, &c->peer);
+}
+
+/** Get name of the file transfer 'i' of client 'c' reads into 'buf'. */
+static const char *bench_name(const bench_client *c, unsigned int i,
+                              char *buf, size_t len)
+{
+    if (opts.members == 0)
+        return BENCH_FILE;
+
+    snprintf(buf, len, BENCH_MEMBER,
+             (c->id * opts.transfers + i) % opts.members);
+
+    return buf;
+}
+
+/** Send request 'opcode' for file 'name' with benchmark options. */
+static void bench_request(bench_client *c, uint16_t opcode, const char *name)
+{
+    char    buf[TFTP_MAX_PAYLOAD];
+    size_t  len;
+
+    *(uint16_t *)buf = htons(opcode);
+    len  = 2;
+    len += sprintf(buf + len, "%s", name) + 1;
+    len += sprintf(buf + len, "octet") + 1;
+    len += sprintf(buf + len, "blksize") + 1;
+    len += sprintf(buf + len, "%u", opts.blksize) + 1;
+    len += sprintf(buf + len, "windowsize") + 1;
+    len += sprintf(buf + len, "%u", opts.windowsize) + 1;
+    len += sprintf(buf + len, "tsize") + 1;
+    len += sprintf(buf + len, "%zu", opcode == WRQ ? opts.size : 0) + 1;
+
+    bench_send(c, buf, len, &server);
+}
+
+/** Check if 'from' is the transfer port, learning it from the first reply. */
+static int bench_from_peer(bench_client *c, struct sockaddr_in *from)
+{
+    if (c->peer.sin_port == 0)
+        c->peer = *from;
+
+    return c->peer.sin_port == from->sin_port &&
+           c->peer.sin_addr.s_addr == from->sin_addr.s_addr;
+}
+
+/**
+ * Read benchmark file 'name', acknowledging each window and the last block
+ * received in order after a gap (RFC 7440), and check its content.
+ *
+ * @return
+ *      Zero on success, or -1, if the transfer failed.
+ */
+static int bench_read(bench_client *c, const char *name)
+{
+    tftp_message        msg;
+    struct sockaddr_in  from;
+    uint64_t            next    = 1;        /* block expected */
+    unsigned int        window  = 0;        /* blocks received since ACK */
+    unsigned int        retries = 0;
+    int                 rewound = 0;
+    size_t              offset;
+    ssize_t             len;
+
+    bench_request(c, RRQ, name);
+
+    while (1)
+    {
+        len = bench_recv(c, &msg, &from);
+        if (len == 0)
+        {
+            if (++retries == BENCH_RETRIES)
+                return -1;
+
+            if (c->peer.sin_port == 0)
+                bench_request(c, RRQ, name);
+            else
+                bench_ack(c, next - 1);
+            continue;
+        }
+
+        if (!bench_from_peer(c, &from))
+            continue;
+
+        if (ntohs(msg.opcode) == ERROR)
+            return -1;
+
+        if (ntohs(msg.opcode) == OACK && next == 1)
+        {
+            bench_ack(c, 0);
+            continue;
+        }
+
+        if (ntohs(msg.opcode) != DATA)
+            continue;
+
+        /* acknowledge the last block received in order once per gap */
+        if (ntohs(msg.data.block_number) != (uint16_t)next)
+        {
+            if (!rewound)
+            {
+                bench_ack(c, next - 1);
+                rewound = 1;
+                window  = 0;
+            }
+            continue;
+        }
+
+        len   -= 4;                                         /* +4 for opcode */
+        offset = (next - 1) * opts.blksize;
+        if (offset + len > opts.size ||
+            memcmp(msg.data.data, content + offset, len))
+            return -1;
+
+        next++;
+        window++;
+        retries = 0;
+        rewound = 0;
+
+        if ((size_t)len < opts.blksize)
+        {
+            bench_ack(c, next - 1);
+            return offset + len == opts.size ? 0 : -1;
+        }
+
+        if (window == opts.windowsize)
+        {
+            if (opts.delay > 0)
+                usleep(opts.delay);
+
+            bench_ack(c, next - 1);
+            window = 0;
+        }
+    }
+}
+
+/** Send window of DATA blocks following block 'acked'. */
+static void bench_send_window(bench_client *c, uint64_t acked,
+                              uint64_t last_block)
+{
+    tftp_message    msg;
+    uint64_t        block;
+    size_t          offset;
+    size_t          len;
+
+    if (opts.delay > 0)
+        usleep(opts.delay);
+
+    for (block = acked + 1;
+         block <= last_block && block <= acked + opts.windowsize; block++)
+    {
+        offset = (block - 1) * opts.blksize;
+        len    = opts.size - offset < opts.blksize ?
+                 opts.size - offset : opts.blksize;
+
+        msg.data.opcode       = htons(DATA);
+        msg.data.block_number = htons(block);
+        memcpy(msg.data.data, content + offset, len);
+
+        bench_send(c, &msg, 4 + len, &c->peer);
+    }
+}
+
+/**
+ * Write the benchmark file as 'name', resending the window following
+ * the last acknowledged block on timeouts.
+ *
+ * @return
+ *      Zero on success, or -1, if the transfer failed.
+ */
+static int bench_write(bench_client *c, const char *name)
+{
+    tftp_message        msg;
+    struct sockaddr_in  from;
+    uint64_t            last_block = opts.size / opts.blksize + 1;
+    uint64_t            acked      = 0;
+    unsigned int        retries    = 0;
+    uint16_t            distance;
+    ssize_t             len;
+
+    bench_request(c, WRQ, name);
+
+    while (1)
+    {
+        len = bench_recv(c, &msg, &from);
+        if (len == 0)
+        {
+            if (++retries == BENCH_RETRIES)
+                return -1;
+
+            if (c->peer.sin_port == 0)
+                bench_request(c, WRQ, name);
+            else
+                bench_send_window(c, acked, last_block);
+            continue;
+        }
+
+        if (!bench_from_peer(c, &from))
+            continue;
+
+        if (ntohs(msg.opcode) == ERROR)
+            return -1;
+
+        if (ntohs(msg.opcode) == OACK && acked == 0)
+        {
+            bench_send_window(c, acked, last_block);
+            continue;
+        }
+
+        if (ntohs(msg.opcode) != ACK)
+            continue;
+
+        /* duplicate and stale ACKs are ignored */
+        distance = ntohs(msg.ack.block_number) - (uint16_t)acked;
+        if (distance == 0 || distance > opts.windowsize)
+            continue;
+
+        acked  += distance;
+        retries = 0;
+
+        if (acked == last_block)
+            return 0;
+
+        bench_send_window(c, acked, last_block);
+    }
+}
+
+/** Run transfers of client 'arg'. */
+static void *bench_client_run(void *arg)
+{
+    bench_client    *c = arg;
+    char            name[64];
+    unsigned int    i;
+    long            start;
+    int             rc;
+
+    for (i = 0; i < opts.transfers; i++)
+    {
+        memset(&c->peer, 0, sizeof(c->peer));
+
+        /*
+         * Each transfer comes from a port of its own, like from a real
+         * client, so packets of the previous one are not taken for it.
+         */
+        c->sock = socket(AF_INET, SOCK_DGRAM, 0);
+        if (c->sock == -1)
+            break;
+
+        start = bench_time_us();
+        if (opts.upload)
+        {
+            snprintf(name, sizeof(name), "up-%u-%u.bin", c->id, i);
+            rc = bench_write(c, name);
+        }
+        else
+        {
+            rc = bench_read(c, bench_name(c, i, name, sizeof(name)));
+        }
+
+        if (rc == 0)
+            c->times[c->done++] = bench_time_us() - start;
+
+        close(c->sock);
+    }
+
+    return NULL;
+}
+
+/**
+ * Start the server on loopback in a child process serving 'dir',
+ * and wait until it answers requests.
+ *
+ * @return
+ *      Process ID of the server, or -1, if it did not start.
+ */
+static pid_t bench_server_start(const char *dir)
+{
+    tftp_server_options so;
+    tftp_server_data    data;
+    bench_client        probe = { .seed = 1 };
+    tftp_message        msg;
+    struct sockaddr_in  from;
+    char                port[16];
+    char                archive[4096];
+    char                name[64];
+    double              loss = opts.loss;
+    pid_t               pid;
+    int                 i;
+
+    snprintf(port, sizeof(port), "%d", opts.port);
+
+    memset(&so, 0, sizeof(so));
+    so.addr       = "127.0.0.1";
+    so.port       = port;
+    so.dir        = dir;
+    so.workers    = opts.workers;
+    so.cache_size = 256;
+    so.io_engine  = opts.io;
+    so.fsync      = "none";
+
+    if (opts.members > 0)
+    {
+        snprintf(archive, sizeof(archive), "%s/%s", dir, BENCH_ARCHIVE);
+        so.archive = archive;
+    }
+
+    pid = fork();
+    if (pid == 0)
+    {
+        /* transfers are not logged one by one */
+        if (freopen("/dev/null", "w", stdout) == NULL ||
+            tftp_fill_server_data(&data, &so) ||
+            tftp_server_start(&data))
+            exit(EXIT_FAILURE);
+        exit(EXIT_SUCCESS);
+    }
+    if (pid < 0)
+    {
+        perror("tftp bench: fork()");
+        return -1;
+    }
+
+    /* the server is up once it answers a request, which is cancelled */
+    probe.sock = socket(AF_INET, SOCK_DGRAM, 0);
+    opts.loss  = 0;
+
+    for (i = 0; i < BENCH_RETRIES; i++)
+    {
+        bench_request(&probe, RRQ,
+                      bench_name(&probe, 0, name, sizeof(name)));
+        if (bench_recv(&probe, &msg, &from) > 0)
+        {
+            msg.error.opcode          = htons(ERROR);
+            msg.error.error_code      = 0;
+            msg.error.error_string[0] = '\0';
+            bench_send(&probe, &msg, 5, &from);
+            break;
+        }
+    }
+
+    close(probe.sock);
+    opts.loss = loss;
+
+    if (i == BENCH_RETRIES)
+    {
+        fprintf(stderr, "tftp bench: server did not start\n");
+        kill(pid, SIGKILL);
+        waitpid(pid, NULL, 0);
+        return -1;
+    }
+
+    return pid;
+}
+
+static int bench_cmp_time(const void *a, const void *b)
+{
+    long x = *(const long *)a;
+    long y = *(const long *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+static size_t bench_parse_size(const char *arg)
+{
+    char    *end;
+    size_t  size = strtoul(arg, &end, 10);
+
+    if (*end == 'K' || *end == 'k')
+        size *= 1024;
+    else if (*end == 'M' || *end == 'm')
+        size *= 1024 * 1024;
+    else if (*end == 'G' || *end == 'g')
+        size *= 1024 * 1024 * 1024;
+
+    return size;
+}
+
+static int bench_parse_options(int argc, char **argv)
+{
+    int opt;
+
+    while ((opt = getopt(argc, argv, "c:n:s:b:w:l:d:j:i:p:ua:h")) != -1)
+    {
+        switch (opt)
+        {
+            case 'c': opts.clients    = atoi(optarg);               break;
+            case 'n': opts.transfers  = atoi(optarg);               break;
+            case 's': opts.size       = bench_parse_size(optarg);   break;
+            case 'b': opts.blksize    = atoi(optarg);               break;
+            case 'w': opts.windowsize = atoi(optarg);               break;
+            case 'l': opts.loss       = atof(optarg) / 100;         break;
+            case 'd': opts.delay      = atol(optarg);               break;
+            case 'j': opts.workers    = atoi(optarg);               break;
+            case 'i': opts.io         = optarg;                     break;
+            case 'p': opts.port       = atoi(optarg);               break;
+            case 'u': opts.upload     = 1;                          break;
+            case 'a': opts.members    = atoi(optarg);               break;
+            default:
+                fprintf(stderr, "Usage: %s [-c clients] [-n transfers] "
+                        "[-s size[K|M|G]] [-b blksize] [-w windowsize] "
+                        "[-l loss%%] [-d delay_us] [-j workers] "
+                        "[-i epoll|uring] [-p port] [-u] [-a files]\n",
+                        argv[0]);
+                return -1;
+        }
+    }
+
+    if (opts.clients == 0 || opts.transfers == 0 ||
+        opts.blksize < TFTP_MIN_BLKSIZE || opts.blksize > TFTP_MAX_BLKSIZE ||
+        opts.windowsize == 0 || opts.windowsize > UINT16_MAX ||
+        (opts.upload && opts.members > 0))
+    {
+        fprintf(stderr, "tftp bench: invalid options\n");
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * Write tar archive 'path' of the benchmark files, all with the same
+ * content.
+ *
+ * @return
+ *      Zero on success, or -1, if error occured.
+ */
+static int bench_write_archive(const char *path)
+{
+    static const uint8_t    zero[512 * 2];
+    uint8_t                 h[512];
+    unsigned int            sum;
+    unsigned int            i;
+    size_t                  j;
+    FILE                    *f;
+
+    f = fopen(path, "w");
+    if (f == NULL)
+        return -1;
+
+    for (i = 0; i < opts.members; i++)
+    {
+        memset(h, 0, sizeof(h));
+        snprintf((char *)h, 100, BENCH_MEMBER, i);
+        sprintf((char *)h + 100, "%07o", 0644);
+        sprintf((char *)h + 108, "%07o", 0);
+        sprintf((char *)h + 116, "%07o", 0);
+        sprintf((char *)h + 124, "%011zo", opts.size);
+        sprintf((char *)h + 136, "%011o", 0);
+        memset(h + 148, ' ', 8);
+        h[156] = '0';
+        memcpy(h + 257, "ustar\0" "00", 8);
+
+        for (sum = 0, j = 0; j < sizeof(h); j++)
+            sum += h[j];
+        sprintf((char *)h + 148, "%06o", sum);
+
+        if (fwrite(h, 1, sizeof(h), f) != sizeof(h) ||
+            fwrite(content, 1, opts.size, f) != opts.size ||
+            fwrite(zero, 1, -opts.size % 512, f) != -opts.size % 512)
+            break;
+    }
+
+    if (i < opts.members || fwrite(zero, 1, sizeof(zero), f) != sizeof(zero))
+    {
+        fclose(f);
+        return -1;
+    }
+
+    return fclose(f) ? -1 : 0;
+}
+
+/**
+ * Measure how long the server takes to index archive 'path' at start
+ * and to look up a file in it for a request.
+ *
+ * @return
+ *      Zero on success, or -1, if error occured.
+ */
+static int bench_measure_archive(const char *path)
+{
+    tftp_archive    *a;
+    char            name[64];
+    unsigned int    i;
+    unsigned int    n;
+    long            start;
+
+    start = bench_time_us();
+    a     = tftp_archive_open(path);
+    if (a == NULL)
+        return -1;
+    index_time = (bench_time_us() - start) / 1e3;
+
+    /* at least a million lookups, so the clock does not show */
+    n     = opts.members > 1000000 ? opts.members : 1000000;
+    start = bench_time_us();
+    for (i = 0; i < n; i++)
+    {
+        snprintf(name, sizeof(name), BENCH_MEMBER, i % opts.members);
+        if (tftp_archive_find(a, name) == NULL)
+            return -1;
+    }
+    lookup_time = (bench_time_us() - start) * 1e3 / n;
+
+    return 0;
+}
+
+/** Write the benchmark file, or archive of them, into 'dir'. */
+static int bench_prepare(const char *dir)
+{
+    char    path[4096];
+    FILE    *f;
+    size_t  i;
+
+    content = malloc(opts.size + 1);
+    if (content == NULL)
+    {
+        perror("tftp bench: malloc()");
+        return -1;
+    }
+
+    for (i = 0; i < opts.size; i++)
+        content[i] = i * 2654435761u >> 24;
+
+    if (opts.members > 0)
+    {
+        snprintf(path, sizeof(path), "%s/%s", dir, BENCH_ARCHIVE);
+        if (bench_write_archive(path) || bench_measure_archive(path))
+        {
+            fprintf(stderr, "tftp bench: archive failed\n");
+            return -1;
+        }
+        return 0;
+    }
+
+    snprintf(path, sizeof(path), "%s/%s", dir, BENCH_FILE);
+    f = fopen(path, "w");
+    if (f == NULL || fwrite(content, 1, opts.size, f) != opts.size ||
+        fclose(f))
+    {
+        perror("tftp bench: write file");
+        return -1;
+    }
+
+    return 0;
+}
+
+/** Remove files of the benchmark and directory 'dir'. */
+static void bench_cleanup(const char *dir)
+{
+    char            path[4096];
+    unsigned int    c;
+    unsigned int    i;
+
+    for (c = 0; opts.upload && c < opts.clients; c++)
+        for (i = 0; i < opts.transfers; i++)
+        {
+            snprintf(path, sizeof(path), "%s/up-%u-%u.bin", dir, c, i);
+            unlink(path);
+        }
+
+    snprintf(path, sizeof(path), "%s/%s", dir, BENCH_FILE);
+    unlink(path);
+    snprintf(path, sizeof(path), "%s/%s", dir, BENCH_ARCHIVE);
+    unlink(path);
+    rmdir(dir);
+}
+
+int main(int argc, char **argv)
+{
+    char            dir[] = "/tmp/tftp_bench.XXXXXX";
+    bench_client    *clients;
+    long            *times;
+    unsigned int    n = 0;
+    unsigned int    i;
+    unsigned int    j;
+    unsigned long   packets = 0;
+    long            start;
+    double          wall;
+    double          cpu;
+    double          bytes;
+    struct rusage   ru;
+    pid_t           pid;
+    int             rc = EXIT_FAILURE;
+
+    if (bench_parse_options(argc, argv))
+        return EXIT_FAILURE;
+
+    if (mkdtemp(dir) == NULL)
+    {
+        perror("tftp bench: mkdtemp()");
+        return EXIT_FAILURE;
+    }
+
+    clients = calloc(opts.clients, sizeof(*clients));
+    times   = calloc(opts.clients * opts.transfers, sizeof(*times));
+    if (clients == NULL || times == NULL || bench_prepare(dir))
+        goto cleanup;
+
+    inet_pton(AF_INET, "127.0.0.1", &server.sin_addr);
+    server.sin_family = AF_INET;
+    server.sin_port   = htons(opts.port);
+
+    pid = bench_server_start(dir);
+    if (pid < 0)
+        goto cleanup;
+
+    start = bench_time_us();
+
+    for (i = 0; i < opts.clients; i++)
+    {
+        clients[i].id    = i;
+        clients[i].seed  = i + 1;
+        clients[i].times = times + i * opts.transfers;
+
+        if (pthread_create(&clients[i].thread, NULL, bench_client_run,
+                           &clients[i]))
+        {
+            fprintf(stderr, "tftp bench: pthread_create() failed\n");
+            opts.clients = i;
+            break;
+        }
+    }
+
+    for (i = 0; i < opts.clients; i++)
+    {
+        pthread_join(clients[i].thread, NULL);
+
+        packets += clients[i].packets;
+        for (j = 0; j < clients[i].done; j++)
+            times[n++] = clients[i].times[j];
+    }
+
+    wall = (bench_time_us() - start) / 1e6;
+
+    kill(pid, SIGTERM);
+    if (wait4(pid, NULL, 0, &ru) < 0)
+    {
+        perror("tftp bench: wait4()");
+        goto cleanup;
+    }
+
+    cpu   = ru.ru_utime.tv_sec + ru.ru_utime.tv_usec / 1e6 +
+            ru.ru_stime.tv_sec + ru.ru_stime.tv_usec / 1e6;
+    bytes = (double)n * opts.size;
+
+    qsort(times, n, sizeof(*times), bench_cmp_time);
+
+    printf("%s: %u clients x %u transfers of %zu bytes, blksize %u, "
+           "windowsize %u, loss %.1f%%, delay %ld us, %u workers, %s\n",
+           opts.upload ? "write" : "read", opts.clients, opts.transfers,
+           opts.size, opts.blksize, opts.windowsize, opts.loss * 100,
+           opts.delay, opts.workers, opts.io);
+    printf("transfers:     %u completed, %u failed\n",
+           n, opts.clients * opts.transfers - n);
+    printf("throughput:    %.1f MB/s\n", bytes / wall / 1e6);
+    printf("packets:       %.0f/s\n", packets / wall);
+    if (n > 0)
+        printf("transfer time: p50 %.1f ms, p99 %.1f ms\n",
+               times[(n - 1) / 2] / 1e3, times[(n - 1) * 99 / 100] / 1e3);
+    if (bytes > 0)
+        printf("server CPU:    %.2f s per GB\n", cpu / (bytes / 1e9));
+    if (opts.members > 0)
+        printf("archive:       %u files indexed in %.1f ms, "
+               "%.0f ns per lookup\n", opts.members, index_time,
+               lookup_time);
+
+    rc = n == opts.clients * opts.transfers ? EXIT_SUCCESS : EXIT_FAILURE;
+
+cleanup:
+    bench_cleanup(dir);
+    free(clients);
+    free(times);
+    free(content);
+
+    return rc;
+}
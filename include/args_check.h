@@ -16,6 +16,8 @@
 
 typedef struct exec_on_board_options {
     int                     flags;
+    const char              *output;    /* file for output of the command */
+    const char              *batch;     /* file of commands to run       */
     telnet_auth_options     telnet_opt;
     tftp_server_options     tftp_opt;
 } exec_on_board_options;
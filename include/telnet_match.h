@@ -0,0 +1,54 @@
+/** @file
+ * @brief Streaming matcher of several patterns in telnet output.
+ *
+ * The patterns are compiled into an Aho-Corasick automaton with
+ * a transition for every byte, so output of the board is fed to it
+ * chunk by chunk as it is received, every byte is looked at once, and
+ * a pattern split between two chunks is still found. The matcher
+ * reports which pattern ended where in the stream, patterns given
+ * first win if several end at the same byte.
+ *
+ * @author Ivan Morozko <Ivan.Morozko@oktetlabs.ru>
+ *
+ * $Id: $
+ */
+
+#ifndef _TELNET_MATCH_
+#define _TELNET_MATCH_
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define TELNET_MATCH_MAX_PATTERNS   32
+#define TELNET_MATCH_NONE           -1
+
+typedef struct telnet_match {
+    uint16_t            (*next)[256];   /* transitions of each state      */
+    int8_t              *out;       /* pattern ending in a state, or
+                                     * TELNET_MATCH_NONE                 */
+    uint16_t            *depth;     /* length of the prefix of a state   */
+    unsigned int        n_states;
+    uint16_t            state;
+    uint64_t            pos;        /* bytes fed since reset             */
+} telnet_match;
+
+extern int telnet_match_init(telnet_match *m, const char *const *patterns,
+                             unsigned int n_patterns);
+
+extern void telnet_match_destroy(telnet_match *m);
+
+extern void telnet_match_reset(telnet_match *m);
+
+extern int telnet_match_feed(telnet_match *m, const char *buf, size_t len,
+                             size_t *end);
+
+/**
+ * Get number of the last bytes fed to 'm' that are the beginning
+ * of a pattern, so a match may still start at them.
+ */
+static inline unsigned int telnet_match_partial(const telnet_match *m)
+{
+    return m->depth[m->state];
+}
+
+#endif
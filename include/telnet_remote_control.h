@@ -12,6 +12,9 @@
 #ifndef _TELNET_REMOTE_CONTROL_
 #define _TELNET_REMOTE_CONTROL_
 
+#include <stdint.h>
+#include <stddef.h>
+
 #include "connection.h"
 
 typedef struct telnet_auth_options {
@@ -27,16 +30,50 @@ typedef struct telnet_auth_options {
     /* The string that server would send as command line prompt.            */
 } telnet_auth_options;
 
+/**
+ * Consumer of output of a command, called with each part of it as it
+ * arrives.
+ *
+ * @return
+ *      Zero on success, or -1, if error occured.
+ */
+typedef int (*telnet_output_cb)(void *arg, const char *buf, size_t len);
+
 typedef struct telnet_cmd_data {
     const char            *command;
     const char            *error_substr; /* The substring that expected to be
                                           * in the server responce if an error
                                           * occures.  */
+    const char            **patterns;    /* NULL-terminated list of other
+                                          * substrings to look for in the
+                                          * responce, or NULL.  */
+    uint32_t              found;         /* Bits of 'patterns' found in
+                                          * the responce.  */
+    telnet_output_cb      output;        /* Consumer of the responce up to
+                                          * the prompt, or NULL.  */
+    void                  *output_arg;
+    int                   status;        /* Exit status of the command
+                                          * run by telnet_execute_batch(),
+                                          * -1 if unknown.  */
 } telnet_cmd_data;
 
+/* State of the telnet protocol of the connection (RFC 854, RFC 1143). */
+typedef struct telnet_nvt {
+    uint8_t               state;         /* Of the parser of commands
+                                          * of the server.  */
+    uint8_t               cmd;           /* WILL, WONT, DO or DONT which
+                                          * option is awaited for.  */
+    uint8_t               local[256];    /* Our options: NO, YES or
+                                          * WANTYES if asked for.  */
+    uint8_t               remote[256];   /* Options of the server.  */
+    uint8_t               reply[64];     /* Replies not sent yet.  */
+    size_t                reply_len;
+} telnet_nvt;
+
 typedef struct telnet_board_data {
     conn_info             tcp_conn;
     telnet_auth_options   *opt;
+    telnet_nvt            nvt;
 } telnet_board_data;
 
 extern int telnet_fill_board_data(telnet_board_data *ret,
@@ -48,4 +85,10 @@ extern int telnet_auth(telnet_board_data *data);
 
 extern int telnet_execute_command(telnet_board_data *data,
                                   telnet_cmd_data *cmd_data);
+
+extern int telnet_execute_batch(telnet_board_data *data,
+                                telnet_cmd_data *cmds, unsigned int n_cmds);
+
+extern int telnet_output_file(void *file, const char *buf, size_t len);
+
 #endif
@@ -0,0 +1,54 @@
+/** @file
+ * @brief Files of the TFTP server served out of a tar or cpio archive.
+ *
+ * The archive is mapped into memory once, and its members are indexed
+ * by name in a hash table at start, so a request for a member costs
+ * a hash lookup and its content is sent as a slice of the mapping,
+ * without opening any file. The archive is a provider of the server
+ * (see tftp_provider.h). POSIX ustar, GNU and v7 tar archives with
+ * long names (GNU and pax) and cpio archives of the "newc" format are
+ * read; only regular files are served, and of members with the same
+ * name the last one wins, like on extraction.
+ *
+ * @author Ivan Morozko <Ivan.Morozko@oktetlabs.ru>
+ *
+ * $Id: $
+ */
+
+#ifndef _TFTP_ARCHIVE_
+#define _TFTP_ARCHIVE_
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "tftp_provider.h"
+
+#define TFTP_ARCHIVE_END        UINT32_MAX  /* end of a hash chain */
+
+typedef struct tftp_archive_member {
+    uint32_t            next;       /* in the hash chain               */
+    uint32_t            name;       /* offset in 'names'               */
+    off_t               offset;     /* of the content in the archive   */
+    off_t               size;
+} tftp_archive_member;
+
+typedef struct tftp_archive {
+    tftp_provider       provider;   /* goes first                      */
+    uint8_t             *map;       /* whole archive, read-only        */
+    size_t              map_size;
+    char                *names;     /* NUL-terminated, one after another */
+    size_t              names_len;
+    size_t              names_size;
+    tftp_archive_member *members;
+    uint32_t            n_members;
+    uint32_t            size;       /* members allocated               */
+    uint32_t            *buckets;   /* first members of hash chains    */
+    uint32_t            mask;       /* number of buckets minus one     */
+} tftp_archive;
+
+extern tftp_archive *tftp_archive_open(const char *path);
+
+extern const tftp_archive_member *tftp_archive_find(const tftp_archive *a,
+                                                    const char *name);
+
+#endif
@@ -0,0 +1,76 @@
+/** @file
+ * @brief Shared in-memory cache of files read by TFTP clients.
+ *
+ * Files are cached by path, inode and modification time, so all
+ * transfers of a file share one resident copy of its content.
+ * The cache keeps within a memory budget by evicting least recently
+ * used files nobody reads, and drops files changed in the server
+ * directory as inotify reports them. Files are read into the cache
+ * by a loader thread, so loops never wait for the disk: transfers
+ * of a file that is not read yet are served from the file itself.
+ *
+ * @author Ivan Morozko <Ivan.Morozko@oktetlabs.ru>
+ *
+ * $Id: $
+ */
+
+#ifndef _TFTP_CACHE_
+#define _TFTP_CACHE_
+
+#include <stdint.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#define TFTP_CACHE_BUCKETS       256
+
+typedef struct tftp_cache_entry {
+    struct tftp_cache_entry *hash_next;
+    struct tftp_cache_entry *lru_prev;
+    struct tftp_cache_entry *lru_next;      /* more recently used      */
+    char                    *path;          /* as requested by client  */
+    dev_t                   dev;
+    ino_t                   ino;
+    struct timespec         mtime;
+    off_t                   size;
+    uint8_t                 *data;          /* NULL while loading      */
+    unsigned int            refs;           /* transfers reading 'data'
+                                             * and the loader          */
+    int                     loading;        /* 'data' is being read    */
+    int                     fd;             /* file the loader reads
+                                             * 'data' from             */
+    struct tftp_cache_entry *load_next;     /* next file queued for
+                                             * the loader              */
+    int                     stale;          /* removed from the cache,
+                                             * freed with the last
+                                             * reference               */
+} tftp_cache_entry;
+
+typedef struct tftp_cache {
+    pthread_mutex_t         lock;
+    pthread_cond_t          queued;         /* a file is queued for
+                                             * the loader               */
+    pthread_t               loader;
+    tftp_cache_entry        *load_head;     /* files to read, oldest
+                                             * first                    */
+    tftp_cache_entry        *load_tail;
+    int                     inotify_fd;
+    size_t                  budget;         /* bytes of file data       */
+    size_t                  used;
+    tftp_cache_entry        *buckets[TFTP_CACHE_BUCKETS];
+    tftp_cache_entry        *lru_head;      /* least recently used      */
+    tftp_cache_entry        *lru_tail;
+} tftp_cache;
+
+extern tftp_cache *tftp_cache_create(size_t budget, const char *directory);
+
+extern tftp_cache_entry *tftp_cache_get(tftp_cache *cache, const char *path,
+                                        int fd, struct stat *st, int *hit);
+
+extern void tftp_cache_put(tftp_cache *cache, tftp_cache_entry *entry);
+
+extern void tftp_cache_notify(tftp_cache *cache);
+
+extern size_t tftp_cache_used(tftp_cache *cache);
+
+#endif
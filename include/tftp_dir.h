@@ -0,0 +1,50 @@
+/** @file
+ * @brief Files of the TFTP server directory opened beneath it.
+ *
+ * The server directory is opened once, and requested files are
+ * resolved relative to it with openat2() and RESOLVE_BENEATH, so
+ * neither ".." nor symbolic links lead out of it. Each loop keeps
+ * descriptors of the files it read last, so repeated requests for
+ * a file of the directory do not resolve its path at all. A cached
+ * descriptor is used while the directory is not modified since it
+ * was opened: renaming, removing or creating a file changes the
+ * modification time of its directory, and a file written in place
+ * keeps its inode.
+ *
+ * @author Ivan Morozko <Ivan.Morozko@oktetlabs.ru>
+ *
+ * $Id: $
+ */
+
+#ifndef _TFTP_DIR_
+#define _TFTP_DIR_
+
+#include <time.h>
+
+#define TFTP_DIR_FILES          64      /* cached descriptors per loop  */
+#define TFTP_DIR_RACY           50000   /* microseconds, directory
+                                         * changes this recent may yet
+                                         * keep its modification time  */
+
+/* Descriptor of a file read from the directory. */
+typedef struct tftp_dir_file {
+    char            *name;          /* NULL if the slot is free         */
+    int             fd;
+    struct timespec dir_mtime;      /* of the directory when opened     */
+} tftp_dir_file;
+
+typedef struct tftp_dir {
+    int             fd;             /* O_PATH descriptor of the server
+                                     * directory, not owned            */
+    int             beneath;        /* kernel has openat2()             */
+    tftp_dir_file   files[TFTP_DIR_FILES];
+} tftp_dir;
+
+extern void tftp_dir_init(tftp_dir *dir, int fd);
+
+extern void tftp_dir_destroy(tftp_dir *dir);
+
+extern int tftp_dir_open(tftp_dir *dir, const char *name, int flags,
+                         int *cached);
+
+#endif
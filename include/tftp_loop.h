@@ -0,0 +1,192 @@
+/** @file
+ * @brief Event loop multiplexing TFTP transfers in one process.
+ *
+ * The loop waits on the well-known server socket for new requests and
+ * on a shared transfer socket for messages of running transfers.
+ * Transfers are looked up by client address and port, retransmissions
+ * are driven by a hashed timer wheel. Packets are received and sent in
+ * batches with recvmmsg() and sendmmsg(): transfers queue their packets
+ * and the loop flushes the queue before it waits for events. The loop
+ * may use io_uring instead of epoll (see tftp_uring.h), otherwise files
+ * of write requests are written by a writer thread (see tftp_writer.h).
+ * Besides the stats of its periodic report, the loop keeps metrics
+ * for scraping (see tftp_metrics.h). Windows of read requests may be
+ * paced (see tftp_pace.h). Requested files are opened beneath the
+ * server directory (see tftp_dir.h), unless a provider generates
+ * them (see tftp_provider.h).
+ *
+ * @author Ivan Morozko <Ivan.Morozko@oktetlabs.ru>
+ *
+ * $Id: $
+ */
+
+#ifndef _TFTP_LOOP_
+#define _TFTP_LOOP_
+
+#include <stdint.h>
+#include <time.h>
+#include <sys/types.h>
+#include <netinet/in.h>
+
+#include "tftp_proto.h"
+#include "tftp_cache.h"
+#include "tftp_mcast.h"
+#include "tftp_metrics.h"
+#include "tftp_pace.h"
+#include "tftp_dir.h"
+#include "tftp_provider.h"
+
+#define TFTP_LOOP_BUCKETS        1024   /* transfer hash table size */
+#define TFTP_WHEEL_SLOTS         1024
+#define TFTP_WHEEL_TICK          100    /* timer wheel tick in microseconds */
+#define TFTP_LOOP_BATCH          64     /* packets per recvmmsg()/sendmmsg() */
+#define TFTP_LOOP_TX_BUFFER      (1024 * 1024)  /* bytes of queued packets */
+
+struct tftp_transfer;
+struct tftp_uring;
+struct tftp_writer;
+struct mmsghdr;
+struct iovec;
+
+typedef struct tftp_timer {
+    struct tftp_timer     *next;
+    struct tftp_timer     **pprev;      /* NULL if the timer is not armed */
+    uint64_t              expires;      /* wheel tick to fire at          */
+} tftp_timer;
+
+/* Packets received or to be sent by a single syscall. */
+typedef struct tftp_batch {
+    struct mmsghdr        *hdrs;
+    struct iovec          *iovs;
+    struct sockaddr_in    *addrs;
+    uint8_t               *buf;         /* packets follow each other    */
+    size_t                size;         /* size of 'buf'                */
+    size_t                used;         /* bytes taken by queued packets */
+    unsigned int          len;          /* number of queued packets     */
+} tftp_batch;
+
+typedef struct tftp_loop_stats {
+    unsigned long         transfers;    /* started transfers            */
+    unsigned long         completed;
+    unsigned long         failed;
+    unsigned int          peak;         /* most concurrent transfers    */
+    double                active_time;  /* integral of active transfers
+                                         * over time, in seconds        */
+    long                  cpu_time;     /* CPU time at the last report  */
+    long                  wall_time;    /* wall time at the last report */
+    unsigned long         tx_calls;     /* sendmmsg() calls and packets */
+    unsigned long         tx_packets;   /* sent by them since the last  */
+    unsigned long         rx_calls;     /* report, the same for         */
+    unsigned long         rx_packets;   /* recvmmsg()                   */
+    unsigned long         cache_hits;   /* files read found in the cache */
+    unsigned long         cache_misses;
+    unsigned long         written_behind;   /* bytes handed to the writer */
+    unsigned long         written_in_place; /* bytes written by the loop
+                                             * as the writer was behind  */
+    unsigned long         zero_skipped; /* zero bytes left as holes   */
+    unsigned long         dup_acks;     /* duplicate and stale ACKs     */
+    unsigned long         fast_resends; /* windows resent on a duplicate
+                                         * ACK before the timeout       */
+    unsigned long         stale_data;   /* DATA of blocks received
+                                         * already                      */
+    unsigned long         paced;        /* windows held back by pacing  */
+} tftp_loop_stats;
+
+typedef struct tftp_loop {
+    unsigned int          worker;       /* index of the worker thread    */
+    clockid_t             cpu_clock;    /* CPU time clock of the thread  */
+    int                   epfd;
+    int                   listen_sock;  /* -1 if requests are not accepted */
+    int                   stop_fd;      /* eventfd the server stops the
+                                         * loop with, -1 if none         */
+    int                   stopped;      /* 'stop_fd' is signalled        */
+    int                   xfer_sock;    /* shared by all transfers         */
+    const char            *base_directory;
+    tftp_dir              dir;          /* files are opened beneath it   */
+    const tftp_provider   *providers;   /* asked for files read first,
+                                         * NULL if none                  */
+    tftp_cache            *cache;       /* shared by workers, may be NULL */
+    tftp_mcast            *mcast;       /* NULL if multicast is disabled */
+    int                   mcast_owner;  /* the loop serves multicast
+                                         * sessions                      */
+    struct tftp_uring     *uring;       /* NULL if the loop uses epoll   */
+    struct tftp_writer    *writer;      /* NULL if files are written by
+                                         * io_uring or the loop itself   */
+    int                   fsync;        /* TFTP_FSYNC_* of written files */
+    tftp_bucket           *pacer;       /* server bandwidth cap shared by
+                                         * workers, NULL if none         */
+    unsigned long         client_rate;  /* bytes per second of a client,
+                                         * 0 if unlimited                */
+    struct tftp_transfer  *transfers[TFTP_LOOP_BUCKETS];
+    unsigned int          active;
+    tftp_timer            *wheel[TFTP_WHEEL_SLOTS];
+    uint64_t              tick;         /* last processed wheel tick     */
+    unsigned int          armed;        /* number of armed timers        */
+    long                  changed_at;   /* last change of 'active'       */
+    tftp_batch            tx;           /* packets queued for xfer_sock  */
+    tftp_batch            rx;
+    tftp_loop_stats       stats;
+    tftp_metrics          metrics;      /* never reset, unlike 'stats'   */
+} tftp_loop;
+
+extern long tftp_time_us(void);
+
+extern int tftp_loop_init(tftp_loop *loop, int listen_sock,
+                          const char *base_directory, int dir_fd,
+                          tftp_cache *cache);
+
+extern int tftp_loop_set_mcast(tftp_loop *loop, tftp_mcast *mcast,
+                               int owner);
+
+extern int tftp_loop_set_stop(tftp_loop *loop, int stop_fd);
+
+extern int tftp_loop_set_uring(tftp_loop *loop);
+
+extern int tftp_loop_set_writer(tftp_loop *loop, int fsync);
+
+extern void tftp_loop_set_pace(tftp_loop *loop, tftp_bucket *pacer,
+                               unsigned long client_rate);
+
+extern void tftp_loop_set_providers(tftp_loop *loop,
+                                    const tftp_provider *providers);
+
+extern void tftp_loop_destroy(tftp_loop *loop);
+
+extern int tftp_loop_add_request(tftp_loop *loop, tftp_message *msg,
+                                 ssize_t msg_len,
+                                 struct sockaddr_in *client_sock,
+                                 socklen_t slen);
+
+extern void tftp_loop_request(tftp_loop *loop, tftp_message *msg,
+                              ssize_t msg_len,
+                              struct sockaddr_in *client_sock,
+                              socklen_t slen);
+
+extern void tftp_loop_input(tftp_loop *loop, tftp_message *msg,
+                            ssize_t msg_len,
+                            struct sockaddr_in *client_sock,
+                            socklen_t slen);
+
+extern void tftp_loop_finish(tftp_loop *loop, struct tftp_transfer *t);
+
+extern tftp_message *tftp_loop_packet(tftp_loop *loop, size_t max_len);
+
+extern void tftp_loop_queue(tftp_loop *loop, size_t len,
+                            struct sockaddr_in *sock, socklen_t slen);
+
+extern void tftp_loop_queue_data(tftp_loop *loop, size_t hdr_len,
+                                 const void *data, size_t data_len,
+                                 struct sockaddr_in *sock, socklen_t slen);
+
+extern void tftp_loop_flush(tftp_loop *loop);
+
+extern int tftp_loop_run(tftp_loop *loop);
+
+extern void tftp_loop_report(tftp_loop *loop);
+
+extern void tftp_timer_arm(tftp_loop *loop, tftp_timer *timer,
+                           long timeout);
+
+extern void tftp_timer_cancel(tftp_loop *loop, tftp_timer *timer);
+
+#endif
@@ -0,0 +1,81 @@
+/** @file
+ * @brief Multicast TFTP sessions as defined in RFC 2090.
+ *
+ * Clients reading the same file with the multicast option join
+ * a session. DATA packets of the session are sent to its multicast
+ * group, and only the master client acknowledges them. When the master
+ * client has the whole file, the next client becomes the master and
+ * acknowledges the blocks it missed, so those are sent to the group
+ * again. All sessions are served by a single event loop, the other
+ * loops forward multicast requests to it.
+ *
+ * @author Ivan Morozko <Ivan.Morozko@oktetlabs.ru>
+ *
+ * $Id: $
+ */
+
+#ifndef _TFTP_MCAST_
+#define _TFTP_MCAST_
+
+#include <stdint.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <netinet/in.h>
+
+#include "tftp_proto.h"
+
+#define TFTP_MCAST_SESSIONS      64     /* group ports from the base port */
+
+struct tftp_loop;
+struct tftp_transfer;
+
+/* Request forwarded to the loop serving sessions. */
+typedef struct tftp_mcast_request {
+    struct tftp_mcast_request   *next;
+    struct sockaddr_in          client_sock;
+    socklen_t                   slen;
+    ssize_t                     msg_len;
+    uint8_t                     msg[];
+} tftp_mcast_request;
+
+typedef struct tftp_mcast_session {
+    struct tftp_mcast_session   *next;
+    dev_t                       dev;            /* file read by clients */
+    ino_t                       ino;
+    off_t                       size;
+    struct timespec             mtime;
+    uint16_t                    blksize;
+    unsigned int                slot;
+    struct sockaddr_in          group;
+    struct tftp_transfer        *master;        /* acknowledges DATA    */
+    struct tftp_transfer        *waiting;       /* clients to become master
+                                                 * in order of joining  */
+} tftp_mcast_session;
+
+typedef struct tftp_mcast {
+    struct sockaddr_in          group;          /* address and base port */
+    struct in_addr              interface;      /* to send to groups from */
+    pthread_mutex_t             lock;           /* protects 'inbox'       */
+    int                         event_fd;       /* signals new requests   */
+    tftp_mcast_request          *inbox;
+    tftp_mcast_session          *sessions;      /* of the serving loop    */
+    uint64_t                    slots;          /* group ports taken      */
+} tftp_mcast;
+
+extern tftp_mcast *tftp_mcast_create(const char *group, const char *port,
+                                     const char *interface);
+
+extern int tftp_mcast_requested(tftp_message *msg, ssize_t msg_len);
+
+extern int tftp_mcast_forward(tftp_mcast *mcast, tftp_message *msg,
+                              ssize_t msg_len,
+                              struct sockaddr_in *client_sock,
+                              socklen_t slen);
+
+extern void tftp_mcast_accept(struct tftp_loop *loop);
+
+extern int tftp_mcast_join(struct tftp_transfer *t);
+
+extern void tftp_mcast_leave(struct tftp_transfer *t);
+
+#endif
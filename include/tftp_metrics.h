@@ -0,0 +1,77 @@
+/** @file
+ * @brief Metrics of the TFTP server in Prometheus text format.
+ *
+ * Each loop keeps counters and latency histograms that only grow,
+ * unlike the stats of its periodic report. They are plain memory
+ * updated by the loop itself, so counting costs no system calls.
+ * Counters of a transfer are added to its loop when it finishes.
+ * Metrics of all loops are written to a file by a separate thread
+ * of the server, to be picked up by the node exporter textfile
+ * collector or any other scraper.
+ *
+ * @author Ivan Morozko <Ivan.Morozko@oktetlabs.ru>
+ *
+ * $Id: $
+ */
+
+#ifndef _TFTP_METRICS_
+#define _TFTP_METRICS_
+
+#include <stdint.h>
+
+#define TFTP_HIST_BUCKETS       32      /* powers of two from 1 us up to
+                                         * about 36 minutes             */
+#define TFTP_METRICS_INTERVAL   5       /* seconds between writes       */
+
+struct tftp_loop;
+struct tftp_cache;
+
+/* Latency histogram, all values are in microseconds. */
+typedef struct tftp_histogram {
+    unsigned long   buckets[TFTP_HIST_BUCKETS]; /* samples above 2^(i-1)
+                                                 * and up to 2^i        */
+    unsigned long   count;
+    unsigned long   sum;
+} tftp_histogram;
+
+typedef struct tftp_metrics {
+    unsigned long   reads;          /* read requests received          */
+    unsigned long   writes;         /* write requests received         */
+    unsigned long   completed;      /* transfers                       */
+    unsigned long   failed;
+    unsigned long   bytes_sent;     /* file data, each block once      */
+    unsigned long   bytes_received;
+    unsigned long   blocks_sent;    /* DATA packets with retransmissions */
+    unsigned long   blocks_received;
+    unsigned long   retransmits;    /* DATA and ACK packets resent     */
+    unsigned long   timeouts;       /* retransmission timer expirations */
+    unsigned long   dup_acks;       /* duplicate and stale ACKs        */
+    unsigned long   stale_data;     /* DATA of blocks received already */
+    unsigned long   paced;          /* windows held back by pacing     */
+    unsigned long   cache_hits;
+    unsigned long   cache_misses;
+    unsigned long   opens_cached;   /* files opened with a cached
+                                     * descriptor                      */
+    unsigned long   opens_resolved; /* files opened by their path      */
+    unsigned long   opens_provided; /* files generated by providers    */
+    tftp_histogram  rtt;            /* round-trip time samples         */
+    tftp_histogram  duration;       /* of transfers                    */
+    tftp_histogram  cache_latency;  /* file lookups in the cache       */
+    tftp_histogram  disk_latency;   /* writes and syncs of uploads     */
+} tftp_metrics;
+
+/** Add sample of 'us' microseconds to histogram 'h'. */
+static inline void tftp_histogram_add(tftp_histogram *h, long us)
+{
+    unsigned int i = us > 1 ? 64 - __builtin_clzl(us - 1) : 0;
+
+    if (i < TFTP_HIST_BUCKETS)
+        h->buckets[i]++;
+    h->count++;
+    h->sum += us > 0 ? us : 0;
+}
+
+extern int tftp_metrics_write(const char *path, struct tftp_loop **loops,
+                              unsigned int n, struct tftp_cache *cache);
+
+#endif
@@ -0,0 +1,28 @@
+/** @file
+ * @brief Netascii translation of TFTP transfers.
+ *
+ * Files sent in netascii mode have line ends translated to CR LF
+ * and bare carriage returns to CR NUL (RFC 764, RFC 1350) block by
+ * block as they are sent, files received are translated back.
+ * Text is scanned for CR and LF with SSE2 (NEON on ARM) and copied
+ * in runs between them.
+ *
+ * @author Ivan Morozko <Ivan.Morozko@oktetlabs.ru>
+ *
+ * $Id: $
+ */
+
+#ifndef _TFTP_NETASCII_
+#define _TFTP_NETASCII_
+
+#include <stdint.h>
+#include <sys/types.h>
+
+extern size_t tftp_netascii_encode(const uint8_t *src, size_t len,
+                                   uint8_t *dst, size_t size, int *carry,
+                                   size_t *used);
+
+extern uint8_t *tftp_netascii_decode(uint8_t *data, size_t *len, int *cr,
+                                     int last);
+
+#endif
@@ -0,0 +1,46 @@
+/** @file
+ * @brief Pacing of TFTP read transfers with token buckets.
+ *
+ * Windows of DATA are paced by two token buckets: one of the transfer
+ * limits the rate of each client, and one shared by all workers caps
+ * the bandwidth of the whole server. Buckets are kept as the time the
+ * next byte is due at (GCRA), so the shared one is a single atomic
+ * word. A window that does not conform waits on the retransmission
+ * timer of its transfer, the loop never sleeps. Transfers of small
+ * files may run further ahead of the shared bucket than large ones,
+ * so short requests go first while large ones pull images, but all
+ * of them stay within the cap.
+ *
+ * @author Ivan Morozko <Ivan.Morozko@oktetlabs.ru>
+ *
+ * $Id: $
+ */
+
+#ifndef _TFTP_PACE_
+#define _TFTP_PACE_
+
+#include <stddef.h>
+
+#define TFTP_PACE_BURST         (64 * 1024)     /* bytes sent ahead of
+                                                 * the rate at most      */
+#define TFTP_PACE_SMALL         (1024 * 1024)   /* files given the larger
+                                                 * burst of the server
+                                                 * cap                   */
+#define TFTP_PACE_SMALL_BURST   (256 * 1024)    /* bytes small files are
+                                                 * sent ahead of the
+                                                 * server rate at most   */
+
+/* Token bucket, 'due' is shared by workers for the server cap. */
+typedef struct tftp_bucket {
+    unsigned long   rate;           /* bytes per second, 0 if unlimited */
+    long            due;            /* time the rate allows the next
+                                     * byte at, microseconds           */
+} tftp_bucket;
+
+struct tftp_transfer;
+
+extern void tftp_bucket_init(tftp_bucket *b, unsigned long rate);
+
+extern long tftp_pace(struct tftp_transfer *t, size_t len);
+
+#endif
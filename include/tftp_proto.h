@@ -0,0 +1,89 @@
+/** @file
+ * @brief TFTP protocol messages.
+ *
+ * Packet layouts and constants of the TFTP protocol as defined
+ * in RFC 1350 and its option extensions.
+ *
+ * @author Ivan Morozko <Ivan.Morozko@oktetlabs.ru>
+ *
+ * $Id: $
+ */
+
+#ifndef _TFTP_PROTO_
+#define _TFTP_PROTO_
+
+#include <stdint.h>
+
+#define TFTP_MAX_PAYLOAD        512
+#define TFTP_MSG_MIN_SIZE       4
+
+/* Block sizes allowed by RFC 2348. */
+#define TFTP_MIN_BLKSIZE        8
+#define TFTP_MAX_BLKSIZE        65464
+
+/*
+ * Largest window accepted (RFC 7440), far below half of the 16-bit
+ * block numbers, so ACKs of earlier windows are told from later ones.
+ */
+#define TFTP_MAX_WINDOWSIZE     512
+
+enum tftp_opcode {
+    RRQ = 1,
+    WRQ,
+    DATA,
+    ACK,
+    ERROR,
+    OACK
+};
+
+/* Error codes of ERROR packets (RFC 1350). */
+enum tftp_error_code {
+    TFTP_ERR_UNDEFINED = 0,
+    TFTP_ERR_NOT_FOUND,
+    TFTP_ERR_ACCESS,
+    TFTP_ERR_DISK_FULL,
+    TFTP_ERR_ILLEGAL_OP,
+    TFTP_ERR_UNKNOWN_TID,
+    TFTP_ERR_EXISTS,
+    TFTP_ERR_NO_USER
+};
+
+enum tftp_transfer_mode {
+    NETASCII = 1,
+    OCTET
+};
+
+typedef union {
+
+    uint16_t opcode;
+
+    struct {
+        uint16_t    opcode;                                 /* RRQ or WRQ */
+        uint8_t     filename_and_mode[TFTP_MAX_PAYLOAD + 2];/* +2 for mode */
+    } __attribute__((packed)) request;
+
+    struct {
+        uint16_t    opcode;                                 /* DATA */
+        uint16_t    block_number;
+        uint8_t     data[TFTP_MAX_BLKSIZE];
+    } __attribute__((packed)) data;
+
+    struct {
+        uint16_t    opcode;                                 /* ACK */
+        uint16_t    block_number;
+    } __attribute__((packed)) ack;
+
+    struct {
+        uint16_t    opcode;                                 /* ERROR */
+        uint16_t    error_code;
+        uint8_t     error_string[TFTP_MAX_PAYLOAD];
+    } __attribute__((packed)) error;
+
+    struct {
+        uint16_t    opcode;                                 /* OACK */
+        uint8_t     options[TFTP_MAX_PAYLOAD];
+    } __attribute__((packed)) oack;
+
+} __attribute__((packed)) tftp_message;
+
+#endif
@@ -0,0 +1,65 @@
+/** @file
+ * @brief Files generated by the TFTP server instead of read from disk.
+ *
+ * Providers are asked for the file of a read request before it is
+ * looked up in the server directory. A provider generates content
+ * in memory for the address of the client and the name it requested,
+ * or lends content it keeps, like members of an archive (see
+ * tftp_archive.h). DATA is sent from it like from a file mapped into
+ * memory, so the filesystem is never touched. Providers are shared
+ * by workers and keep no state of requests.
+ *
+ * The template provider serves names matching a pattern from a
+ * template read at start, with the client and the name substituted:
+ * %a - address of the client, e.g. 192.168.1.2,
+ * %x - the address in hex as PXELINUX looks it up, e.g. C0A80102,
+ * %p - port of the client,
+ * %n - the requested name,
+ * %% - a percent sign.
+ *
+ * @author Ivan Morozko <Ivan.Morozko@oktetlabs.ru>
+ *
+ * $Id: $
+ */
+
+#ifndef _TFTP_PROVIDER_
+#define _TFTP_PROVIDER_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <netinet/in.h>
+
+#define TFTP_MAX_TEMPLATES      16
+
+typedef struct tftp_provider {
+    struct tftp_provider    *next;
+    /**
+     * Generate file 'name' for 'client'.
+     *
+     * @param data      Location for the content, never NULL even
+     *                  if it is empty.
+     * @param len       Location for the size of the content.
+     * @param borrowed  Location for flag set if the content belongs
+     *                  to the provider and stays while the server
+     *                  runs, otherwise it is allocated with malloc().
+     *
+     * @return
+     *      Zero on success, 1 if the provider has no such file,
+     *      or -1, if error occured.
+     */
+    int                     (*get)(const struct tftp_provider *p,
+                                   const struct sockaddr_in *client,
+                                   const char *name,
+                                   uint8_t **data, size_t *len,
+                                   int *borrowed);
+} tftp_provider;
+
+extern int tftp_provider_get(const tftp_provider *providers,
+                             const struct sockaddr_in *client,
+                             const char *name, uint8_t **data,
+                             size_t *len, int *borrowed);
+
+extern tftp_provider *tftp_template_create(const char *pattern,
+                                           const char *path);
+
+#endif
@@ -4,7 +4,13 @@
  * The server listens on a server specified port.
  * It can handle read requests and serve files via TFTP protocol
  * as defined in RFC 1350.
+ * Option negotiation (RFC 2347) is supported for the block size
+ * (RFC 2348), timeout and transfer size (RFC 2349) and window size
+ * (RFC 7440) options.
  * It only serves files from a server specified directory.
+ * All transfers are multiplexed by event loops, one per worker thread;
+ * requests are spread across workers by SO_REUSEPORT. Optionally each
+ * request is served by a forked child process.
  *
  * @author Ivan Morozko <Ivan.Morozko@oktetlabs.ru>
  *
@@ -15,18 +21,82 @@
 #define _TFTP_SERVER_
 
 #include <signal.h>
+#include <pthread.h>
 
 #include "connection.h"
+#include "tftp_loop.h"
+#include "tftp_cache.h"
+#include "tftp_mcast.h"
+#include "tftp_pace.h"
+#include "tftp_provider.h"
+#include "tftp_archive.h"
+
+/* Event loop thread with its own socket on the server port. */
+typedef struct tftp_worker {
+    unsigned int      id;
+    int               cpu;              /* CPU to run on, -1 if any    */
+    conn_info         udp_conn;
+    pthread_t         thread;
+    int               running;          /* 'loop' is initialized       */
+    tftp_loop         loop;
+} tftp_worker;
 
 typedef struct tftp_server_data {
     conn_info         udp_conn;
     const char        *base_directory;
+    int               dir_fd;           /* O_PATH descriptor of
+                                         * 'base_directory'            */
+    int               fork_per_request; /* Serve each request in a child
+                                         * process instead of the event
+                                         * loop.                       */
+    size_t            cache_size;       /* bytes, 0 to serve files
+                                         * without the cache           */
+    tftp_cache        *cache;
+    tftp_mcast        *mcast;           /* NULL if multicast is disabled */
+    int               use_uring;        /* workers use io_uring instead
+                                         * of epoll if the kernel has it */
+    int               fsync;            /* TFTP_FSYNC_* of uploads     */
+    const char        *metrics;         /* file to write metrics to,
+                                         * NULL to not write them      */
+    tftp_bucket       *pacer;           /* bandwidth cap shared by
+                                         * workers and forked children,
+                                         * NULL if unlimited           */
+    unsigned long     client_rate;      /* bytes per second, 0 if
+                                         * unlimited                   */
+    tftp_provider     *providers;       /* of generated files, NULL if
+                                         * none                        */
+    int               stop_fd;          /* eventfd SIGTERM stops the
+                                         * server with                 */
+    unsigned int      n_workers;
+    tftp_worker       *workers;         /* workers[0] runs in the thread
+                                         * calling tftp_server_start() and
+                                         * shares 'udp_conn'.          */
 } tftp_server_data;
 
 typedef struct tftp_server_options {
     const char        *addr;
     const char        *port;
     const char        *dir;
+    int               fork_per_request;
+    unsigned int      workers;          /* 0 for one per online CPU    */
+    const char        *cpus;            /* CPU list to pin workers to,
+                                         * NULL to not pin them        */
+    unsigned long     cache_size;       /* MiB                         */
+    const char        *mcast_addr;      /* NULL to disable multicast   */
+    const char        *mcast_port;
+    const char        *io_engine;       /* "epoll" or "uring"          */
+    const char        *fsync;           /* "none" or "end"             */
+    const char        *metrics;         /* NULL to not write metrics   */
+    unsigned long     rate;             /* Mbit/s of the server and    */
+    unsigned long     client_rate;      /* of each client, 0 if
+                                         * unlimited                   */
+    const char        *templates[TFTP_MAX_TEMPLATES];     /* patterns of
+                                                           * generated  */
+    const char        *template_files[TFTP_MAX_TEMPLATES]; /* files and
+                                                            * templates */
+    unsigned int      n_templates;
+    const char        *archive;         /* tar or cpio archive to serve
+                                         * files from, NULL if none    */
 } tftp_server_options;
 
 extern int tftp_fill_server_data(tftp_server_data *ret,
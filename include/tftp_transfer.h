@@ -0,0 +1,172 @@
+/** @file
+ * @brief TFTP transfer state machine.
+ *
+ * Option negotiation and per-transfer state of read and write
+ * requests. A transfer never blocks waiting for the client: the event
+ * loop (see tftp_loop.h) feeds it with received messages and with
+ * expirations of its retransmission timer.
+ *
+ * @author Ivan Morozko <Ivan.Morozko@oktetlabs.ru>
+ *
+ * $Id: $
+ */
+
+#ifndef _TFTP_TRANSFER_
+#define _TFTP_TRANSFER_
+
+#include <stdio.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <netinet/in.h>
+
+#include "tftp_proto.h"
+#include "tftp_loop.h"
+#include "tftp_cache.h"
+#include "tftp_uring.h"
+#include "tftp_writer.h"
+
+/* Options that can be acknowledged in OACK. */
+#define TFTP_OPT_BLKSIZE        0x01
+#define TFTP_OPT_WINDOWSIZE     0x02
+#define TFTP_OPT_TIMEOUT        0x04
+#define TFTP_OPT_TSIZE          0x08
+#define TFTP_OPT_MULTICAST      0x10
+
+/* Transfer options negotiated with client as defined in RFC 2347. */
+typedef struct tftp_options {
+    unsigned int    accepted;       /* TFTP_OPT_* flags to put in OACK */
+    uint16_t        blksize;
+    uint16_t        windowsize;     /* blocks sent before waiting for ACK */
+    uint8_t         timeout;        /* seconds, 0 if not negotiated       */
+    unsigned long   tsize;          /* transfer size in bytes             */
+} tftp_options;
+
+/* Per-transfer retransmission timer, all values are in microseconds. */
+typedef struct tftp_rto {
+    long            srtt;           /* smoothed round-trip time, 0 if unknown */
+    long            rttvar;         /* round-trip time variation              */
+    long            rto;            /* current retransmission timeout         */
+    long            max;            /* upper bound for exponential backoff    */
+} tftp_rto;
+
+/* Point of netascii text sent where a block starts. */
+typedef struct tftp_text_pos {
+    off_t           offset;         /* of the file data translated      */
+    int             carry;          /* byte following CR not sent yet,
+                                     * -1 if none                        */
+} tftp_text_pos;
+
+enum tftp_transfer_state {
+    TFTP_TRANSFER_RUNNING,
+    TFTP_TRANSFER_COMPLETED,
+    TFTP_TRANSFER_FAILED
+};
+
+typedef struct tftp_transfer {
+    struct tftp_transfer    *hash_next;     /* next in loop hash bucket */
+    tftp_timer              timer;          /* retransmission timer     */
+    tftp_loop               *loop;
+    struct sockaddr_in      client_sock;
+    socklen_t               slen;
+    FILE                    *fd;
+    uint8_t                 *map;           /* content of the file read:
+                                             * cached copy, read-only
+                                             * mapping or generated
+                                             * content, NULL if it is
+                                             * read with pread()          */
+    tftp_cache_entry        *cached;        /* NULL if 'map' is not cached */
+    int                     text;           /* content is translated to
+                                             * netascii as it is sent     */
+    tftp_text_pos           *text_pos;      /* starts of the blocks of
+                                             * the window sent, NULL
+                                             * until the first window    */
+    uint64_t                text_base;      /* block acknowledged when
+                                             * the window was sent       */
+    uint8_t                 *text_buf;      /* file data read to be
+                                             * translated, may be NULL   */
+    int                     provided;       /* 'map' is generated by a
+                                             * provider, 'fd' is NULL     */
+    int                     borrowed;       /* 'map' belongs to the
+                                             * provider                   */
+    off_t                   file_size;      /* size of the regular file
+                                             * read, -1 if unknown        */
+    char                    *filename;
+    uint16_t                opcode;         /* RRQ or WRQ */
+    int                     mode;
+    int                     state;
+    tftp_options            opts;
+    tftp_rto                rto;
+    tftp_mcast_session      *session;       /* NULL if not multicast     */
+    struct tftp_transfer    *session_next;  /* next client waiting to
+                                             * become master             */
+    tftp_uring_xfer         io;             /* file I/O submitted to
+                                             * io_uring or the writer    */
+    tftp_write              *wbuf;          /* blocks not handed to the
+                                             * writer yet, may be NULL   */
+    int                     synced;         /* sync of the file written
+                                             * is submitted              */
+    int                     preallocated;   /* file written is laid out
+                                             * to the size from tsize    */
+
+    uint64_t                block_number;   /* last acknowledged block for
+                                             * RRQ, last block received in
+                                             * order for WRQ, counted past
+                                             * rollovers of the 16-bit
+                                             * number on the wire         */
+    uint16_t                window_len;     /* blocks in current window  */
+    int                     cr;             /* netascii block received
+                                             * ends with CR               */
+    int                     negotiating;    /* OACK is not acknowledged  */
+    int                     last_sent;      /* window ends with last block */
+    int                     rewound;        /* gap already acknowledged
+                                             * for WRQ, window already
+                                             * resent on a duplicate ACK
+                                             * for RRQ                   */
+    int                     retransmitted;
+    int                     paced;          /* window waits for tokens   */
+    tftp_bucket             pace;           /* rate of the client        */
+    unsigned int            sends;          /* transmissions of current
+                                             * window                    */
+    unsigned int            stale_acks;     /* duplicate ACKs expected
+                                             * from retransmissions of
+                                             * the previous window       */
+    int                     countdown;      /* retries left              */
+    long                    sent_at;        /* time of the transmission
+                                             * measured for RTT, 0 if none */
+
+    long                    started_at;     /* time of the request       */
+    uint64_t                highest_sent;   /* last new block sent       */
+    unsigned long           bytes;          /* file data sent once or
+                                             * received                  */
+    unsigned long           blocks;         /* DATA packets sent or
+                                             * received                  */
+    unsigned int            retransmits;    /* DATA, OACK or ACK packets
+                                             * resent                    */
+    unsigned int            timeouts;
+    unsigned int            rtt_samples;
+    long                    rtt_sum;
+} tftp_transfer;
+
+extern tftp_transfer *tftp_transfer_create(tftp_loop *loop,
+                                           tftp_message *msg,
+                                           ssize_t msg_len,
+                                           struct sockaddr_in *client_sock,
+                                           socklen_t slen);
+
+extern int tftp_transfer_start(tftp_transfer *t);
+
+extern int tftp_transfer_input(tftp_transfer *t, tftp_message *msg,
+                               ssize_t msg_len);
+
+extern int tftp_transfer_timeout(tftp_transfer *t);
+
+extern void tftp_transfer_promote(tftp_transfer *t);
+
+extern int tftp_transfer_written(tftp_transfer *t, int error);
+
+extern void tftp_transfer_destroy(tftp_transfer *t);
+
+extern int tftp_send_error(int s, int error_code, char *error_string,
+                           struct sockaddr_in *sock, socklen_t slen);
+
+#endif
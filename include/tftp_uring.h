@@ -0,0 +1,129 @@
+/** @file
+ * @brief io_uring engine of the TFTP event loop.
+ *
+ * Instead of waiting for readiness with epoll and moving packets with
+ * recvmmsg()/sendmmsg(), the loop keeps a multishot receive posted on
+ * a ring for each of its sockets and submits queued packets as sends.
+ * Messages are received into a ring of provided buffers in the order
+ * they arrive. File I/O goes through the same ring: blocks of read
+ * requests are read ahead of the window being sent, and blocks of write
+ * requests are written behind the window being received right from the
+ * receive buffers, so a slow disk does not stall the other transfers
+ * of the loop. Receive and read-ahead buffers are registered with
+ * the ring. The ring is set up with raw syscalls and needs Linux 6.0
+ * or newer, loops fall back to epoll on older kernels.
+ *
+ * @author Ivan Morozko <Ivan.Morozko@oktetlabs.ru>
+ *
+ * $Id: $
+ */
+
+#ifndef _TFTP_URING_
+#define _TFTP_URING_
+
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+
+#include "tftp_loop.h"
+
+#define TFTP_URING_ENTRIES      256     /* submission queue size          */
+#define TFTP_URING_RX_BUFS      64      /* receive buffers, a power of 2  */
+#define TFTP_URING_AHEAD_SLOTS  32      /* read requests reading ahead    */
+#define TFTP_URING_AHEAD_SIZE   (64 * 1024) /* bytes read ahead at once,
+                                             * a slot has two such halves */
+#define TFTP_URING_SYNCS        64      /* files being synced at once     */
+
+struct io_uring_sqe;
+struct io_uring_cqe;
+struct io_uring_buf_ring;
+struct tftp_transfer;
+
+/* I/O of a transfer submitted to the ring. */
+typedef struct tftp_uring_xfer {
+    int                     ahead;          /* read-ahead slot, -1 if none */
+    int                     reading;        /* half being read, -1 if none */
+    int                     queued;         /* read waits for the flush   */
+    struct tftp_transfer    *read_next;     /* next transfer waiting      */
+    uint64_t                block[2];       /* first block of each half,
+                                             * counted past rollovers     */
+    ssize_t                 size[2];        /* bytes asked for            */
+    ssize_t                 len[2];         /* bytes read, -1 if none     */
+    unsigned int            writes;         /* writes not completed       */
+    off_t                   offset;         /* of the next block written  */
+    int                     draining;       /* last block is received,
+                                             * writes are completing      */
+} tftp_uring_xfer;
+
+/* Completion waiting to be handled. */
+typedef struct tftp_uring_done {
+    uint64_t                user_data;
+    int32_t                 res;
+    uint32_t                flags;
+} tftp_uring_done;
+
+typedef struct tftp_uring {
+    int                     fd;
+    void                    *ring;          /* both rings share a mapping */
+    size_t                  ring_size;
+    struct io_uring_sqe     *sqes;
+    size_t                  sqes_size;
+    unsigned int            *sq_head;
+    unsigned int            *sq_tail;
+    unsigned int            sq_mask;
+    unsigned int            sq_entries;
+    unsigned int            *sq_array;
+    unsigned int            *cq_head;
+    unsigned int            *cq_tail;
+    unsigned int            cq_mask;
+    struct io_uring_cqe     *cqes;
+    int                     fixed;          /* buffers are registered     */
+    unsigned int            inflight;       /* submitted, not completed   */
+    unsigned int            sends;          /* sends not completed        */
+    tftp_uring_done         *done;          /* ring of 'cq_entries'       */
+    unsigned int            done_size;
+    unsigned int            done_head;
+    unsigned int            done_tail;
+    struct io_uring_buf_ring *rx_ring;      /* provided receive buffers */
+    uint8_t                 *rx;
+    uint16_t                rx_tail;        /* of 'rx_ring'               */
+    unsigned int            rx_out;         /* buffers taken from it      */
+    struct msghdr           rx_msg;         /* layout of received buffers */
+    int                     rx_socks[2];    /* server and transfer sockets */
+    int                     rx_armed[2];    /* receive is posted          */
+    uint8_t                 rx_held[TFTP_URING_RX_BUFS];    /* being written */
+    size_t                  rx_write_len[TFTP_URING_RX_BUFS];
+    long                    rx_write_at[TFTP_URING_RX_BUFS]; /* submitted */
+    struct tftp_transfer    *rx_writer[TFTP_URING_RX_BUFS];
+    uint8_t                 *ahead;         /* read-ahead slots           */
+    uint32_t                ahead_free;     /* bitmap of free slots       */
+    struct tftp_transfer    *ahead_owner[TFTP_URING_AHEAD_SLOTS];
+    struct tftp_transfer    *reads;         /* reads to submit after the
+                                             * queued packets are sent    */
+    struct tftp_transfer    *sync_owner[TFTP_URING_SYNCS];
+    long                    sync_at[TFTP_URING_SYNCS];  /* submitted      */
+} tftp_uring;
+
+extern int tftp_uring_create(tftp_loop *loop);
+
+extern void tftp_uring_destroy(tftp_loop *loop);
+
+extern void tftp_uring_flush(tftp_loop *loop);
+
+extern int tftp_uring_wait(tftp_loop *loop, struct timespec *ts);
+
+extern int tftp_uring_reserve(struct tftp_transfer *t);
+
+extern const uint8_t *tftp_uring_block(struct tftp_transfer *t,
+                                       uint64_t block, ssize_t *len);
+
+extern void tftp_uring_read_ahead(struct tftp_transfer *t, uint64_t block);
+
+extern int tftp_uring_write(struct tftp_transfer *t, const uint8_t *data,
+                            size_t len);
+
+extern int tftp_uring_sync(struct tftp_transfer *t);
+
+extern void tftp_uring_release(struct tftp_transfer *t);
+
+#endif
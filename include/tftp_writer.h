@@ -0,0 +1,89 @@
+/** @file
+ * @brief Write-behind of files uploaded by TFTP clients.
+ *
+ * Blocks of write requests are gathered into chunks and handed to
+ * a writer thread of the loop, so a block is acknowledged as soon as
+ * it is buffered and a slow disk does not throttle the client. The
+ * writer reports written chunks to the loop through an eventfd. Once
+ * the buffered data of a loop exceeds its budget, chunks are written
+ * by the loop itself, so clients are throttled by the disk again.
+ * Zero blocks, like erased pages of flash dumps, are left as holes
+ * in the file instead of being written.
+ *
+ * @author Ivan Morozko <Ivan.Morozko@oktetlabs.ru>
+ *
+ * $Id: $
+ */
+
+#ifndef _TFTP_WRITER_
+#define _TFTP_WRITER_
+
+#include <stdint.h>
+#include <pthread.h>
+#include <sys/types.h>
+
+#include "tftp_loop.h"
+
+#define TFTP_WRITER_CHUNK       (64 * 1024)         /* bytes per write   */
+#define TFTP_WRITER_BUDGET      (32 * 1024 * 1024)  /* bytes buffered by
+                                                     * the loop at most  */
+#define TFTP_WRITER_HOLE        4096                /* file system block
+                                                     * left as a hole    */
+
+/* How files of write requests are synced before the last ACK. */
+#define TFTP_FSYNC_NONE         0       /* left to the kernel          */
+#define TFTP_FSYNC_END          1       /* fdatasync() the whole file  */
+
+struct tftp_transfer;
+
+/* Chunk of a file to be written at 'offset', or synced if 'len' is 0. */
+typedef struct tftp_write {
+    struct tftp_write       *next;
+    struct tftp_transfer    *t;             /* NULL if the transfer is gone */
+    int                     fd;
+    off_t                   offset;
+    size_t                  len;
+    int                     sync;           /* fdatasync() the file     */
+    int                     punch;          /* punch zero blocks out of
+                                             * the preallocated file    */
+    size_t                  holes;          /* zero bytes not written   */
+    int                     error;          /* errno, 0 if written      */
+    long                    latency;        /* of the write, microseconds */
+    uint8_t                 data[];
+} tftp_write;
+
+typedef struct tftp_writer {
+    pthread_t               thread;
+    pthread_mutex_t         lock;
+    pthread_cond_t          queued;         /* a chunk is queued or the
+                                             * writer is stopped        */
+    pthread_cond_t          idle;           /* a chunk is written       */
+    int                     event_fd;       /* signals written chunks   */
+    tftp_write              *queue;         /* chunks to be written     */
+    tftp_write              **queue_tail;
+    tftp_write              *busy;          /* chunk being written      */
+    tftp_write              *done;          /* written chunks the loop
+                                             * has not handled yet      */
+    tftp_write              **done_tail;
+    size_t                  pending;        /* bytes queued or busy     */
+    int                     stop;
+} tftp_writer;
+
+extern int tftp_writer_zero(const uint8_t *data, size_t len);
+
+extern tftp_writer *tftp_writer_create(void);
+
+extern void tftp_writer_destroy(tftp_writer *writer);
+
+extern int tftp_writer_append(struct tftp_transfer *t, const uint8_t *data,
+                              size_t len);
+
+extern int tftp_writer_flush(struct tftp_transfer *t);
+
+extern int tftp_writer_sync(struct tftp_transfer *t);
+
+extern void tftp_writer_complete(tftp_loop *loop);
+
+extern void tftp_writer_release(struct tftp_transfer *t);
+
+#endif
@@ -18,17 +18,35 @@
 #define STD_HOST_ADDR            "192.168.1.3"
 #define STD_TFTP_PORT            "12345"
 #define STD_TFTP_DIRECTORY       "."
+#define STD_TFTP_WORKERS         "1"
+#define STD_TFTP_CACHE           "256"
+#define STD_TFTP_IO              "epoll"
+#define STD_TFTP_FSYNC           "none"
+#define STD_TFTP_RATE            "0"
 
 /* options which don't have a one-char version */
 #define OPT_TFTP_DIR             256
 #define OPT_CL_PROMPT            257
 #define OPT_LOGIN_PROMPT         258
 #define OPT_PWD_PROMPT           259
+#define OPT_TFTP_FORK            260
+#define OPT_TFTP_WORKERS         261
+#define OPT_TFTP_CPUS            262
+#define OPT_TFTP_CACHE           263
+#define OPT_TFTP_MCAST           264
+#define OPT_TFTP_IO              265
+#define OPT_TFTP_FSYNC           266
+#define OPT_TFTP_METRICS         267
+#define OPT_TFTP_RATE            268
+#define OPT_TFTP_CLIENT_RATE     269
+#define OPT_TFTP_TEMPLATE        270
+#define OPT_TFTP_ARCHIVE         271
+#define OPT_BATCH                272
 
 #define STD_A_ARG_VALUE          "\""STD_BOARD_ADDR":"STD_TELNET_PORT"\""
 #define STD_T_ARG_VALUE          "\""STD_HOST_ADDR":"STD_TFTP_PORT"\""
 
-#define OPTSTRING                ":hqp:u:t:a:P:"
+#define OPTSTRING                ":hqp:u:t:a:o:P:"
 
 exec_on_board_options global_opt;
 
@@ -40,10 +58,24 @@ static struct option long_opts[] =
     {"username",     required_argument, 0, 'u'},
     {"addr",         required_argument, 0, 'a'},
     {"tftp-addr",    required_argument, 0, 't'},
+    {"output",       required_argument, 0, 'o'},
+    {"batch",        required_argument, 0,  OPT_BATCH},
     {"tftp-dir",     required_argument, 0,  OPT_TFTP_DIR},
     {"cl-prompt",    required_argument, 0,  OPT_CL_PROMPT},
     {"login-prompt", required_argument, 0,  OPT_LOGIN_PROMPT},
     {"pwd-prompt",   required_argument, 0,  OPT_PWD_PROMPT},
+    {"tftp-fork",    no_argument,       0,  OPT_TFTP_FORK},
+    {"tftp-workers", required_argument, 0,  OPT_TFTP_WORKERS},
+    {"tftp-cpus",    required_argument, 0,  OPT_TFTP_CPUS},
+    {"tftp-cache",   required_argument, 0,  OPT_TFTP_CACHE},
+    {"tftp-mcast",   required_argument, 0,  OPT_TFTP_MCAST},
+    {"tftp-io",      required_argument, 0,  OPT_TFTP_IO},
+    {"tftp-fsync",   required_argument, 0,  OPT_TFTP_FSYNC},
+    {"tftp-metrics", required_argument, 0,  OPT_TFTP_METRICS},
+    {"tftp-rate",    required_argument, 0,  OPT_TFTP_RATE},
+    {"tftp-client-rate", required_argument, 0, OPT_TFTP_CLIENT_RATE},
+    {"tftp-template", required_argument, 0,  OPT_TFTP_TEMPLATE},
+    {"tftp-archive", required_argument, 0,  OPT_TFTP_ARCHIVE},
     {0, 0, 0, 0}
 };
 
@@ -59,10 +91,24 @@ static struct {
   { 'p', "<password>",         "Specify password for telnet server. Default value is %s.",   "\""STD_PASSWORD"\"" },
   { 'a', "<[ipaddr][:port]>",  "Specify board address and telnet port. Default value is %s.",    STD_A_ARG_VALUE },
   { 't', "<[ipaddr][:port]>",  "Specify address and port for tftp server. Default value is %s.", STD_T_ARG_VALUE },
+  { 'o', "<file>",             "Write output of the command to the file as it arrives, \"-\" for stdout.", NULL },
+  { OPT_BATCH,        "<file>", "Run commands of the file, one per line, as a batch instead of the built-in command.", NULL },
   { OPT_TFTP_DIR,     "<dir>", "Specify directory for tftp server. Default value is %s.",    "\""STD_TFTP_DIRECTORY"\"" },
   { OPT_CL_PROMPT,    "<str>", "Specify command line prompt. Default value is %s.",          "\""STD_CL_PROMPT"\"" },
   { OPT_LOGIN_PROMPT, "<str>", "Specify login prompt. Default value is %s.",                 "\""STD_LOGIN_PROMPT"\"" },
   { OPT_PWD_PROMPT,   "<str>", "Specify password prompt. Default value is %s.",              "\""STD_PASSWORD_PROMPT"\"" },
+  { OPT_TFTP_FORK,    NULL,    "Serve each tftp request in a separate process.",                NULL },
+  { OPT_TFTP_WORKERS, "<n>",   "Specify number of tftp server threads, 0 for one per CPU. Default value is %s.", STD_TFTP_WORKERS },
+  { OPT_TFTP_CPUS,    "<list>", "Specify CPUs to pin tftp server threads to, e.g. \"0,2-3\".",     NULL },
+  { OPT_TFTP_CACHE,   "<MiB>", "Specify memory budget of tftp file cache, 0 to disable it. Default value is %s.", STD_TFTP_CACHE },
+  { OPT_TFTP_MCAST,   "<group[:port]>", "Enable multicast tftp (RFC 2090) with groups at the address and ports from the port (1758 by default).", NULL },
+  { OPT_TFTP_IO,      "<epoll|uring>", "Specify I/O engine of tftp server, uring falls back to epoll on kernels older than 6.0. Default value is %s.", "\""STD_TFTP_IO"\"" },
+  { OPT_TFTP_FSYNC,   "<none|end>", "Specify if files uploaded to tftp server are synced to disk before the last block is acknowledged. Default value is %s.", "\""STD_TFTP_FSYNC"\"" },
+  { OPT_TFTP_METRICS, "<file>", "Write tftp server metrics in Prometheus text format to the file every 5 seconds.", NULL },
+  { OPT_TFTP_RATE,    "<Mbit/s>", "Specify bandwidth cap of tftp server, 0 for none. Default value is %s.", STD_TFTP_RATE },
+  { OPT_TFTP_CLIENT_RATE, "<Mbit/s>", "Specify bandwidth cap of each tftp client, 0 for none. Default value is %s.", STD_TFTP_RATE },
+  { OPT_TFTP_TEMPLATE, "<pattern:file>", "Serve tftp files matching the pattern from the template, with %%a, %%x, %%p and %%n replaced by client address, address in hex, port and file name. May be repeated.", NULL },
+  { OPT_TFTP_ARCHIVE, "<file>", "Serve tftp files read out of the tar or cpio archive before the tftp directory.", NULL },
   { 0, NULL, NULL, NULL }
 };
 
@@ -111,6 +157,8 @@ static void opts_print(void)
 static void set_defaults(void)
 {
     global_opt.flags                           = STD_FLAGS;
+    global_opt.output                          = NULL;
+    global_opt.batch                           = NULL;
     global_opt.telnet_opt.addr                 = STD_BOARD_ADDR;
     global_opt.telnet_opt.port                 = STD_TELNET_PORT;
     global_opt.telnet_opt.username             = STD_USERNAME;
@@ -121,6 +169,19 @@ static void set_defaults(void)
     global_opt.tftp_opt.addr                   = STD_HOST_ADDR;
     global_opt.tftp_opt.port                   = STD_TFTP_PORT;
     global_opt.tftp_opt.dir                    = STD_TFTP_DIRECTORY;
+    global_opt.tftp_opt.fork_per_request       = 0;
+    global_opt.tftp_opt.workers                = atoi(STD_TFTP_WORKERS);
+    global_opt.tftp_opt.cpus                   = NULL;
+    global_opt.tftp_opt.cache_size             = atol(STD_TFTP_CACHE);
+    global_opt.tftp_opt.mcast_addr             = NULL;
+    global_opt.tftp_opt.mcast_port             = NULL;
+    global_opt.tftp_opt.io_engine              = STD_TFTP_IO;
+    global_opt.tftp_opt.fsync                  = STD_TFTP_FSYNC;
+    global_opt.tftp_opt.metrics                = NULL;
+    global_opt.tftp_opt.rate                   = atol(STD_TFTP_RATE);
+    global_opt.tftp_opt.client_rate            = atol(STD_TFTP_RATE);
+    global_opt.tftp_opt.n_templates            = 0;
+    global_opt.tftp_opt.archive                = NULL;
 }
 
 /*
@@ -163,6 +224,50 @@ static void opts_parse_tftp(void)
         global_opt.tftp_opt.port = port;
 }
 
+/* Fill global_opt.tftp_opt multicast group with options from optarg.  */
+static void opts_parse_tftp_mcast(void)
+{
+    char *port;
+
+    port = split_chr(optarg, ':');
+
+    global_opt.tftp_opt.mcast_addr = optarg;
+
+    if (port && *port != '\0')
+        global_opt.tftp_opt.mcast_port = port;
+}
+
+/*
+ * Add template of generated tftp files from optarg.
+ *
+ * @return
+ *      Zero on success, or -1, if error occurred.
+ */
+static int opts_parse_tftp_template(void)
+{
+    tftp_server_options *tftp_opt = &global_opt.tftp_opt;
+    char                *file;
+
+    file = split_chr(optarg, ':');
+    if (file == NULL || *file == '\0' || *optarg == '\0')
+    {
+        fprintf(stderr, "Template should be given as <pattern:file>.\n");
+        return -1;
+    }
+
+    if (tftp_opt->n_templates == TFTP_MAX_TEMPLATES)
+    {
+        fprintf(stderr, "Too many templates.\n");
+        return -1;
+    }
+
+    tftp_opt->templates[tftp_opt->n_templates]      = optarg;
+    tftp_opt->template_files[tftp_opt->n_templates] = file;
+    tftp_opt->n_templates++;
+
+    return 0;
+}
+
 /* Fill global_opt.telnet_opt with options from optarg.  */
 static void opts_parse_telnet(void)
 {
@@ -216,6 +321,12 @@ int options_get(int argc, char **argv)
             case 'q':
                 global_opt.flags |= FLAG_QUIET;
                 break;
+            case 'o':
+                global_opt.output = optarg;
+                break;
+            case OPT_BATCH:
+                global_opt.batch = optarg;
+                break;
             case 'u':
                 global_opt.telnet_opt.username = optarg;
                 break;
@@ -234,6 +345,43 @@ int options_get(int argc, char **argv)
             case OPT_PWD_PROMPT:
                 global_opt.telnet_opt.password_prompt = optarg;
                 break;
+            case OPT_TFTP_FORK:
+                global_opt.tftp_opt.fork_per_request = 1;
+                break;
+            case OPT_TFTP_WORKERS:
+                global_opt.tftp_opt.workers = atoi(optarg);
+                break;
+            case OPT_TFTP_CPUS:
+                global_opt.tftp_opt.cpus = optarg;
+                break;
+            case OPT_TFTP_CACHE:
+                global_opt.tftp_opt.cache_size = strtoul(optarg, NULL, 10);
+                break;
+            case OPT_TFTP_MCAST:
+                opts_parse_tftp_mcast();
+                break;
+            case OPT_TFTP_IO:
+                global_opt.tftp_opt.io_engine = optarg;
+                break;
+            case OPT_TFTP_FSYNC:
+                global_opt.tftp_opt.fsync = optarg;
+                break;
+            case OPT_TFTP_METRICS:
+                global_opt.tftp_opt.metrics = optarg;
+                break;
+            case OPT_TFTP_RATE:
+                global_opt.tftp_opt.rate = strtoul(optarg, NULL, 10);
+                break;
+            case OPT_TFTP_CLIENT_RATE:
+                global_opt.tftp_opt.client_rate = strtoul(optarg, NULL, 10);
+                break;
+            case OPT_TFTP_TEMPLATE:
+                if (opts_parse_tftp_template())
+                    goto abort;
+                break;
+            case OPT_TFTP_ARCHIVE:
+                global_opt.tftp_opt.archive = optarg;
+                break;
             case ':':
                 fprintf(stderr, "Option -%c requires an argument.\n", optopt);
                 goto abort;
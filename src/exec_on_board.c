@@ -17,6 +17,67 @@ static telnet_cmd_data tmp_get_backup_cmd = {
 
 extern exec_on_board_options global_opt;
 
+/**
+ * Read commands of batch file 'path', one per line, into 'cmds'.
+ * Empty lines are skipped.
+ *
+ * @return
+ *      Number of commands, or -1, if error occurred.
+ *
+ * @se
+ *      Prints information about occurred error to stderr.
+ */
+static int batch_read(const char *path, telnet_cmd_data **cmds)
+{
+    telnet_cmd_data *tmp;
+    char            *cmd;
+    char            *line = NULL;
+    size_t          size  = 0;
+    ssize_t         len;
+    int             n     = 0;
+    FILE            *f;
+
+    *cmds = NULL;
+
+    f = fopen(path, "r");
+    if (f == NULL)
+    {
+        perror("fopen()");
+        return -1;
+    }
+
+    while ((len = getline(&line, &size, f)) != -1)
+    {
+        while (len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r'))
+            line[--len] = '\0';
+        if (len == 0)
+            continue;
+
+        tmp = realloc(*cmds, (n + 1) * sizeof(**cmds));
+        cmd = tmp == NULL ? NULL : strdup(line);
+        if (cmd == NULL)
+        {
+            perror("batch_read()");
+            if (tmp != NULL)
+                *cmds = tmp;
+            while (n > 0)
+                free((char *)(*cmds)[--n].command);
+            free(*cmds);
+            *cmds = NULL;
+            n = -1;
+            break;
+        }
+
+        *cmds = tmp;
+        memset(&(*cmds)[n], 0, sizeof(**cmds));
+        (*cmds)[n++].command = cmd;
+    }
+
+    free(line);
+    fclose(f);
+    return n;
+}
+
 int main(int argc, char **argv)
 {
     int                 retval;
@@ -24,11 +85,22 @@ int main(int argc, char **argv)
     int                 tftp_server_status;
     tftp_server_data    tftp_server_data;
     telnet_board_data   board_control_data;
+    FILE                *output = NULL;
+    telnet_cmd_data     *batch  = NULL;
+    int                 n_batch = 0;
+    int                 i;
 
     retval = options_get(argc, argv);
     if (retval)
         return retval;
 
+    if (global_opt.batch != NULL)
+    {
+        n_batch = batch_read(global_opt.batch, &batch);
+        if (n_batch == -1)
+            return -1;
+    }
+
     retval = tftp_fill_server_data(&tftp_server_data,
                                    &global_opt.tftp_opt);
     if (retval)
@@ -56,8 +128,33 @@ int main(int argc, char **argv)
             if (retval)
                 goto cleanup;
 
-            retval = telnet_execute_command(&board_control_data,
-                                            &tmp_get_backup_cmd);
+            if (global_opt.output != NULL)
+            {
+                output = strcmp(global_opt.output, "-") == 0 ? stdout :
+                         fopen(global_opt.output, "w");
+                if (output == NULL)
+                {
+                    perror("fopen()");
+                    retval = -1;
+                    goto cleanup;
+                }
+
+                tmp_get_backup_cmd.output     = telnet_output_file;
+                tmp_get_backup_cmd.output_arg = output;
+
+                for (i = 0; i < n_batch; i++)
+                {
+                    batch[i].output     = telnet_output_file;
+                    batch[i].output_arg = output;
+                }
+            }
+
+            if (global_opt.batch != NULL)
+                retval = telnet_execute_batch(&board_control_data,
+                                              batch, n_batch);
+            else
+                retval = telnet_execute_command(&board_control_data,
+                                                &tmp_get_backup_cmd);
             if (retval)
                 goto cleanup;
 
@@ -65,6 +162,14 @@ int main(int argc, char **argv)
     }
 
 cleanup:
+    if (output != NULL && output != stdout && fclose(output))
+    {
+        perror("fclose()");
+        retval = -1;
+    }
+    for (i = 0; i < n_batch; i++)
+        free((char *)batch[i].command);
+    free(batch);
     telnet_free_board_data(&board_control_data);
     tftp_server_stop(tftp_server_pid);
     wait(&tftp_server_status);
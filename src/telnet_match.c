@@ -0,0 +1,169 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "include/telnet_match.h"
+
+/**
+ * Compile 'n_patterns' 'patterns' into matcher 'm'. Empty patterns
+ * never match.
+ *
+ * @return
+ *      Zero on success, or -1, if error occured.
+ */
+int telnet_match_init(telnet_match *m, const char *const *patterns,
+                      unsigned int n_patterns)
+{
+    const char      *c;
+    uint16_t        *fail;
+    uint16_t        *queue;
+    unsigned int    head;
+    unsigned int    tail;
+    unsigned int    max_states = 1;
+    unsigned int    i;
+    unsigned int    b;
+    uint16_t        s;
+    uint16_t        u;
+
+    memset(m, 0, sizeof(*m));
+
+    if (n_patterns > TELNET_MATCH_MAX_PATTERNS)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    for (i = 0; i < n_patterns; i++)
+        max_states += strlen(patterns[i]);
+
+    if (max_states > UINT16_MAX)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    m->next  = calloc(max_states, sizeof(*m->next));
+    m->out   = malloc(max_states * sizeof(*m->out));
+    m->depth = malloc(max_states * sizeof(*m->depth));
+    fail     = malloc(max_states * sizeof(*fail));
+    queue    = malloc(max_states * sizeof(*queue));
+    if (m->next == NULL || m->out == NULL || m->depth == NULL ||
+        fail == NULL || queue == NULL)
+    {
+        free(fail);
+        free(queue);
+        telnet_match_destroy(m);
+        return -1;
+    }
+
+    memset(m->out, TELNET_MATCH_NONE, max_states * sizeof(*m->out));
+    m->n_states = 1;
+    m->depth[0] = 0;
+
+    /* trie of the patterns, state 0 is the root */
+    for (i = 0; i < n_patterns; i++)
+    {
+        if (patterns[i][0] == '\0')
+            continue;
+
+        for (s = 0, c = patterns[i]; *c != '\0'; c++)
+        {
+            if (m->next[s][(uint8_t)*c] == 0)
+            {
+                m->depth[m->n_states]   = m->depth[s] + 1;
+                m->next[s][(uint8_t)*c] = m->n_states++;
+            }
+            s = m->next[s][(uint8_t)*c];
+        }
+
+        if (m->out[s] == TELNET_MATCH_NONE)
+            m->out[s] = i;
+    }
+
+    /*
+     * Breadth-first, missing transitions of a state are taken from its
+     * failure state, the longest proper suffix of it in the trie, which
+     * is shallower and so complete already.
+     */
+    head = tail = 0;
+    queue[tail++] = 0;
+    fail[0]       = 0;
+
+    while (head < tail)
+    {
+        s = queue[head++];
+
+        for (b = 0; b < 256; b++)
+        {
+            u = m->next[s][b];
+            if (u == 0)
+            {
+                m->next[s][b] = s == 0 ? 0 : m->next[fail[s]][b];
+                continue;
+            }
+
+            fail[u] = s == 0 ? 0 : m->next[fail[s]][b];
+            if (m->out[u] == TELNET_MATCH_NONE ||
+                (m->out[fail[u]] != TELNET_MATCH_NONE &&
+                 m->out[fail[u]] < m->out[u]))
+                m->out[u] = m->out[fail[u]];
+
+            queue[tail++] = u;
+        }
+    }
+
+    free(fail);
+    free(queue);
+
+    return 0;
+}
+
+/** Free automaton of 'm'. */
+void telnet_match_destroy(telnet_match *m)
+{
+    free(m->next);
+    free(m->out);
+    free(m->depth);
+    m->next  = NULL;
+    m->out   = NULL;
+    m->depth = NULL;
+}
+
+/** Start matching a new stream with 'm'. */
+void telnet_match_reset(telnet_match *m)
+{
+    m->state = 0;
+    m->pos   = 0;
+}
+
+/**
+ * Feed 'len' bytes of 'buf' to 'm' until a pattern is found.
+ * Bytes after the match are not fed, the caller feeds them again
+ * from 'end' to find the next match.
+ *
+ * @return
+ *      Index of the pattern ending at 'end' bytes of 'buf', 'm->pos'
+ *      bytes of the stream, or TELNET_MATCH_NONE, if no pattern ends
+ *      in 'buf', then 'end' is 'len'.
+ */
+int telnet_match_feed(telnet_match *m, const char *buf, size_t len,
+                      size_t *end)
+{
+    size_t  i;
+
+    for (i = 0; i < len; i++)
+    {
+        m->state = m->next[m->state][(uint8_t)buf[i]];
+        if (m->out[m->state] != TELNET_MATCH_NONE)
+        {
+            m->pos += i + 1;
+            *end    = i + 1;
+            return m->out[m->state];
+        }
+    }
+
+    m->pos += len;
+    *end    = len;
+
+    return TELNET_MATCH_NONE;
+}
@@ -4,12 +4,42 @@
 #include <sys/socket.h>
 #include <stdlib.h>
 #include <unistd.h>
+#include <time.h>
+#include <arpa/telnet.h>
 
 #include "include/telnet_remote_control.h"
+#include "include/telnet_match.h"
 
-#define MAX_RECV_BUFF_SIZE  10000
+#define RING_SIZE           (128 * 1024)    /* > the longest pattern */
+#define REPORT_SIZE         10000   /* end of output shown on error */
 #define TIMEOUT             3
 
+/* window size advertised, so the board does not wrap long lines */
+#define NAWS_WIDTH          10000
+#define NAWS_HEIGHT         10000
+
+/* states of an option of telnet_nvt */
+#define OPT_NO              0
+#define OPT_YES             1
+#define OPT_WANTYES         2       /* asked for, not answered yet */
+
+/* states of the parser of telnet_nvt */
+#define NVT_DATA            0
+#define NVT_CR              1       /* CR received, NUL after it is dropped */
+#define NVT_IAC             2
+#define NVT_OPT             3       /* option of WILL, WONT, DO or DONT */
+#define NVT_SB              4       /* subnegotiation, skipped */
+#define NVT_SB_IAC          5
+
+/* patterns of a command looked for in its output */
+#define MATCH_PROMPT        0
+#define MATCH_ERROR         1
+#define MATCH_PATTERNS      2       /* the first of telnet_cmd_data */
+#define MATCH_MARKER        1       /* of a batch instead of the error */
+
+/* start of lines echoed after commands of a batch, a nonce follows */
+#define MARKER              "EOB"
+
 /**
  * Fill 'ret' structure with appropriate data.
  *
@@ -26,6 +56,7 @@ int telnet_fill_board_data(telnet_board_data *ret, telnet_auth_options *opt)
         return retval;
 
     ret->opt = opt;
+    memset(&ret->nvt, 0, sizeof(ret->nvt));
 
     return retval;
 }
@@ -54,8 +85,308 @@ int telnet_free_board_data(telnet_board_data *data)
 }
 
 /**
- * Wait for TIMEOUT seconds until server sends data that contains
- * 'expected' as substring.
+ * Send replies to options queued in telnet_nvt of 'data'.
+ *
+ * @return
+ *      Zero on success, or -1, if error occured.
+ *
+ * @se
+ *      Prints information about occurred error to stderr.
+ */
+static int telnet_nvt_flush(telnet_board_data *data)
+{
+    telnet_nvt  *nvt = &data->nvt;
+
+    if (nvt->reply_len > 0 &&
+        send(get_sock(&data->tcp_conn), nvt->reply, nvt->reply_len, 0) == -1)
+    {
+        perror("telnet: send()");
+        return -1;
+    }
+
+    nvt->reply_len = 0;
+
+    return 0;
+}
+
+/**
+ * Queue 'len' bytes of 'cmd' to the server.
+ *
+ * @return
+ *      Zero on success, or -1, if error occured.
+ */
+static int telnet_nvt_queue(telnet_board_data *data, const uint8_t *cmd,
+                            size_t len)
+{
+    telnet_nvt  *nvt = &data->nvt;
+
+    if (nvt->reply_len + len > sizeof(nvt->reply) && telnet_nvt_flush(data))
+        return -1;
+
+    memcpy(nvt->reply + nvt->reply_len, cmd, len);
+    nvt->reply_len += len;
+
+    return 0;
+}
+
+/**
+ * Queue command 'cmd' of option 'opt' to the server.
+ *
+ * @return
+ *      Zero on success, or -1, if error occured.
+ */
+static int telnet_nvt_send(telnet_board_data *data, uint8_t cmd, uint8_t opt)
+{
+    uint8_t msg[] = { IAC, cmd, opt };
+
+    return telnet_nvt_queue(data, msg, sizeof(msg));
+}
+
+/**
+ * Queue our window size to the server, once it agreed to NAWS
+ * (RFC 1073).
+ *
+ * @return
+ *      Zero on success, or -1, if error occured.
+ */
+static int telnet_nvt_naws(telnet_board_data *data)
+{
+    static const uint8_t msg[] = {
+        IAC, SB, TELOPT_NAWS, NAWS_WIDTH >> 8, NAWS_WIDTH & 0xff,
+        NAWS_HEIGHT >> 8, NAWS_HEIGHT & 0xff, IAC, SE
+    };
+
+    return telnet_nvt_queue(data, msg, sizeof(msg));
+}
+
+/**
+ * Ask the board to suppress go-ahead both ways and offer it our window
+ * size. Remote echo is refused when the board offers it.
+ *
+ * @return
+ *      Zero on success, or -1, if error occured.
+ *
+ * @se
+ *      Prints information about occurred error to stderr.
+ */
+static int telnet_nvt_start(telnet_board_data *data)
+{
+    telnet_nvt  *nvt = &data->nvt;
+
+    nvt->remote[TELOPT_SGA] = OPT_WANTYES;
+    nvt->local[TELOPT_SGA]  = OPT_WANTYES;
+    nvt->local[TELOPT_NAWS] = OPT_WANTYES;
+
+    if (telnet_nvt_send(data, DO, TELOPT_SGA) ||
+        telnet_nvt_send(data, WILL, TELOPT_SGA) ||
+        telnet_nvt_send(data, WILL, TELOPT_NAWS))
+        return -1;
+
+    return telnet_nvt_flush(data);
+}
+
+/**
+ * Answer command 'cmd' of option 'opt' of the server. Only options
+ * we want are agreed to, and an option that is in the state asked
+ * for already is not answered, so negotiation never loops.
+ *
+ * @return
+ *      Zero on success, or -1, if error occured.
+ */
+static int telnet_nvt_option(telnet_board_data *data, uint8_t cmd,
+                             uint8_t opt)
+{
+    telnet_nvt  *nvt    = &data->nvt;
+    int         remote  = cmd == WILL || cmd == WONT;
+    int         enable  = cmd == WILL || cmd == DO;
+    uint8_t     *state  = remote ? &nvt->remote[opt] : &nvt->local[opt];
+    int         want;
+
+    /* the board echoes nothing, and we echo nothing locally */
+    want = opt == TELOPT_SGA || (!remote && opt == TELOPT_NAWS);
+
+    if (!enable)
+    {
+        if (*state == OPT_YES)
+        {
+            *state = OPT_NO;
+            return telnet_nvt_send(data, remote ? DONT : WONT, opt);
+        }
+        *state = OPT_NO;
+        return 0;
+    }
+
+    if (*state == OPT_YES)
+        return 0;
+
+    if (*state == OPT_NO)
+    {
+        if (!want)
+            return telnet_nvt_send(data, remote ? DONT : WONT, opt);
+
+        if (telnet_nvt_send(data, remote ? DO : WILL, opt))
+            return -1;
+    }
+
+    *state = OPT_YES;
+
+    if (!remote && opt == TELOPT_NAWS)
+        return telnet_nvt_naws(data);
+
+    return 0;
+}
+
+/**
+ * Strip telnet commands from 'len' bytes of 'buf' received from
+ * the server, answering option negotiation, and unescape data.
+ * The parser state is kept across chunks.
+ *
+ * @return
+ *      Number of data bytes left in 'buf', or -1, if error occured.
+ *
+ * @se
+ *      Prints information about occurred error to stderr.
+ */
+static ssize_t telnet_nvt_filter(telnet_board_data *data, char *buf,
+                                 size_t len)
+{
+    telnet_nvt  *nvt = &data->nvt;
+    size_t      i;
+    size_t      n = 0;
+    uint8_t     c;
+
+    for (i = 0; i < len; i++)
+    {
+        c = buf[i];
+
+        switch (nvt->state)
+        {
+            case NVT_CR:
+                nvt->state = NVT_DATA;
+                if (c == '\0')
+                    break;
+                /* fall through */
+            case NVT_DATA:
+                if (c == IAC)
+                {
+                    nvt->state = NVT_IAC;
+                    break;
+                }
+                if (c == '\r')
+                    nvt->state = NVT_CR;
+                buf[n++] = c;
+                break;
+
+            case NVT_IAC:
+                nvt->state = NVT_DATA;
+                if (c == IAC)
+                    buf[n++] = c;
+                else if (c == SB)
+                    nvt->state = NVT_SB;
+                else if (c >= WILL && c <= DONT)
+                {
+                    nvt->cmd   = c;
+                    nvt->state = NVT_OPT;
+                }
+                break;
+
+            case NVT_OPT:
+                nvt->state = NVT_DATA;
+                if (telnet_nvt_option(data, nvt->cmd, c))
+                    return -1;
+                break;
+
+            case NVT_SB:
+                if (c == IAC)
+                    nvt->state = NVT_SB_IAC;
+                break;
+
+            case NVT_SB_IAC:
+                nvt->state = c == SE ? NVT_DATA : NVT_SB;
+                break;
+        }
+    }
+
+    if (telnet_nvt_flush(data))
+        return -1;
+
+    return n;
+}
+
+/**
+ * Output of the server received by telnet_recv_match(). Bytes are
+ * counted from the start of the output, byte 'pos' of it is kept in
+ * 'ring[pos % RING_SIZE]' until RING_SIZE more bytes are received,
+ * so memory does not grow with the output.
+ */
+typedef struct telnet_recv {
+    char                ring[RING_SIZE];
+    uint64_t            len;        /* bytes received                  */
+    uint64_t            fed;        /* of them fed to the matcher      */
+    uint64_t            sent;       /* of them passed to 'output'      */
+    telnet_output_cb    output;     /* or NULL to only keep the output */
+    void                *output_arg;
+} telnet_recv;
+
+/** Start receiving output passed to 'output' with 'output_arg'. */
+static void telnet_recv_init(telnet_recv *rcv, telnet_output_cb output,
+                             void *output_arg)
+{
+    rcv->len        = 0;
+    rcv->fed        = 0;
+    rcv->sent       = 0;
+    rcv->output     = output;
+    rcv->output_arg = output_arg;
+}
+
+/**
+ * Pass output of 'rcv' up to byte 'end' to its consumer.
+ *
+ * @return
+ *      Zero on success, or -1, if error occured.
+ */
+static int telnet_recv_output(telnet_recv *rcv, uint64_t end)
+{
+    size_t  off;
+    size_t  len;
+
+    while (rcv->sent < end)
+    {
+        off = rcv->sent % RING_SIZE;
+        len = end - rcv->sent < RING_SIZE - off ?
+              end - rcv->sent : RING_SIZE - off;
+
+        if (rcv->output != NULL &&
+            rcv->output(rcv->output_arg, rcv->ring + off, len))
+            return -1;
+
+        rcv->sent += len;
+    }
+
+    return 0;
+}
+
+/** Print the last REPORT_SIZE bytes of output of 'rcv' to stderr. */
+static void telnet_recv_report(const telnet_recv *rcv)
+{
+    uint64_t    pos = rcv->len > REPORT_SIZE ? rcv->len - REPORT_SIZE : 0;
+    size_t      off;
+    size_t      len;
+
+    fprintf(stderr, "----------------------------------\n");
+    for (; pos < rcv->len; pos += len)
+    {
+        off = pos % RING_SIZE;
+        len = rcv->len - pos < RING_SIZE - off ?
+              rcv->len - pos : RING_SIZE - off;
+        fwrite(rcv->ring + off, 1, len, stderr);
+    }
+    fprintf(stderr, "\n----------------------------------\n");
+}
+
+/**
+ * Receive the next chunk of output into 'rcv', with telnet commands
+ * stripped from it.
  *
  * @return
  *      Zero on success, or -1, if TIMEOUT reached or error occured.
@@ -63,18 +394,65 @@ int telnet_free_board_data(telnet_board_data *data)
  * @se
  *      Prints information about occurred error to stderr.
  */
-static int telnet_recv_str(telnet_board_data *data,
-                           const char *expected, char *buff)
+static int telnet_recv_more(telnet_board_data *data, telnet_recv *rcv)
 {
-    int retval;
-    int offset;
-    int s;
-    struct timeval tv;
+    ssize_t retval;
+    size_t  off;
+    size_t  len;
+
+    /* bytes not passed to the consumer yet are never overwritten */
+    off = rcv->len % RING_SIZE;
+    len = RING_SIZE - (rcv->len - rcv->sent) < RING_SIZE - off ?
+          RING_SIZE - (rcv->len - rcv->sent) : RING_SIZE - off;
+
+    retval = recv(get_sock(&data->tcp_conn), rcv->ring + off, len, 0);
+    if (retval == -1)
+    {
+        perror("telnet: recv()");
+        return -1;
+    }
+    if (retval == 0)
+    {
+        fprintf(stderr, "telnet: connection closed by server\n");
+        return -1;
+    }
+
+    retval = telnet_nvt_filter(data, rcv->ring + off, retval);
+    if (retval == -1)
+        return -1;
+
+    rcv->len += retval;
+
+    return 0;
+}
+
+/**
+ * Wait for TIMEOUT seconds until server sends data that contains one of
+ * the patterns of 'm'. Each chunk received is fed to 'm' once, bytes
+ * following a match are kept for the next call. Output is passed to
+ * the consumer of 'rcv' as soon as no pattern may start in it, so
+ * the output of a command never includes its prompt.
+ *
+ * @return
+ *      Index of the pattern found, or -1, if TIMEOUT reached or error
+ *      occured.
+ *
+ * @se
+ *      Prints information about occurred error to stderr.
+ */
+static int telnet_recv_match(telnet_board_data *data, telnet_match *m,
+                             telnet_recv *rcv)
+{
+    int             retval;
+    int             s;
+    size_t          off;
+    size_t          len;
+    size_t          end;
+    struct timeval  tv;
 
     s           = get_sock(&data->tcp_conn);
     tv.tv_sec   = TIMEOUT;
     tv.tv_usec  = 0;
-    offset      = 0;
 
     retval = setsockopt(s, SOL_SOCKET, SO_RCVTIMEO, (char *)&tv, sizeof(tv));
     if (retval)
@@ -85,19 +463,49 @@ static int telnet_recv_str(telnet_board_data *data,
 
     while (1)
     {
-        retval = recv(s, buff + offset, MAX_RECV_BUFF_SIZE, 0);
-        if (retval == -1)
+        while (rcv->fed < rcv->len)
         {
-            perror("telnet: recv()");
-            break;
+            off = rcv->fed % RING_SIZE;
+            len = rcv->len - rcv->fed < RING_SIZE - off ?
+                  rcv->len - rcv->fed : RING_SIZE - off;
+
+            retval = telnet_match_feed(m, rcv->ring + off, len, &end);
+            rcv->fed += end;
+            if (retval != TELNET_MATCH_NONE)
+                return retval;
         }
 
-        offset += retval;
+        if (telnet_recv_output(rcv, rcv->fed - telnet_match_partial(m)) ||
+            telnet_recv_more(data, rcv))
+            return -1;
+    }
+}
+
+/**
+ * Wait for TIMEOUT seconds until server sends 'expected'.
+ *
+ * @return
+ *      Zero on success, or -1, if TIMEOUT reached or error occured.
+ *
+ * @se
+ *      Prints information about occurred error to stderr.
+ */
+static int telnet_recv_str(telnet_board_data *data, const char *expected,
+                           telnet_recv *rcv)
+{
+    telnet_match    m;
+    int             retval;
 
-        if (strstr(buff, expected))
-            return 0;
+    retval = telnet_match_init(&m, &expected, 1);
+    if (retval)
+    {
+        perror("telnet: telnet_match_init()");
+        return retval;
     }
 
+    retval = telnet_recv_match(data, &m, rcv);
+    telnet_match_destroy(&m);
+
     return retval;
 }
 
@@ -147,39 +555,40 @@ static int telnet_send_str(telnet_board_data *data, const char *str)
  */
 int telnet_auth(telnet_board_data *data)
 {
-    int  retval;
-    char recv_buff[MAX_RECV_BUFF_SIZE] = {0};
+    int         retval;
+    telnet_recv rcv;
+
+    telnet_recv_init(&rcv, NULL, NULL);
 
     retval = socket_connect(&data->tcp_conn);
     if (retval)
         return retval;
 
-    retval = telnet_recv_str(data, data->opt->login_prompt, recv_buff);
+    retval = telnet_nvt_start(data);
     if (retval)
         return retval;
 
-    memset(recv_buff, 0, MAX_RECV_BUFF_SIZE);
+    retval = telnet_recv_str(data, data->opt->login_prompt, &rcv);
+    if (retval)
+        return retval;
 
     retval = telnet_send_str(data, data->opt->username);
     if (retval)
         return retval;
 
-    retval = telnet_recv_str(data, data->opt->password_prompt, recv_buff);
+    retval = telnet_recv_str(data, data->opt->password_prompt, &rcv);
     if (retval)
         return retval;
 
-    memset(recv_buff, 0, MAX_RECV_BUFF_SIZE);
-
     retval = telnet_send_str(data, data->opt->password);
     if (retval)
         return retval;
 
-    retval = telnet_recv_str(data, data->opt->cl_prompt, recv_buff);
+    retval = telnet_recv_str(data, data->opt->cl_prompt, &rcv);
     if (retval)
     {
-        fprintf(stderr, "Error occured. Telnet output:\n"
-                        "----------------------------------\n%s\n"
-                        "----------------------------------\n", recv_buff);
+        fprintf(stderr, "Error occured. Telnet output:\n");
+        telnet_recv_report(&rcv);
         return retval;
     }
 
@@ -187,7 +596,11 @@ int telnet_auth(telnet_board_data *data)
 }
 
 /**
- * Execute command specified in 'cmd_data' on telnet server.
+ * Execute command specified in 'cmd_data' on telnet server. The output
+ * is scanned once for the command line prompt, the error substring and
+ * other patterns of 'cmd_data' together, patterns found are set in
+ * 'cmd_data->found'. The output up to the prompt is streamed to
+ * 'cmd_data->output' as it arrives.
  *
  * @return
  *      Zero on success, or -1, if error occurred.
@@ -197,24 +610,304 @@ int telnet_auth(telnet_board_data *data)
  */
 int telnet_execute_command(telnet_board_data *data, telnet_cmd_data *cmd_data)
 {
-    int  retval;
-    char recv_buff[MAX_RECV_BUFF_SIZE] = {0};
+    const char      *patterns[TELNET_MATCH_MAX_PATTERNS];
+    unsigned int    n_patterns = MATCH_PATTERNS;
+    uint64_t        error_pos  = 0;
+    int             error      = 0;
+    int             retval;
+    telnet_match    m;
+    telnet_recv     rcv;
+
+    patterns[MATCH_PROMPT] = data->opt->cl_prompt;
+    patterns[MATCH_ERROR]  = cmd_data->error_substr != NULL ?
+                             cmd_data->error_substr : "";
+
+    for (; cmd_data->patterns != NULL &&
+           cmd_data->patterns[n_patterns - MATCH_PATTERNS] != NULL;
+         n_patterns++)
+    {
+        if (n_patterns == TELNET_MATCH_MAX_PATTERNS)
+        {
+            fprintf(stderr, "telnet: too many patterns to look for\n");
+            return -1;
+        }
+        patterns[n_patterns] = cmd_data->patterns[n_patterns - MATCH_PATTERNS];
+    }
 
-    retval = telnet_send_str(data, cmd_data->command);
+    retval = telnet_match_init(&m, patterns, n_patterns);
     if (retval)
+    {
+        perror("telnet: telnet_match_init()");
         return retval;
+    }
+
+    cmd_data->found = 0;
+    telnet_recv_init(&rcv, cmd_data->output, cmd_data->output_arg);
 
-    retval = telnet_recv_str(data, data->opt->cl_prompt, recv_buff);
+    retval = telnet_send_str(data, cmd_data->command);
     if (retval)
-        return retval;
+        goto out;
+
+    while ((retval = telnet_recv_match(data, &m, &rcv)) > MATCH_PROMPT)
+    {
+        if (retval == MATCH_ERROR && !error)
+        {
+            error     = 1;
+            error_pos = m.pos - strlen(patterns[MATCH_ERROR]);
+        }
+        else if (retval >= MATCH_PATTERNS)
+        {
+            cmd_data->found |= 1u << (retval - MATCH_PATTERNS);
+        }
+    }
+
+    if (retval)
+        goto out;
+
+    retval = telnet_recv_output(&rcv,
+                                rcv.fed - strlen(patterns[MATCH_PROMPT]));
+    if (retval)
+        goto out;
+
+    if (error)
+    {
+        fprintf(stderr, "Error occured: \"%s\" at byte %llu of output. "
+                        "Telnet output:\n",
+                patterns[MATCH_ERROR], (unsigned long long)error_pos);
+        telnet_recv_report(&rcv);
+        retval = -1;
+    }
+
+out:
+    telnet_match_destroy(&m);
+    return retval;
+}
+
+/**
+ * Read the rest "<index>:<status>" of the marker line following
+ * the marker found in 'rcv', and the line end.
+ *
+ * @return
+ *      Zero on success, or -1, if error occured.
+ *
+ * @se
+ *      Prints information about occurred error to stderr.
+ */
+static int telnet_recv_marker(telnet_board_data *data, telnet_recv *rcv,
+                              unsigned int *index, int *status)
+{
+    char    line[32];
+    size_t  n = 0;
+    char    c;
+
+    while (1)
+    {
+        /* a chunk of telnet commands only adds no data */
+        while (rcv->fed == rcv->len)
+            if (telnet_recv_more(data, rcv))
+                return -1;
+
+        c = rcv->ring[rcv->fed++ % RING_SIZE];
+        if (c == '\n')
+            break;
+        if (c == '\r')
+            continue;
+
+        if (n == sizeof(line) - 1)
+            break;
+        line[n++] = c;
+    }
+
+    line[n] = '\0';
+
+    if (c != '\n' || sscanf(line, "%u:%d", index, status) != 2)
+    {
+        fprintf(stderr, "telnet: invalid marker line \"%s\"\n", line);
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * Execute 'n_cmds' commands of 'cmds' on telnet server as a batch.
+ * All commands are sent at once, each one followed by an echo of
+ * a marker with its index and exit status ($?), so the batch takes
+ * a round trip instead of one per command. The marker is quoted in
+ * the echo command, so its echo by the board does not match it.
+ * The output is split by the markers: output of each command without
+ * prompts is streamed to its consumer, and its exit status is set.
+ * Error substrings and patterns of 'cmds' are not looked for.
+ *
+ * @return
+ *      Zero if all commands exited with zero status, or -1, if error
+ *      occurred.
+ *
+ * @se
+ *      Prints information about occurred error and commands that
+ *      failed to stderr.
+ */
+int telnet_execute_batch(telnet_board_data *data, telnet_cmd_data *cmds,
+                         unsigned int n_cmds)
+{
+    const char      *patterns[2];
+    char            marker[sizeof(MARKER) + 9];     /* nonce and ':' */
+    char            *batch      = NULL;
+    size_t          batch_len   = 0;
+    ssize_t         sent;
+    size_t          off;
+    unsigned int    index;
+    unsigned int    i;
+    int             status;
+    int             found;
+    int             retval;
+    FILE            *f;
+    telnet_match    m;
+    telnet_recv     rcv;
+
+    if (n_cmds == 0)
+        return 0;
+
+    snprintf(marker, sizeof(marker), MARKER "%08x",
+             (unsigned int)time(NULL) * 2654435761u ^ (unsigned int)getpid());
+
+    f = open_memstream(&batch, &batch_len);
+    if (f == NULL)
+    {
+        perror("telnet: open_memstream()");
+        return -1;
+    }
+
+    for (i = 0; i < n_cmds; i++)
+    {
+        cmds[i].status = -1;
+        fprintf(f, "%s\recho %s'':%u:$?\r", cmds[i].command, marker, i);
+    }
 
-    if (strstr(recv_buff, cmd_data->error_substr))
+    if (fclose(f))
     {
-        fprintf(stderr, "Error occured. Telnet output:\n"
-                        "----------------------------------\n%s\n"
-                        "----------------------------------\n", recv_buff);
+        perror("telnet: fclose()");
+        free(batch);
         return -1;
     }
 
+    strcat(marker, ":");
+    patterns[MATCH_PROMPT] = data->opt->cl_prompt;
+    patterns[MATCH_MARKER] = marker;
+
+    retval = telnet_match_init(&m, patterns, 2);
+    if (retval)
+    {
+        perror("telnet: telnet_match_init()");
+        free(batch);
+        return retval;
+    }
+
+    for (off = 0; off < batch_len; off += sent)
+    {
+        sent = send(get_sock(&data->tcp_conn), batch + off,
+                    batch_len - off, 0);
+        if (sent == -1)
+        {
+            perror("telnet: send()");
+            retval = -1;
+            goto out;
+        }
+    }
+
+    telnet_recv_init(&rcv, cmds[0].output, cmds[0].output_arg);
+
+    /* the last marker is followed by a prompt, as any line */
+    i = 0;
+    while (1)
+    {
+        found = telnet_recv_match(data, &m, &rcv);
+        if (found == -1)
+        {
+            retval = -1;
+            goto out;
+        }
+
+        retval = telnet_recv_output(&rcv, rcv.fed - strlen(patterns[found]));
+        if (retval)
+            goto out;
+
+        rcv.sent = rcv.fed;
+
+        if (found == MATCH_PROMPT && i == n_cmds)
+            break;
+
+        /* space ending the prompt is not output of the next command */
+        if (found == MATCH_PROMPT)
+        {
+            while (rcv.fed == rcv.len)
+            {
+                if (telnet_recv_more(data, &rcv))
+                {
+                    retval = -1;
+                    goto out;
+                }
+            }
+
+            if (rcv.ring[rcv.fed % RING_SIZE] == ' ')
+                rcv.sent = ++rcv.fed;
+            continue;
+        }
+
+        retval = telnet_recv_marker(data, &rcv, &index, &status);
+        if (retval)
+            goto out;
+
+        if (index != i)
+        {
+            fprintf(stderr, "telnet: marker of command %u instead of %u\n",
+                    index, i);
+            retval = -1;
+            goto out;
+        }
+
+        rcv.sent       = rcv.fed;
+        cmds[i].status = status;
+        i++;
+
+        rcv.output     = i < n_cmds ? cmds[i].output : NULL;
+        rcv.output_arg = i < n_cmds ? cmds[i].output_arg : NULL;
+        telnet_match_reset(&m);
+    }
+
+    for (i = 0; i < n_cmds; i++)
+    {
+        if (cmds[i].status != 0)
+        {
+            fprintf(stderr, "Command \"%s\" exited with status %d\n",
+                    cmds[i].command, cmds[i].status);
+            retval = -1;
+        }
+    }
+
+out:
+    telnet_match_destroy(&m);
+    free(batch);
     return retval;
 }
+
+/**
+ * Write output of a command to stream 'file', a consumer of
+ * telnet_cmd_data.
+ *
+ * @return
+ *      Zero on success, or -1, if error occurred.
+ *
+ * @se
+ *      Prints information about occurred error to stderr.
+ */
+int telnet_output_file(void *file, const char *buf, size_t len)
+{
+    if (fwrite(buf, 1, len, file) != len)
+    {
+        perror("telnet: fwrite()");
+        return -1;
+    }
+
+    return 0;
+}
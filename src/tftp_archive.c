@@ -0,0 +1,460 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include "include/tftp_archive.h"
+
+#define TAR_BLOCK               512
+#define CPIO_HEADER             110     /* "newc" header before the name */
+#define CPIO_TRAILER            "TRAILER!!!"
+
+static uint32_t tftp_archive_hash(const char *name)
+{
+    uint32_t hash = 2166136261u;
+
+    for (; *name != '\0'; name++)
+        hash = (hash ^ (uint8_t)*name) * 16777619u;
+
+    return hash;
+}
+
+/** Skip leading "./" and "/" of member or requested 'name'. */
+static const char *tftp_archive_name(const char *name)
+{
+    while (1)
+    {
+        if (name[0] == '/')
+            name++;
+        else if (name[0] == '.' && name[1] == '/')
+            name += 2;
+        else
+            return name;
+    }
+}
+
+/**
+ * Find member 'name' of archive 'a'.
+ *
+ * @return
+ *      Member, or NULL, if there is no such regular file.
+ */
+const tftp_archive_member *tftp_archive_find(const tftp_archive *a,
+                                             const char *name)
+{
+    uint32_t i;
+
+    name = tftp_archive_name(name);
+
+    for (i = a->buckets[tftp_archive_hash(name) & a->mask];
+         i != TFTP_ARCHIVE_END; i = a->members[i].next)
+        if (strcmp(a->names + a->members[i].name, name) == 0)
+            return &a->members[i];
+
+    return NULL;
+}
+
+/** Serve member 'name' of archive 'p' as a slice of its mapping. */
+static int tftp_archive_get(const tftp_provider *p,
+                            const struct sockaddr_in *client,
+                            const char *name, uint8_t **data, size_t *len,
+                            int *borrowed)
+{
+    const tftp_archive          *a = (const tftp_archive *)p;
+    const tftp_archive_member   *m;
+
+    (void)client;
+
+    m = tftp_archive_find(a, name);
+    if (m == NULL)
+        return 1;
+
+    *data     = a->map + m->offset;
+    *len      = m->size;
+    *borrowed = 1;
+
+    return 0;
+}
+
+/**
+ * Add member 'name' of 'name_len' bytes with content of 'size' bytes
+ * at 'offset' to archive 'a'. Members without names are skipped.
+ *
+ * @return
+ *      Zero on success, or -1, if error occured.
+ */
+static int tftp_archive_add(tftp_archive *a, const char *name,
+                            size_t name_len, off_t offset, off_t size)
+{
+    tftp_archive_member *m;
+    void                *tmp;
+
+    while (name_len > 0 && (name[0] == '/' ||
+                            (name[0] == '.' && name_len > 1 &&
+                             name[1] == '/')))
+    {
+        name_len -= name[0] == '/' ? 1 : 2;
+        name     += name[0] == '/' ? 1 : 2;
+    }
+
+    if (name_len == 0)
+        return 0;
+
+    if (a->n_members == a->size)
+    {
+        a->size = a->size ? 2 * a->size : 1024;
+        tmp     = realloc(a->members, a->size * sizeof(*a->members));
+        if (tmp == NULL)
+            return -1;
+        a->members = tmp;
+    }
+
+    while (a->names_len + name_len + 1 > a->names_size)
+    {
+        a->names_size = a->names_size ? 2 * a->names_size : 64 * 1024;
+        tmp           = realloc(a->names, a->names_size);
+        if (tmp == NULL)
+            return -1;
+        a->names = tmp;
+    }
+
+    m         = &a->members[a->n_members++];
+    m->name   = a->names_len;
+    m->offset = offset;
+    m->size   = size;
+
+    memcpy(a->names + a->names_len, name, name_len);
+    a->names_len += name_len;
+    a->names[a->names_len++] = '\0';
+
+    return 0;
+}
+
+/** Get number of the tar header field 'p' of 'len' bytes. */
+static uint64_t tftp_tar_number(const uint8_t *p, size_t len)
+{
+    uint64_t n = 0;
+
+    /* GNU base-256 for numbers that do not fit in octal */
+    if (*p & 0x80)
+    {
+        n = *p++ & 0x3f;
+        while (--len > 0)
+            n = n << 8 | *p++;
+        return n;
+    }
+
+    for (; len > 0 && *p == ' '; p++, len--)
+        ;
+    for (; len > 0 && *p >= '0' && *p <= '7'; p++, len--)
+        n = n << 3 | (*p - '0');
+
+    return n;
+}
+
+/** Check the checksum of tar header 'h'. */
+static int tftp_tar_valid(const uint8_t *h)
+{
+    uint64_t    sum = 0;
+    size_t      i;
+
+    for (i = 0; i < TAR_BLOCK; i++)
+        sum += i >= 148 && i < 156 ? ' ' : h[i];
+
+    return sum == tftp_tar_number(h + 148, 8);
+}
+
+/**
+ * Get value of "path" from pax extended header 'p' of 'len' bytes,
+ * records of which are "<length> <keyword>=<value>\n".
+ *
+ * @return
+ *      Start of the path with its length in 'path_len',
+ *      or NULL, if there is no path.
+ */
+static const char *tftp_pax_path(const char *p, size_t len, size_t *path_len)
+{
+    const char  *end = p + len;
+    const char  *rec;
+    size_t      rec_len;
+
+    for (rec = p; rec < end; rec += rec_len)
+    {
+        rec_len = strtoul(rec, (char **)&p, 10);
+        if (rec_len == 0 || rec_len > (size_t)(end - rec) || *p != ' ')
+            return NULL;
+
+        if (rec_len > 6 && (size_t)(p + 6 - rec) < rec_len &&
+            strncmp(p + 1, "path=", 5) == 0)
+        {
+            *path_len = rec + rec_len - (p + 6) - 1;    /* -1 for '\n' */
+            return p + 6;
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * Index members of tar archive 'a'.
+ *
+ * @return
+ *      Zero on success, or -1, if error occured.
+ */
+static int tftp_tar_index(tftp_archive *a)
+{
+    static const uint8_t    zero[TAR_BLOCK];
+    const uint8_t           *h;
+    const char              *long_name = NULL;
+    size_t                  long_len   = 0;
+    char                    name[256 + 1];
+    size_t                  name_len;
+    size_t                  prefix_len;
+    off_t                   offset;
+    off_t                   size;
+
+    for (offset = 0; offset + TAR_BLOCK <= (off_t)a->map_size;
+         offset += TAR_BLOCK + (size + TAR_BLOCK - 1) / TAR_BLOCK * TAR_BLOCK)
+    {
+        h = a->map + offset;
+        if (memcmp(h, zero, TAR_BLOCK) == 0)
+            return 0;
+
+        if (!tftp_tar_valid(h))
+        {
+            errno = EINVAL;
+            return -1;
+        }
+
+        size = tftp_tar_number(h + 124, 12);
+        if (size < 0 ||
+            size > (off_t)a->map_size - offset - TAR_BLOCK)
+        {
+            errno = EINVAL;
+            return -1;
+        }
+
+        switch (h[156])
+        {
+            case 'L':                       /* GNU long name of the next */
+                long_name = (const char *)h + TAR_BLOCK;
+                long_len  = strnlen(long_name, size);
+                continue;
+
+            case 'x':                       /* pax header of the next */
+                long_name = tftp_pax_path((const char *)h + TAR_BLOCK,
+                                          size, &long_len);
+                continue;
+
+            case '0':
+            case '\0':
+            case '7':
+                break;
+
+            default:
+                long_name = NULL;
+                continue;
+        }
+
+        if (long_name == NULL)
+        {
+            name_len   = strnlen((const char *)h, 100);
+            prefix_len = memcmp(h + 257, "ustar", 5) == 0 ?
+                         strnlen((const char *)h + 345, 155) : 0;
+
+            if (prefix_len > 0)
+            {
+                memcpy(name, h + 345, prefix_len);
+                name[prefix_len++] = '/';
+            }
+            memcpy(name + prefix_len, h, name_len);
+
+            long_name = name;
+            long_len  = prefix_len + name_len;
+        }
+
+        if (tftp_archive_add(a, long_name, long_len,
+                             offset + TAR_BLOCK, size))
+            return -1;
+
+        long_name = NULL;
+    }
+
+    return 0;
+}
+
+/** Get number of the cpio header field 'p' of eight hex digits. */
+static uint32_t tftp_cpio_number(const uint8_t *p)
+{
+    char    buf[9];
+
+    memcpy(buf, p, 8);
+    buf[8] = '\0';
+
+    return strtoul(buf, NULL, 16);
+}
+
+/**
+ * Index members of cpio archive 'a' of the "newc" format.
+ *
+ * @return
+ *      Zero on success, or -1, if error occured.
+ */
+static int tftp_cpio_index(tftp_archive *a)
+{
+    const uint8_t   *h;
+    const char      *name;
+    uint32_t        mode;
+    uint32_t        name_size;
+    off_t           size;
+    off_t           offset;
+    off_t           data;
+
+    for (offset = 0; offset + CPIO_HEADER <= (off_t)a->map_size;
+         offset = (data + size + 3) & ~3)
+    {
+        h = a->map + offset;
+        if (memcmp(h, "070701", 6) && memcmp(h, "070702", 6))
+            break;
+
+        mode      = tftp_cpio_number(h + 14);
+        size      = tftp_cpio_number(h + 54);
+        name_size = tftp_cpio_number(h + 94);
+        name      = (const char *)h + CPIO_HEADER;
+        data      = (offset + CPIO_HEADER + name_size + 3) & ~3;
+
+        if (name_size == 0 || data + size > (off_t)a->map_size)
+            break;
+
+        if (strncmp(name, CPIO_TRAILER, name_size) == 0)
+            return 0;
+
+        if ((mode & S_IFMT) == S_IFREG &&
+            tftp_archive_add(a, name, strnlen(name, name_size - 1),
+                             data, size))
+            return -1;
+    }
+
+    errno = EINVAL;
+    return -1;
+}
+
+/**
+ * Hash members of archive 'a' by name. Of members with the same
+ * name the last one is kept.
+ *
+ * @return
+ *      Zero on success, or -1, if error occured.
+ */
+static int tftp_archive_hash_members(tftp_archive *a)
+{
+    tftp_archive_member *m;
+    uint32_t            n_buckets = 1;
+    uint32_t            i;
+    uint32_t            j;
+    uint32_t            *pj;
+
+    while (n_buckets < 2 * a->n_members)
+        n_buckets *= 2;
+
+    a->buckets = malloc(n_buckets * sizeof(*a->buckets));
+    if (a->buckets == NULL)
+        return -1;
+
+    memset(a->buckets, 0xff, n_buckets * sizeof(*a->buckets));
+    a->mask = n_buckets - 1;
+
+    for (i = 0; i < a->n_members; i++)
+    {
+        m = &a->members[i];
+
+        for (pj = &a->buckets[tftp_archive_hash(a->names + m->name) &
+                              a->mask];
+             (j = *pj) != TFTP_ARCHIVE_END; pj = &a->members[j].next)
+            if (strcmp(a->names + a->members[j].name, a->names + m->name) == 0)
+                break;
+
+        if (j != TFTP_ARCHIVE_END)
+        {
+            /* later member replaces the earlier one, like on extraction */
+            a->members[j].offset = m->offset;
+            a->members[j].size   = m->size;
+            m->next              = TFTP_ARCHIVE_END;
+            continue;
+        }
+
+        m->next = TFTP_ARCHIVE_END;
+        *pj     = i;
+    }
+
+    return 0;
+}
+
+/**
+ * Map archive 'path' and index its members. The archive is served
+ * for the whole life of the server.
+ *
+ * @return
+ *      New archive, or NULL, if error occured.
+ *
+ * @se
+ *      Prints information about occurred error to stderr.
+ */
+tftp_archive *tftp_archive_open(const char *path)
+{
+    tftp_archive    *a;
+    struct stat     st;
+    int             fd;
+    int             rc;
+
+    a = calloc(1, sizeof(*a));
+    if (a == NULL)
+    {
+        perror("tftp server: calloc()");
+        return NULL;
+    }
+
+    fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1 || fstat(fd, &st))
+        goto fail;
+
+    a->map_size = st.st_size;
+    a->map      = mmap(NULL, a->map_size > 0 ? a->map_size : 1, PROT_READ,
+                       MAP_SHARED, fd, 0);
+    if (a->map == MAP_FAILED)
+    {
+        a->map = NULL;
+        goto fail;
+    }
+
+    close(fd);
+    fd = -1;
+
+    rc = a->map_size >= 6 && memcmp(a->map, "0707", 4) == 0 ?
+         tftp_cpio_index(a) : tftp_tar_index(a);
+    if (rc || tftp_archive_hash_members(a))
+        goto fail;
+
+    a->provider.get = tftp_archive_get;
+
+    return a;
+
+fail:
+    fprintf(stderr, "tftp server: archive '%s': %s\n", path,
+            errno == EINVAL ? "unsupported or corrupted" : strerror(errno));
+    if (fd != -1)
+        close(fd);
+    if (a->map != NULL)
+        munmap(a->map, a->map_size > 0 ? a->map_size : 1);
+    free(a->members);
+    free(a->names);
+    free(a->buckets);
+    free(a);
+    return NULL;
+}
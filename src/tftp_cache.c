@@ -0,0 +1,425 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/inotify.h>
+
+#include "include/tftp_cache.h"
+
+/* Changes of files in the server directory that invalidate them. */
+#define TFTP_CACHE_EVENTS   (IN_CLOSE_WRITE | IN_ATTRIB | IN_DELETE | \
+                             IN_MOVED_FROM | IN_MOVED_TO)
+
+static unsigned int tftp_cache_hash(const char *path)
+{
+    uint32_t hash = 2166136261u;
+
+    for (; *path != '\0'; path++)
+        hash = (hash ^ (uint8_t)*path) * 16777619u;
+
+    return hash % TFTP_CACHE_BUCKETS;
+}
+
+/** Check if cached 'entry' holds the file described by 'st'. */
+static int tftp_cache_valid(tftp_cache_entry *entry, struct stat *st)
+{
+    return entry->dev == st->st_dev && entry->ino == st->st_ino &&
+           entry->size == st->st_size &&
+           entry->mtime.tv_sec  == st->st_mtim.tv_sec &&
+           entry->mtime.tv_nsec == st->st_mtim.tv_nsec;
+}
+
+static void tftp_cache_lru_unlink(tftp_cache *cache, tftp_cache_entry *entry)
+{
+    if (entry->lru_prev != NULL)
+        entry->lru_prev->lru_next = entry->lru_next;
+    else
+        cache->lru_head = entry->lru_next;
+
+    if (entry->lru_next != NULL)
+        entry->lru_next->lru_prev = entry->lru_prev;
+    else
+        cache->lru_tail = entry->lru_prev;
+
+    entry->lru_prev = NULL;
+    entry->lru_next = NULL;
+}
+
+/** Make 'entry' the most recently used one. */
+static void tftp_cache_lru_touch(tftp_cache *cache, tftp_cache_entry *entry)
+{
+    tftp_cache_lru_unlink(cache, entry);
+
+    entry->lru_prev = cache->lru_tail;
+    if (cache->lru_tail != NULL)
+        cache->lru_tail->lru_next = entry;
+    else
+        cache->lru_head = entry;
+    cache->lru_tail = entry;
+}
+
+static void tftp_cache_free(tftp_cache *cache, tftp_cache_entry *entry)
+{
+    cache->used -= entry->size;
+
+    free(entry->data);
+    free(entry->path);
+    free(entry);
+}
+
+/**
+ * Remove 'entry' from the cache. The entry is freed once
+ * the last transfer reading it puts it back.
+ */
+static void tftp_cache_remove(tftp_cache *cache, tftp_cache_entry *entry)
+{
+    tftp_cache_entry **pe;
+
+    for (pe = &cache->buckets[tftp_cache_hash(entry->path)];
+         *pe != entry; pe = &(*pe)->hash_next)
+        ;
+    *pe = entry->hash_next;
+
+    tftp_cache_lru_unlink(cache, entry);
+    entry->stale = 1;
+
+    if (entry->refs == 0)
+        tftp_cache_free(cache, entry);
+}
+
+static tftp_cache_entry *tftp_cache_lookup(tftp_cache *cache,
+                                           const char *path)
+{
+    tftp_cache_entry *entry;
+
+    for (entry = cache->buckets[tftp_cache_hash(path)]; entry != NULL;
+         entry = entry->hash_next)
+        if (strcmp(entry->path, path) == 0)
+            return entry;
+
+    return NULL;
+}
+
+/**
+ * Evict least recently used files nobody reads until 'size' more
+ * bytes fit into the budget.
+ *
+ * @return
+ *      Zero on success, or -1, if the files in use leave no room.
+ */
+static int tftp_cache_evict(tftp_cache *cache, size_t size)
+{
+    tftp_cache_entry *entry = cache->lru_head;
+    tftp_cache_entry *next;
+
+    while (cache->used + size > cache->budget && entry != NULL)
+    {
+        next = entry->lru_next;
+        if (entry->refs == 0)
+            tftp_cache_remove(cache, entry);
+        entry = next;
+    }
+
+    return cache->used + size > cache->budget ? -1 : 0;
+}
+
+/**
+ * Read the whole file 'fd' of 'size' bytes into memory.
+ *
+ * @return
+ *      File content, or NULL, if error occured.
+ */
+static uint8_t *tftp_cache_read(int fd, off_t size)
+{
+    uint8_t *data;
+    off_t   done;
+    ssize_t len;
+
+    data = malloc(size);
+    if (data == NULL)
+        return NULL;
+
+    for (done = 0; done < size; done += len)
+    {
+        len = pread(fd, data + done, size - done, done);
+        if (len <= 0)
+        {
+            /* file was truncated or could not be read */
+            free(data);
+            return NULL;
+        }
+    }
+
+    return data;
+}
+
+/**
+ * Read files queued by tftp_cache_get() into the cache one by one.
+ * Files changed while they were read are dropped.
+ */
+static void *tftp_cache_loader(void *arg)
+{
+    tftp_cache          *cache = arg;
+    tftp_cache_entry    *entry;
+    uint8_t             *data;
+    struct stat         st;
+
+    pthread_mutex_lock(&cache->lock);
+
+    while (1)
+    {
+        while (cache->load_head == NULL)
+            pthread_cond_wait(&cache->queued, &cache->lock);
+
+        entry            = cache->load_head;
+        cache->load_head = entry->load_next;
+        if (cache->load_head == NULL)
+            cache->load_tail = NULL;
+
+        pthread_mutex_unlock(&cache->lock);
+
+        data = tftp_cache_read(entry->fd, entry->size);
+        if (data != NULL &&
+            (fstat(entry->fd, &st) || !tftp_cache_valid(entry, &st)))
+        {
+            free(data);
+            data = NULL;
+        }
+        close(entry->fd);
+
+        pthread_mutex_lock(&cache->lock);
+
+        entry->data    = data;
+        entry->loading = 0;
+
+        if (data == NULL && !entry->stale)
+            tftp_cache_remove(cache, entry);
+        if (--entry->refs == 0 && entry->stale)
+            tftp_cache_free(cache, entry);
+    }
+
+    return NULL;
+}
+
+/**
+ * Get content of file 'path' opened as 'fd' with status 'st'
+ * from the cache. File that is missing or outdated is queued for
+ * the loader thread instead, and the caller reads it from 'fd'
+ * until it is loaded, like transfers requesting it meanwhile.
+ *
+ * @param hit       Location for the flag set if the file
+ *                  was found in the cache.
+ *
+ * @return
+ *      Cached file the caller must put back with tftp_cache_put(),
+ *      or NULL, if the file is not cached yet or can not be cached.
+ */
+tftp_cache_entry *tftp_cache_get(tftp_cache *cache, const char *path,
+                                 int fd, struct stat *st, int *hit)
+{
+    tftp_cache_entry *entry;
+
+    *hit = 0;
+
+    pthread_mutex_lock(&cache->lock);
+
+    entry = tftp_cache_lookup(cache, path);
+    if (entry != NULL && !entry->loading && !tftp_cache_valid(entry, st))
+    {
+        tftp_cache_remove(cache, entry);
+        entry = NULL;
+    }
+
+    if (entry != NULL)
+    {
+        tftp_cache_lru_touch(cache, entry);
+
+        /* file being read is read by the caller itself meanwhile */
+        if (entry->loading)
+            entry = NULL;
+        else
+        {
+            entry->refs++;
+            *hit = 1;
+        }
+
+        pthread_mutex_unlock(&cache->lock);
+        return entry;
+    }
+
+    if (st->st_size == 0 || (size_t)st->st_size > cache->budget ||
+        tftp_cache_evict(cache, st->st_size))
+    {
+        pthread_mutex_unlock(&cache->lock);
+        return NULL;
+    }
+
+    entry = calloc(1, sizeof(*entry));
+    if (entry == NULL || (entry->path = strdup(path)) == NULL ||
+        (entry->fd = fcntl(fd, F_DUPFD_CLOEXEC, 0)) == -1)
+    {
+        if (entry != NULL)
+            free(entry->path);
+        free(entry);
+        pthread_mutex_unlock(&cache->lock);
+        return NULL;
+    }
+
+    entry->dev     = st->st_dev;
+    entry->ino     = st->st_ino;
+    entry->mtime   = st->st_mtim;
+    entry->size    = st->st_size;
+    entry->refs    = 1;
+    entry->loading = 1;
+
+    entry->hash_next = cache->buckets[tftp_cache_hash(path)];
+    cache->buckets[tftp_cache_hash(path)] = entry;
+    tftp_cache_lru_touch(cache, entry);
+    cache->used += entry->size;
+
+    if (cache->load_tail != NULL)
+        cache->load_tail->load_next = entry;
+    else
+        cache->load_head = entry;
+    cache->load_tail = entry;
+    pthread_cond_signal(&cache->queued);
+
+    pthread_mutex_unlock(&cache->lock);
+
+    return NULL;
+}
+
+/** Release file got by tftp_cache_get(). */
+void tftp_cache_put(tftp_cache *cache, tftp_cache_entry *entry)
+{
+    pthread_mutex_lock(&cache->lock);
+
+    if (--entry->refs == 0 && entry->stale)
+        tftp_cache_free(cache, entry);
+
+    pthread_mutex_unlock(&cache->lock);
+}
+
+/**
+ * Remove cached files with base name 'name', or all files
+ * if 'name' is NULL. Caller must hold the cache lock.
+ */
+static void tftp_cache_invalidate(tftp_cache *cache, const char *name)
+{
+    tftp_cache_entry    *entry;
+    tftp_cache_entry    *next;
+    const char          *base;
+
+    for (entry = cache->lru_head; entry != NULL; entry = next)
+    {
+        next = entry->lru_next;
+
+        base = strrchr(entry->path, '/');
+        base = base == NULL ? entry->path : base + 1;
+
+        if (!entry->loading && (name == NULL || strcmp(base, name) == 0))
+            tftp_cache_remove(cache, entry);
+    }
+}
+
+/**
+ * Read changes of the server directory from inotify and drop
+ * changed files from the cache. Files in subdirectories are
+ * not watched, they are checked when a client requests them.
+ */
+void tftp_cache_notify(tftp_cache *cache)
+{
+    char                        buf[4096]
+                                __attribute__((aligned(__alignof__(
+                                    struct inotify_event))));
+    const struct inotify_event  *ev;
+    ssize_t                     len;
+    char                        *p;
+
+    while ((len = read(cache->inotify_fd, buf, sizeof(buf))) > 0)
+    {
+        pthread_mutex_lock(&cache->lock);
+
+        for (p = buf; p < buf + len; p += sizeof(*ev) + ev->len)
+        {
+            ev = (const struct inotify_event *)p;
+
+            if (ev->mask & IN_Q_OVERFLOW)
+                tftp_cache_invalidate(cache, NULL);
+            else if (ev->len > 0)
+                tftp_cache_invalidate(cache, ev->name);
+        }
+
+        pthread_mutex_unlock(&cache->lock);
+    }
+}
+
+/** Get number of bytes taken by cached files. */
+size_t tftp_cache_used(tftp_cache *cache)
+{
+    size_t used;
+
+    pthread_mutex_lock(&cache->lock);
+    used = cache->used;
+    pthread_mutex_unlock(&cache->lock);
+
+    return used;
+}
+
+/**
+ * Create cache of files from 'directory' taking up to 'budget' bytes.
+ *
+ * @return
+ *      New cache, or NULL, if error occured.
+ *
+ * @se
+ *      Prints information about occurred error to stderr.
+ */
+tftp_cache *tftp_cache_create(size_t budget, const char *directory)
+{
+    tftp_cache  *cache;
+    int         rc;
+
+    cache = calloc(1, sizeof(*cache));
+    if (cache == NULL)
+    {
+        perror("tftp server: calloc()");
+        return NULL;
+    }
+
+    cache->budget = budget;
+
+    cache->inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (cache->inotify_fd == -1 ||
+        inotify_add_watch(cache->inotify_fd, directory,
+                          TFTP_CACHE_EVENTS) == -1)
+    {
+        perror("tftp server: inotify");
+        if (cache->inotify_fd != -1)
+            close(cache->inotify_fd);
+        free(cache);
+        return NULL;
+    }
+
+    pthread_mutex_init(&cache->lock, NULL);
+    pthread_cond_init(&cache->queued, NULL);
+
+    rc = pthread_create(&cache->loader, NULL, tftp_cache_loader, cache);
+    if (rc)
+    {
+        fprintf(stderr, "tftp server: pthread_create(): %s\n",
+                strerror(rc));
+        close(cache->inotify_fd);
+        free(cache);
+        return NULL;
+    }
+
+    return cache;
+}
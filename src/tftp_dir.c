@@ -0,0 +1,150 @@
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/openat2.h>
+
+#include "include/tftp_dir.h"
+
+static unsigned int tftp_dir_hash(const char *name)
+{
+    uint32_t hash = 2166136261u;
+
+    for (; *name != '\0'; name++)
+        hash = (hash ^ (uint8_t)*name) * 16777619u;
+
+    return hash % TFTP_DIR_FILES;
+}
+
+/** Close cached descriptor 'f' and free its slot. */
+static void tftp_dir_drop(tftp_dir_file *f)
+{
+    close(f->fd);
+    free(f->name);
+    f->name = NULL;
+}
+
+/**
+ * Initialize files of the server directory opened as 'fd'.
+ * The descriptor is shared by loops and is not closed with 'dir'.
+ */
+void tftp_dir_init(tftp_dir *dir, int fd)
+{
+    memset(dir, 0, sizeof(*dir));
+
+    dir->fd      = fd;
+    dir->beneath = 1;
+}
+
+/** Close cached descriptors of 'dir'. */
+void tftp_dir_destroy(tftp_dir *dir)
+{
+    unsigned int i;
+
+    for (i = 0; i < TFTP_DIR_FILES; i++)
+        if (dir->files[i].name != NULL)
+            tftp_dir_drop(&dir->files[i]);
+}
+
+/**
+ * Resolve 'name' beneath the directory. Kernels without openat2()
+ * resolve it with openat(), then only the checks of the request
+ * keep clients in the directory.
+ *
+ * @return
+ *      File descriptor, or -1, if error occured.
+ */
+static int tftp_dir_resolve(tftp_dir *dir, const char *name, int flags)
+{
+    struct open_how how;
+    int             fd;
+
+    if (dir->beneath)
+    {
+        memset(&how, 0, sizeof(how));
+        how.flags   = flags | O_CLOEXEC;
+        how.mode    = flags & O_CREAT ? 0666 : 0;
+        how.resolve = RESOLVE_BENEATH | RESOLVE_NO_MAGICLINKS;
+
+        fd = syscall(SYS_openat2, dir->fd, name, &how, sizeof(how));
+        if (fd != -1 || errno != ENOSYS)
+            return fd;
+
+        dir->beneath = 0;
+    }
+
+    return openat(dir->fd, name, flags | O_CLOEXEC, 0666);
+}
+
+/**
+ * Open file 'name' of the server directory with 'flags' of open().
+ * Files read from the directory itself are looked up in the cached
+ * descriptors first, files of subdirectories are always resolved,
+ * as changes of subdirectories do not show in the directory.
+ * 'cached' is set if the file was not resolved.
+ *
+ * @return
+ *      File descriptor of its own, or -1, if error occured.
+ *      The error EXDEV means that 'name' leads out of the directory.
+ */
+int tftp_dir_open(tftp_dir *dir, const char *name, int flags, int *cached)
+{
+    struct stat     st;
+    struct timespec now;
+    tftp_dir_file   *f;
+    int             fd;
+    int             dup_fd;
+
+    *cached = 0;
+
+    if (flags != O_RDONLY || strchr(name, '/') != NULL ||
+        fstat(dir->fd, &st))
+        return tftp_dir_resolve(dir, name, flags);
+
+    f = &dir->files[tftp_dir_hash(name)];
+    if (f->name != NULL && strcmp(f->name, name) == 0 &&
+        f->dir_mtime.tv_sec  == st.st_mtim.tv_sec &&
+        f->dir_mtime.tv_nsec == st.st_mtim.tv_nsec)
+    {
+        fd = fcntl(f->fd, F_DUPFD_CLOEXEC, 0);
+        if (fd != -1)
+            *cached = 1;
+        return fd;
+    }
+
+    if (f->name != NULL)
+        tftp_dir_drop(f);
+
+    /* the directory is looked at before the file, a change between
+     * them makes the cached descriptor stale, never the other way */
+    fd = tftp_dir_resolve(dir, name, flags);
+    if (fd == -1)
+        return -1;
+
+    clock_gettime(CLOCK_REALTIME, &now);
+    if ((now.tv_sec - st.st_mtim.tv_sec) * 1000000L +
+        (now.tv_nsec - st.st_mtim.tv_nsec) / 1000 < TFTP_DIR_RACY)
+        return fd;
+
+    dup_fd = fcntl(fd, F_DUPFD_CLOEXEC, 0);
+    if (dup_fd == -1)
+        return fd;
+
+    f->name = strdup(name);
+    if (f->name == NULL)
+    {
+        close(dup_fd);
+        return fd;
+    }
+
+    f->fd        = dup_fd;
+    f->dir_mtime = st.st_mtim;
+
+    return fd;
+}
@@ -0,0 +1,1025 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stddef.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "include/tftp_loop.h"
+#include "include/tftp_transfer.h"
+#include "include/tftp_uring.h"
+#include "include/tftp_writer.h"
+
+#define TFTP_LOOP_EVENTS        64
+#define TFTP_SOCKET_BUFFER      (4 * 1024 * 1024)
+#define TFTP_REPORT_INTERVAL    10000000L   /* microseconds */
+
+#define timer_to_transfer(timer) \
+    ((tftp_transfer *)((char *)(timer) - offsetof(tftp_transfer, timer)))
+
+/** Get monotonic time in microseconds. */
+long tftp_time_us(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec * 1000000L + ts.tv_nsec / 1000;
+}
+
+/** Get CPU time consumed by the thread running 'loop' in microseconds. */
+static long tftp_cpu_time_us(tftp_loop *loop)
+{
+    struct timespec ts;
+
+    if (clock_gettime(loop->cpu_clock, &ts))
+        return 0;
+
+    return ts.tv_sec * 1000000L + ts.tv_nsec / 1000;
+}
+
+/**
+ * Arm 'timer' to expire in 'timeout' microseconds.
+ * Armed timer is rearmed.
+ */
+void tftp_timer_arm(tftp_loop *loop, tftp_timer *timer, long timeout)
+{
+    tftp_timer **slot;
+
+    tftp_timer_cancel(loop, timer);
+
+    timer->expires = tftp_time_us() / TFTP_WHEEL_TICK +
+                     (timeout + TFTP_WHEEL_TICK - 1) / TFTP_WHEEL_TICK;
+    if (timer->expires <= loop->tick)
+        timer->expires = loop->tick + 1;
+
+    slot = &loop->wheel[timer->expires % TFTP_WHEEL_SLOTS];
+
+    timer->next  = *slot;
+    timer->pprev = slot;
+    if (*slot != NULL)
+        (*slot)->pprev = &timer->next;
+    *slot = timer;
+
+    loop->armed++;
+}
+
+/** Disarm 'timer', if it is armed. */
+void tftp_timer_cancel(tftp_loop *loop, tftp_timer *timer)
+{
+    if (timer->pprev == NULL)
+        return;
+
+    *timer->pprev = timer->next;
+    if (timer->next != NULL)
+        timer->next->pprev = timer->pprev;
+
+    timer->next  = NULL;
+    timer->pprev = NULL;
+
+    loop->armed--;
+}
+
+/** Free packet buffers of 'batch'. */
+static void tftp_batch_free(tftp_batch *batch)
+{
+    free(batch->hdrs);
+    free(batch->iovs);
+    free(batch->addrs);
+    free(batch->buf);
+}
+
+/**
+ * Allocate batch of TFTP_LOOP_BATCH packets taking up to 'size' bytes.
+ *
+ * @return
+ *      Zero on success, or -1, if error occured.
+ *
+ * @se
+ *      Prints information about occurred error to stderr.
+ */
+static int tftp_batch_init(tftp_batch *batch, size_t size)
+{
+    batch->hdrs  = calloc(TFTP_LOOP_BATCH, sizeof(*batch->hdrs));
+    batch->iovs  = calloc(2 * TFTP_LOOP_BATCH, sizeof(*batch->iovs));
+    batch->addrs = calloc(TFTP_LOOP_BATCH, sizeof(*batch->addrs));
+    batch->buf   = malloc(size);
+    batch->size  = size;
+    batch->used  = 0;
+    batch->len   = 0;
+
+    if (batch->hdrs == NULL || batch->iovs == NULL ||
+        batch->addrs == NULL || batch->buf == NULL)
+    {
+        perror("tftp server: malloc()");
+        tftp_batch_free(batch);
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * Get room for a packet of up to 'max_len' bytes in the send queue.
+ * The packet is sent after it is queued with tftp_loop_queue()
+ * and the queue is flushed.
+ *
+ * @return
+ *      Location to build the packet at.
+ */
+tftp_message *tftp_loop_packet(tftp_loop *loop, size_t max_len)
+{
+    tftp_batch *tx = &loop->tx;
+
+    if (tx->len == TFTP_LOOP_BATCH || tx->used + max_len > tx->size)
+        tftp_loop_flush(loop);
+
+    return (tftp_message *)(tx->buf + tx->used);
+}
+
+/**
+ * Queue packet with 'hdr_len' bytes of header built at the location
+ * returned by the last tftp_loop_packet() call followed by 'data_len'
+ * bytes of 'data' to be sent to 'sock'. The data is not copied, it must
+ * stay valid until the queue is flushed.
+ */
+void tftp_loop_queue_data(tftp_loop *loop, size_t hdr_len,
+                          const void *data, size_t data_len,
+                          struct sockaddr_in *sock, socklen_t slen)
+{
+    tftp_batch      *tx  = &loop->tx;
+    unsigned int    i    = tx->len++;
+    struct iovec    *iov = &tx->iovs[2 * i];
+
+    tx->addrs[i]     = *sock;
+    iov[0].iov_base  = tx->buf + tx->used;
+    iov[0].iov_len   = hdr_len;
+    iov[1].iov_base  = (void *)data;
+    iov[1].iov_len   = data_len;
+
+    tx->hdrs[i].msg_hdr.msg_name       = &tx->addrs[i];
+    tx->hdrs[i].msg_hdr.msg_namelen    = slen;
+    tx->hdrs[i].msg_hdr.msg_iov        = iov;
+    tx->hdrs[i].msg_hdr.msg_iovlen     = data_len ? 2 : 1;
+    tx->hdrs[i].msg_hdr.msg_control    = NULL;
+    tx->hdrs[i].msg_hdr.msg_controllen = 0;
+    tx->hdrs[i].msg_hdr.msg_flags      = 0;
+
+    tx->used += hdr_len;
+}
+
+/**
+ * Queue packet of 'len' bytes built at the location returned by
+ * the last tftp_loop_packet() call to be sent to 'sock'.
+ */
+void tftp_loop_queue(tftp_loop *loop, size_t len,
+                     struct sockaddr_in *sock, socklen_t slen)
+{
+    tftp_loop_queue_data(loop, len, NULL, 0, sock, slen);
+}
+
+/**
+ * Send all queued packets from the transfer socket.
+ * Packets that do not fit into the socket buffer are dropped,
+ * retransmission timers of their transfers resend them.
+ *
+ * @se
+ *      Prints information about occurred error to stderr.
+ */
+void tftp_loop_flush(tftp_loop *loop)
+{
+    tftp_batch      *tx   = &loop->tx;
+    unsigned int    sent  = 0;
+    int             n;
+
+    if (loop->uring != NULL)
+    {
+        tftp_uring_flush(loop);
+        return;
+    }
+
+    while (sent < tx->len)
+    {
+        n = sendmmsg(loop->xfer_sock, tx->hdrs + sent, tx->len - sent, 0);
+        loop->stats.tx_calls++;
+
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN)
+                break;
+
+            /* skip the packet that could not be sent */
+            perror("tftp server: sendmmsg()");
+            n = 1;
+        }
+        else
+        {
+            loop->stats.tx_packets += n;
+        }
+
+        sent += n;
+    }
+
+    tx->len  = 0;
+    tx->used = 0;
+}
+
+/**
+ * Read up to TFTP_LOOP_BATCH messages from socket 's' into loop->rx.
+ *
+ * @return
+ *      Number of messages read.
+ *
+ * @se
+ *      Prints information about occurred error to stderr.
+ */
+static int tftp_loop_recv(tftp_loop *loop, int s)
+{
+    tftp_batch  *rx = &loop->rx;
+    int         i;
+    int         n;
+
+    for (i = 0; i < TFTP_LOOP_BATCH; i++)
+    {
+        rx->iovs[i].iov_base = rx->buf + i * sizeof(tftp_message);
+        rx->iovs[i].iov_len  = sizeof(tftp_message);
+
+        memset(&rx->hdrs[i], 0, sizeof(rx->hdrs[i]));
+        rx->hdrs[i].msg_hdr.msg_name    = &rx->addrs[i];
+        rx->hdrs[i].msg_hdr.msg_namelen = sizeof(rx->addrs[i]);
+        rx->hdrs[i].msg_hdr.msg_iov     = &rx->iovs[i];
+        rx->hdrs[i].msg_hdr.msg_iovlen  = 1;
+    }
+
+    n = recvmmsg(s, rx->hdrs, TFTP_LOOP_BATCH, 0, NULL);
+    if (n < 0)
+    {
+        if (errno != EAGAIN && errno != EINTR)
+            perror("tftp server: recvmmsg()");
+        return 0;
+    }
+
+    loop->stats.rx_calls++;
+    loop->stats.rx_packets += n;
+
+    return n;
+}
+
+/** Get message 'i' read by tftp_loop_recv(). */
+static tftp_message *tftp_loop_message(tftp_loop *loop, int i,
+                                       ssize_t *msg_len,
+                                       struct sockaddr_in **client_sock,
+                                       socklen_t *slen)
+{
+    *msg_len     = loop->rx.hdrs[i].msg_len;
+    *client_sock = &loop->rx.addrs[i];
+    *slen        = loop->rx.hdrs[i].msg_hdr.msg_namelen;
+
+    return (tftp_message *)(loop->rx.buf + i * sizeof(tftp_message));
+}
+
+/** Add time spent with current number of active transfers to stats. */
+static void tftp_loop_account(tftp_loop *loop)
+{
+    long now = tftp_time_us();
+
+    loop->stats.active_time += loop->active * (now - loop->changed_at) / 1e6;
+    loop->changed_at = now;
+}
+
+static unsigned int tftp_loop_hash(struct sockaddr_in *client_sock)
+{
+    uint32_t key = client_sock->sin_addr.s_addr ^
+                   ((uint32_t)client_sock->sin_port << 16);
+
+    return (key * 2654435761u) % TFTP_LOOP_BUCKETS;
+}
+
+/** Find transfer with client address and port from 'client_sock'. */
+static tftp_transfer *tftp_loop_lookup(tftp_loop *loop,
+                                       struct sockaddr_in *client_sock)
+{
+    tftp_transfer *t;
+
+    for (t = loop->transfers[tftp_loop_hash(client_sock)]; t != NULL;
+         t = t->hash_next)
+    {
+        if (t->client_sock.sin_addr.s_addr == client_sock->sin_addr.s_addr &&
+            t->client_sock.sin_port == client_sock->sin_port)
+            return t;
+    }
+
+    return NULL;
+}
+
+/** Add counters of finished transfer 't' to the loop metrics. */
+static void tftp_loop_measure(tftp_loop *loop, tftp_transfer *t)
+{
+    tftp_metrics *m = &loop->metrics;
+
+    if (t->state == TFTP_TRANSFER_COMPLETED)
+        m->completed++;
+    else
+        m->failed++;
+
+    if (t->opcode == RRQ)
+    {
+        m->bytes_sent  += t->bytes;
+        m->blocks_sent += t->blocks;
+    }
+    else
+    {
+        m->bytes_received  += t->bytes;
+        m->blocks_received += t->blocks;
+    }
+
+    m->retransmits += t->retransmits;
+    m->timeouts    += t->timeouts;
+
+    tftp_histogram_add(&m->duration, loop->changed_at - t->started_at);
+}
+
+/** Remove finished transfer from the loop and free it. */
+void tftp_loop_finish(tftp_loop *loop, tftp_transfer *t)
+{
+    tftp_transfer **pt;
+
+    for (pt = &loop->transfers[tftp_loop_hash(&t->client_sock)];
+         *pt != t; pt = &(*pt)->hash_next)
+        ;
+    *pt = t->hash_next;
+
+    tftp_loop_account(loop);
+    loop->active--;
+
+    if (t->state == TFTP_TRANSFER_COMPLETED)
+        loop->stats.completed++;
+    else
+        loop->stats.failed++;
+
+    tftp_loop_measure(loop, t);
+    tftp_transfer_destroy(t);
+}
+
+/**
+ * Start transfer requested by client.
+ *
+ * @return
+ *      Zero on success, or -1, if the request is rejected.
+ */
+int tftp_loop_add_request(tftp_loop *loop, tftp_message *msg,
+                          ssize_t msg_len, struct sockaddr_in *client_sock,
+                          socklen_t slen)
+{
+    unsigned int    bucket;
+    tftp_transfer   *t;
+
+    if (loop->mcast != NULL && !loop->mcast_owner &&
+        tftp_mcast_requested(msg, msg_len))
+        return tftp_mcast_forward(loop->mcast, msg, msg_len,
+                                  client_sock, slen);
+
+    /* Client repeats its request until the first reply arrives. */
+    if (tftp_loop_lookup(loop, client_sock) != NULL)
+        return 0;
+
+    if (ntohs(msg->opcode) == RRQ)
+        loop->metrics.reads++;
+    else
+        loop->metrics.writes++;
+
+    t = tftp_transfer_create(loop, msg, msg_len, client_sock, slen);
+    if (t == NULL)
+    {
+        loop->stats.failed++;
+        loop->metrics.failed++;
+        return -1;
+    }
+
+    bucket = tftp_loop_hash(client_sock);
+    t->hash_next = loop->transfers[bucket];
+    loop->transfers[bucket] = t;
+
+    tftp_loop_account(loop);
+    loop->active++;
+    loop->stats.transfers++;
+    if (loop->active > loop->stats.peak)
+        loop->stats.peak = loop->active;
+
+    if (tftp_transfer_start(t) != TFTP_TRANSFER_RUNNING)
+        tftp_loop_finish(loop, t);
+
+    return 0;
+}
+
+/**
+ * Handle request 'msg' received from client on the server socket.
+ *
+ * @se
+ *      If an error occures in received message, prints
+ *      information about that in stdout and sends back ERROR packet.
+ */
+void tftp_loop_request(tftp_loop *loop, tftp_message *msg, ssize_t msg_len,
+                       struct sockaddr_in *client_sock, socklen_t slen)
+{
+    int s = loop->listen_sock;
+
+    if (msg_len < TFTP_MSG_MIN_SIZE)
+    {
+        printf("%s.%u: request with invalid size received\n",
+                inet_ntoa(client_sock->sin_addr),
+                ntohs(client_sock->sin_port));
+        tftp_send_error(s, 0, "invalid request size", client_sock, slen);
+        return;
+    }
+
+    if (ntohs(msg->opcode) == RRQ || ntohs(msg->opcode) == WRQ)
+    {
+        tftp_loop_add_request(loop, msg, msg_len, client_sock, slen);
+    }
+    else
+    {
+        printf("%s.%u: invalid request received: %d\n",
+                inet_ntoa(client_sock->sin_addr),
+                ntohs(client_sock->sin_port), ntohs(msg->opcode));
+        tftp_send_error(s, 0, "invalid opcode", client_sock, slen);
+    }
+}
+
+/** Read requests from the server socket. */
+static void tftp_loop_accept(tftp_loop *loop)
+{
+    int                 i;
+    int                 n;
+    ssize_t             msg_len;
+    struct sockaddr_in  *client_sock;
+    socklen_t           slen;
+    tftp_message        *msg;
+
+    n = tftp_loop_recv(loop, loop->listen_sock);
+
+    for (i = 0; i < n; i++)
+    {
+        msg = tftp_loop_message(loop, i, &msg_len, &client_sock, &slen);
+        tftp_loop_request(loop, msg, msg_len, client_sock, slen);
+    }
+}
+
+/**
+ * Pass message 'msg' received on the transfer socket to the transfer
+ * of its client.
+ */
+void tftp_loop_input(tftp_loop *loop, tftp_message *msg, ssize_t msg_len,
+                     struct sockaddr_in *client_sock, socklen_t slen)
+{
+    tftp_transfer *t;
+
+    t = tftp_loop_lookup(loop, client_sock);
+    if (t == NULL)
+    {
+        tftp_send_error(loop->xfer_sock, TFTP_ERR_UNKNOWN_TID,
+                        "unknown transfer ID", client_sock, slen);
+        return;
+    }
+
+    if (tftp_transfer_input(t, msg, msg_len) != TFTP_TRANSFER_RUNNING)
+        tftp_loop_finish(loop, t);
+}
+
+/** Read messages of running transfers from the transfer socket. */
+static void tftp_loop_receive(tftp_loop *loop)
+{
+    int                 i;
+    int                 n;
+    ssize_t             msg_len;
+    struct sockaddr_in  *client_sock;
+    socklen_t           slen;
+    tftp_message        *msg;
+
+    n = tftp_loop_recv(loop, loop->xfer_sock);
+
+    for (i = 0; i < n; i++)
+    {
+        msg = tftp_loop_message(loop, i, &msg_len, &client_sock, &slen);
+        tftp_loop_input(loop, msg, msg_len, client_sock, slen);
+    }
+}
+
+/** Fire timers expired since the last call. */
+static void tftp_loop_expire(tftp_loop *loop)
+{
+    uint64_t        now = tftp_time_us() / TFTP_WHEEL_TICK;
+    uint64_t        tick;
+    uint64_t        last;
+    tftp_timer      *pending;
+    tftp_timer      *timer;
+    tftp_transfer   *t;
+
+    /* a full turn of the wheel visits every slot */
+    last = now - loop->tick > TFTP_WHEEL_SLOTS ?
+           loop->tick + TFTP_WHEEL_SLOTS : now;
+
+    for (tick = loop->tick + 1; tick <= last && loop->armed; tick++)
+    {
+        tftp_timer **slot = &loop->wheel[tick % TFTP_WHEEL_SLOTS];
+
+        /*
+         * Detach the slot, so that timers rearmed by their
+         * handlers are not visited twice.
+         */
+        pending = *slot;
+        *slot   = NULL;
+        if (pending != NULL)
+            pending->pprev = &pending;
+
+        while ((timer = pending) != NULL)
+        {
+            tftp_timer_cancel(loop, timer);
+
+            if (timer->expires > now)
+            {
+                /* expires on one of the next turns of the wheel */
+                timer->next  = *slot;
+                timer->pprev = slot;
+                if (*slot != NULL)
+                    (*slot)->pprev = &timer->next;
+                *slot = timer;
+                loop->armed++;
+                continue;
+            }
+
+            t = timer_to_transfer(timer);
+            if (tftp_transfer_timeout(t) != TFTP_TRANSFER_RUNNING)
+                tftp_loop_finish(loop, t);
+        }
+    }
+
+    loop->tick = now;
+}
+
+/**
+ * Get time until the nearest timer expiration.
+ *
+ * @return
+ *      'ts' filled with the timeout, or NULL, if no timer is armed.
+ */
+static struct timespec *tftp_loop_timeout(tftp_loop *loop,
+                                          struct timespec *ts)
+{
+    uint64_t    tick;
+    long        timeout;
+
+    if (loop->armed == 0)
+        return NULL;
+
+    for (tick = loop->tick + 1; tick < loop->tick + TFTP_WHEEL_SLOTS; tick++)
+        if (loop->wheel[tick % TFTP_WHEEL_SLOTS] != NULL)
+            break;
+
+    timeout = tick * TFTP_WHEEL_TICK - tftp_time_us();
+    if (timeout < 0)
+        timeout = 0;
+
+    ts->tv_sec  = timeout / 1000000;
+    ts->tv_nsec = timeout % 1000000 * 1000;
+
+    return ts;
+}
+
+/**
+ * Wait for events with microsecond precision timeout.
+ * Kernels without epoll_pwait2() get the timeout rounded up
+ * to milliseconds.
+ */
+static int tftp_loop_wait(tftp_loop *loop, struct epoll_event *events,
+                          struct timespec *ts)
+{
+    static int  no_pwait2;
+    int         n;
+
+    if (!no_pwait2)
+    {
+        n = epoll_pwait2(loop->epfd, events, TFTP_LOOP_EVENTS, ts, NULL);
+        if (n >= 0 || errno != ENOSYS)
+            return n;
+
+        no_pwait2 = 1;
+    }
+
+    return epoll_wait(loop->epfd, events, TFTP_LOOP_EVENTS,
+                      ts == NULL ? -1 :
+                      ts->tv_sec * 1000 + (ts->tv_nsec + 999999) / 1000000);
+}
+
+/**
+ * Print how many transfers were running and how much CPU
+ * they took since the previous report.
+ */
+void tftp_loop_report(tftp_loop *loop)
+{
+    long    now = tftp_time_us();
+    long    cpu = tftp_cpu_time_us(loop);
+    double  wall_time;
+    double  cpu_time;
+    double  active_time;
+
+    tftp_loop_account(loop);
+
+    wall_time   = (now - loop->stats.wall_time) / 1e6;
+    cpu_time    = (cpu - loop->stats.cpu_time) / 1e6;
+    active_time = loop->stats.active_time;
+
+    printf("tftp server: worker %u: %u active, %u peak, %lu completed, "
+           "%lu failed transfers\n", loop->worker, loop->active,
+           loop->stats.peak, loop->stats.completed, loop->stats.failed);
+
+    /*
+     * Average number of concurrent transfers divided by the share
+     * of a core they took is the number a single core sustains.
+     */
+    if (wall_time > 0 && cpu_time > 0)
+        printf("tftp server: worker %u: %.1f concurrent transfers on "
+               "average, %.1f%% of one core, %.0f transfers per core\n",
+               loop->worker, active_time / wall_time,
+               100 * cpu_time / wall_time, active_time / cpu_time);
+
+    if (loop->stats.tx_calls > 0 && loop->stats.rx_calls > 0)
+        printf("tftp server: worker %u: %.1f packets per %s, "
+               "%.1f packets per %s\n", loop->worker,
+               (double)loop->stats.tx_packets / loop->stats.tx_calls,
+               loop->uring != NULL ? "io_uring send" : "sendmmsg()",
+               (double)loop->stats.rx_packets / loop->stats.rx_calls,
+               loop->uring != NULL ? "io_uring wait" : "recvmmsg()");
+
+    if (loop->cache != NULL &&
+        loop->stats.cache_hits + loop->stats.cache_misses > 0)
+        printf("tftp server: worker %u: %lu cache hits, %lu misses, "
+               "%.0f%% hit ratio, %.1f MiB cached\n", loop->worker,
+               loop->stats.cache_hits, loop->stats.cache_misses,
+               100.0 * loop->stats.cache_hits /
+               (loop->stats.cache_hits + loop->stats.cache_misses),
+               tftp_cache_used(loop->cache) / (1024.0 * 1024.0));
+
+    if (loop->stats.written_behind + loop->stats.written_in_place +
+        loop->stats.zero_skipped > 0)
+        printf("tftp server: worker %u: %.1f MiB written behind, "
+               "%.1f MiB written in place, %.1f MiB of zero blocks "
+               "left as holes\n", loop->worker,
+               loop->stats.written_behind / (1024.0 * 1024.0),
+               loop->stats.written_in_place / (1024.0 * 1024.0),
+               loop->stats.zero_skipped / (1024.0 * 1024.0));
+
+    if (loop->stats.dup_acks + loop->stats.stale_data > 0)
+        printf("tftp server: worker %u: %lu duplicate ACKs ignored, "
+               "%lu windows resent on them, %lu stale DATA ignored\n",
+               loop->worker, loop->stats.dup_acks,
+               loop->stats.fast_resends, loop->stats.stale_data);
+
+    if (loop->stats.paced > 0)
+        printf("tftp server: worker %u: %lu windows held back by pacing\n",
+               loop->worker, loop->stats.paced);
+
+    loop->stats.tx_calls         = 0;
+    loop->stats.tx_packets       = 0;
+    loop->stats.rx_calls         = 0;
+    loop->stats.rx_packets       = 0;
+    loop->stats.written_behind   = 0;
+    loop->stats.written_in_place = 0;
+    loop->stats.zero_skipped     = 0;
+    loop->stats.dup_acks         = 0;
+    loop->stats.fast_resends     = 0;
+    loop->stats.stale_data       = 0;
+    loop->stats.paced            = 0;
+    loop->stats.active_time      = 0;
+    loop->stats.wall_time        = now;
+    loop->stats.cpu_time         = cpu;
+}
+
+/**
+ * Register 'fd' for 'events' in the loop.
+ *
+ * @return
+ *      Zero on success, or -1, if error occured.
+ */
+static int tftp_loop_watch(tftp_loop *loop, int fd, uint32_t events)
+{
+    struct epoll_event ev = { .events = events, .data.fd = fd };
+
+    if (fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK) ||
+        epoll_ctl(loop->epfd, EPOLL_CTL_ADD, fd, &ev))
+    {
+        perror("tftp server: epoll_ctl()");
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * Initialize event loop. Requests are read from 'listen_sock',
+ * unless it is -1, then transfers are only added by
+ * tftp_loop_add_request(). Requested files are opened beneath
+ * 'base_directory' opened as 'dir_fd'. Files read are served from
+ * 'cache', unless it is NULL.
+ *
+ * @return
+ *      Zero on success, or -1, if error occured.
+ *
+ * @se
+ *      Prints information about occurred error to stderr.
+ */
+int tftp_loop_init(tftp_loop *loop, int listen_sock,
+                   const char *base_directory, int dir_fd,
+                   tftp_cache *cache)
+{
+    int size = TFTP_SOCKET_BUFFER;
+
+    memset(loop, 0, sizeof(*loop));
+
+    if (pthread_getcpuclockid(pthread_self(), &loop->cpu_clock))
+        loop->cpu_clock = CLOCK_THREAD_CPUTIME_ID;
+
+    loop->listen_sock    = listen_sock;
+    loop->stop_fd        = -1;
+    loop->base_directory = base_directory;
+    loop->cache          = cache;
+    loop->tick           = tftp_time_us() / TFTP_WHEEL_TICK;
+    loop->changed_at     = tftp_time_us();
+    loop->stats.wall_time = loop->changed_at;
+    loop->stats.cpu_time  = tftp_cpu_time_us(loop);
+
+    tftp_dir_init(&loop->dir, dir_fd);
+
+    if (tftp_batch_init(&loop->tx, TFTP_LOOP_TX_BUFFER))
+        return -1;
+
+    if (tftp_batch_init(&loop->rx, TFTP_LOOP_BATCH * sizeof(tftp_message)))
+    {
+        tftp_batch_free(&loop->tx);
+        return -1;
+    }
+
+    loop->epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (loop->epfd == -1)
+    {
+        perror("tftp server: epoll_create1()");
+        tftp_batch_free(&loop->rx);
+        tftp_batch_free(&loop->tx);
+        return -1;
+    }
+
+    loop->xfer_sock = socket(AF_INET, SOCK_DGRAM, 0);
+    if (loop->xfer_sock == -1)
+    {
+        perror("tftp server: socket()");
+        close(loop->epfd);
+        tftp_batch_free(&loop->rx);
+        tftp_batch_free(&loop->tx);
+        return -1;
+    }
+
+    /* windows of many transfers are in flight at once */
+    setsockopt(loop->xfer_sock, SOL_SOCKET, SO_SNDBUF, &size, sizeof(size));
+    setsockopt(loop->xfer_sock, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+
+    /* only one of the workers is woken up to read directory changes */
+    if (tftp_loop_watch(loop, loop->xfer_sock, EPOLLIN) ||
+        (listen_sock != -1 && tftp_loop_watch(loop, listen_sock, EPOLLIN)) ||
+        (cache != NULL && tftp_loop_watch(loop, cache->inotify_fd,
+                                          EPOLLIN | EPOLLEXCLUSIVE)))
+    {
+        close(loop->xfer_sock);
+        close(loop->epfd);
+        tftp_batch_free(&loop->rx);
+        tftp_batch_free(&loop->tx);
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * Enable multicast transfers configured by 'mcast'. The loop serves
+ * multicast sessions if 'owner' is nonzero, otherwise it forwards
+ * multicast requests to the serving loop.
+ *
+ * @return
+ *      Zero on success, or -1, if error occured.
+ *
+ * @se
+ *      Prints information about occurred error to stderr.
+ */
+int tftp_loop_set_mcast(tftp_loop *loop, tftp_mcast *mcast, int owner)
+{
+    loop->mcast       = mcast;
+    loop->mcast_owner = owner;
+
+    if (!owner)
+        return 0;
+
+    if (setsockopt(loop->xfer_sock, IPPROTO_IP, IP_MULTICAST_IF,
+                   &mcast->interface, sizeof(mcast->interface)))
+    {
+        perror("tftp server: setsockopt()");
+        return -1;
+    }
+
+    return tftp_loop_watch(loop, mcast->event_fd, EPOLLIN);
+}
+
+/**
+ * Switch the loop to io_uring. Must be called after the loop
+ * is initialized and multicast is enabled.
+ *
+ * @return
+ *      Zero on success, or -1, if the kernel does not support
+ *      io_uring, then the loop keeps using epoll.
+ */
+int tftp_loop_set_uring(tftp_loop *loop)
+{
+    return tftp_uring_create(loop);
+}
+
+/**
+ * Stop the loop once eventfd 'stop_fd' is signalled: tftp_loop_run()
+ * returns at once, transfers in progress are not finished. Must be
+ * called before tftp_loop_set_uring().
+ *
+ * @return
+ *      Zero on success, or -1, if error occured.
+ */
+int tftp_loop_set_stop(tftp_loop *loop, int stop_fd)
+{
+    loop->stop_fd = stop_fd;
+
+    return tftp_loop_watch(loop, stop_fd, EPOLLIN);
+}
+
+/**
+ * Set how files of write requests are written: loop using epoll starts
+ * a writer thread that writes them behind their transfers, loop using
+ * io_uring writes them through the ring. Files are synced before
+ * the last block is acknowledged as 'fsync' says.
+ *
+ * @return
+ *      Zero on success, or -1, if error occured.
+ */
+int tftp_loop_set_writer(tftp_loop *loop, int fsync)
+{
+    loop->fsync = fsync;
+
+    if (loop->uring != NULL)
+        return 0;
+
+    loop->writer = tftp_writer_create();
+    if (loop->writer == NULL)
+        return -1;
+
+    if (tftp_loop_watch(loop, loop->writer->event_fd, EPOLLIN))
+    {
+        tftp_writer_destroy(loop->writer);
+        loop->writer = NULL;
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * Pace windows of read requests of the loop by server bandwidth cap
+ * 'pacer' (NULL if none) and 'client_rate' bytes per second of each
+ * client (0 if unlimited).
+ */
+void tftp_loop_set_pace(tftp_loop *loop, tftp_bucket *pacer,
+                        unsigned long client_rate)
+{
+    loop->pacer       = pacer;
+    loop->client_rate = client_rate;
+}
+
+/**
+ * Make loop 'loop' ask 'providers' (NULL if none) for files of read
+ * requests before the server directory.
+ */
+void tftp_loop_set_providers(tftp_loop *loop,
+                             const tftp_provider *providers)
+{
+    loop->providers = providers;
+}
+
+/** Stop all transfers and free loop resources. */
+void tftp_loop_destroy(tftp_loop *loop)
+{
+    int i;
+
+    for (i = 0; i < TFTP_LOOP_BUCKETS; i++)
+        while (loop->transfers[i] != NULL)
+        {
+            loop->transfers[i]->state = TFTP_TRANSFER_FAILED;
+            tftp_loop_finish(loop, loop->transfers[i]);
+        }
+
+    tftp_loop_flush(loop);
+
+    if (loop->uring != NULL)
+        tftp_uring_destroy(loop);
+    if (loop->writer != NULL)
+        tftp_writer_destroy(loop->writer);
+
+    close(loop->xfer_sock);
+    close(loop->epfd);
+    tftp_batch_free(&loop->rx);
+    tftp_batch_free(&loop->tx);
+    tftp_dir_destroy(&loop->dir);
+}
+
+/**
+ * Run event loop. Loop that accepts requests runs until it is
+ * stopped, otherwise it returns once all transfers are finished.
+ *
+ * @return
+ *      Zero if all transfers completed or the loop is stopped,
+ *      or -1, if a transfer failed or error occured.
+ *
+ * @se
+ *      Prints information about occurred error to stderr.
+ *      Periodically prints transfer statistics.
+ */
+int tftp_loop_run(tftp_loop *loop)
+{
+    int                 i;
+    int                 n;
+    unsigned long       reported = 0;
+    struct epoll_event  events[TFTP_LOOP_EVENTS];
+    struct timespec     ts;
+
+    while (!loop->stopped && (loop->listen_sock != -1 || loop->active > 0))
+    {
+        /* packets queued by transfers since the last wait */
+        tftp_loop_flush(loop);
+
+        if (loop->uring != NULL)
+        {
+            if (tftp_uring_wait(loop, tftp_loop_timeout(loop, &ts)) < 0 &&
+                errno != EINTR)
+            {
+                perror("tftp server: io_uring_enter()");
+                return -1;
+            }
+            n = 0;
+        }
+        else
+        {
+            n = tftp_loop_wait(loop, events, tftp_loop_timeout(loop, &ts));
+            if (n < 0 && errno != EINTR)
+            {
+                perror("tftp server: epoll_wait()");
+                return -1;
+            }
+        }
+
+        for (i = 0; i < n; i++)
+        {
+            if (events[i].data.fd == loop->stop_fd)
+                loop->stopped = 1;
+            else if (events[i].data.fd == loop->listen_sock)
+                tftp_loop_accept(loop);
+            else if (loop->cache != NULL &&
+                     events[i].data.fd == loop->cache->inotify_fd)
+                tftp_cache_notify(loop->cache);
+            else if (loop->mcast_owner &&
+                     events[i].data.fd == loop->mcast->event_fd)
+                tftp_mcast_accept(loop);
+            else if (loop->writer != NULL &&
+                     events[i].data.fd == loop->writer->event_fd)
+                tftp_writer_complete(loop);
+            else
+                tftp_loop_receive(loop);
+        }
+
+        tftp_loop_expire(loop);
+
+        if (loop->listen_sock != -1 &&
+            (loop->active > 0 || loop->stats.transfers != reported) &&
+            tftp_time_us() - loop->stats.wall_time >= TFTP_REPORT_INTERVAL)
+        {
+            tftp_loop_report(loop);
+            reported = loop->stats.transfers;
+        }
+    }
+
+    tftp_loop_flush(loop);
+
+    return loop->stats.failed && !loop->stopped ? -1 : 0;
+}
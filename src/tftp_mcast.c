@@ -0,0 +1,285 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/eventfd.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "include/tftp_mcast.h"
+#include "include/tftp_loop.h"
+#include "include/tftp_transfer.h"
+
+#define TFTP_MCAST_PORT         1758    /* used in RFC 2090 examples */
+
+/**
+ * Check if tftp request 'msg' asks for multicast transfer.
+ *
+ * @return
+ *      Nonzero if the request has the multicast option.
+ */
+int tftp_mcast_requested(tftp_message *msg, ssize_t msg_len)
+{
+    char    *field = (char *)msg->request.filename_and_mode;
+    char    *last  = (char *)msg + msg_len - 1;
+    int     i;
+
+    if (msg_len < TFTP_MSG_MIN_SIZE || ntohs(msg->opcode) != RRQ ||
+        *last != '\0')
+        return 0;
+
+    /* filename, mode, then option names alternate with values */
+    for (i = 0; field <= last; i++, field = strchr(field, '\0') + 1)
+        if (i >= 2 && i % 2 == 0 && !strcasecmp(field, "multicast"))
+            return 1;
+
+    return 0;
+}
+
+/**
+ * Pass request to the loop serving multicast sessions.
+ *
+ * @return
+ *      Zero on success, or -1, if error occured.
+ *
+ * @se
+ *      Prints information about occurred error to stderr.
+ */
+int tftp_mcast_forward(tftp_mcast *mcast, tftp_message *msg,
+                       ssize_t msg_len, struct sockaddr_in *client_sock,
+                       socklen_t slen)
+{
+    tftp_mcast_request  *req;
+    tftp_mcast_request  **preq;
+    uint64_t            one = 1;
+
+    req = malloc(sizeof(*req) + msg_len);
+    if (req == NULL)
+    {
+        perror("tftp server: malloc()");
+        return -1;
+    }
+
+    req->next        = NULL;
+    req->client_sock = *client_sock;
+    req->slen        = slen;
+    req->msg_len     = msg_len;
+    memcpy(req->msg, msg, msg_len);
+
+    pthread_mutex_lock(&mcast->lock);
+    for (preq = &mcast->inbox; *preq != NULL; preq = &(*preq)->next)
+        ;
+    *preq = req;
+    pthread_mutex_unlock(&mcast->lock);
+
+    if (write(mcast->event_fd, &one, sizeof(one)) != sizeof(one))
+        perror("tftp server: write()");
+
+    return 0;
+}
+
+/** Start transfers of requests forwarded to the serving 'loop'. */
+void tftp_mcast_accept(tftp_loop *loop)
+{
+    tftp_mcast          *mcast = loop->mcast;
+    tftp_mcast_request  *req;
+    tftp_mcast_request  *next;
+    uint64_t            count;
+
+    if (read(mcast->event_fd, &count, sizeof(count)) != sizeof(count))
+        return;
+
+    pthread_mutex_lock(&mcast->lock);
+    req          = mcast->inbox;
+    mcast->inbox = NULL;
+    pthread_mutex_unlock(&mcast->lock);
+
+    for (; req != NULL; req = next)
+    {
+        next = req->next;
+        tftp_loop_add_request(loop, (tftp_message *)req->msg, req->msg_len,
+                              &req->client_sock, req->slen);
+        free(req);
+    }
+}
+
+/**
+ * Add read request transfer 't' to the session of the file it reads,
+ * or start a new session with 't' as the master client.
+ * Clients of a session must agree on block size.
+ *
+ * @return
+ *      Zero on success, or -1, if the transfer can not be multicast.
+ *
+ * @se
+ *      Prints information about the joined session.
+ */
+int tftp_mcast_join(tftp_transfer *t)
+{
+    tftp_loop           *loop  = t->loop;
+    tftp_mcast          *mcast = loop->mcast;
+    tftp_mcast_session  *s;
+    tftp_transfer       **pt;
+    struct stat         st;
+    unsigned int        slot;
+    char                group[INET_ADDRSTRLEN];
+
+    /*
+     * Block numbers of a session must not wrap around, and blocks
+     * of netascii text and of generated files do not map to a file.
+     */
+    if (mcast == NULL || !loop->mcast_owner || t->opcode != RRQ ||
+        t->mode != OCTET || t->provided ||
+        fstat(fileno(t->fd), &st) || !S_ISREG(st.st_mode) ||
+        st.st_size / t->opts.blksize >= UINT16_MAX)
+        return -1;
+
+    for (s = mcast->sessions; s != NULL; s = s->next)
+        if (s->dev == st.st_dev && s->ino == st.st_ino &&
+            s->size == st.st_size && s->blksize == t->opts.blksize &&
+            s->mtime.tv_sec  == st.st_mtim.tv_sec &&
+            s->mtime.tv_nsec == st.st_mtim.tv_nsec)
+            break;
+
+    if (s == NULL)
+    {
+        for (slot = 0; slot < TFTP_MCAST_SESSIONS; slot++)
+            if (!(mcast->slots & (1ULL << slot)))
+                break;
+
+        if (slot == TFTP_MCAST_SESSIONS)
+            return -1;
+
+        s = calloc(1, sizeof(*s));
+        if (s == NULL)
+            return -1;
+
+        s->dev     = st.st_dev;
+        s->ino     = st.st_ino;
+        s->size    = st.st_size;
+        s->mtime   = st.st_mtim;
+        s->blksize = t->opts.blksize;
+        s->slot    = slot;
+        s->group   = mcast->group;
+        s->master  = t;
+
+        s->group.sin_port = htons(ntohs(mcast->group.sin_port) + slot);
+
+        s->next         = mcast->sessions;
+        mcast->sessions = s;
+        mcast->slots   |= 1ULL << slot;
+    }
+    else
+    {
+        for (pt = &s->waiting; *pt != NULL; pt = &(*pt)->session_next)
+            ;
+        *pt = t;
+    }
+
+    t->session = s;
+
+    inet_ntop(AF_INET, &s->group.sin_addr, group, sizeof(group));
+    printf("%s.%u: joined multicast group %s:%u%s\n",
+            inet_ntoa(t->client_sock.sin_addr),
+            ntohs(t->client_sock.sin_port),
+            group, ntohs(s->group.sin_port),
+            s->master == t ? " as master client" : "");
+
+    return 0;
+}
+
+/**
+ * Remove finished transfer 't' from its session. If 't' was the
+ * master client, the next client becomes the master, and the session
+ * ends with the last client.
+ */
+void tftp_mcast_leave(tftp_transfer *t)
+{
+    tftp_mcast_session  *s     = t->session;
+    tftp_mcast          *mcast = t->loop->mcast;
+    tftp_mcast_session  **ps;
+    tftp_transfer       **pt;
+
+    t->session = NULL;
+
+    if (s->master != t)
+    {
+        for (pt = &s->waiting; *pt != t; pt = &(*pt)->session_next)
+            ;
+        *pt = t->session_next;
+        return;
+    }
+
+    s->master = s->waiting;
+    if (s->master != NULL)
+    {
+        s->waiting = s->master->session_next;
+        s->master->session_next = NULL;
+
+        tftp_transfer_promote(s->master);
+        return;
+    }
+
+    for (ps = &mcast->sessions; *ps != s; ps = &(*ps)->next)
+        ;
+    *ps = s->next;
+
+    mcast->slots &= ~(1ULL << s->slot);
+    free(s);
+}
+
+/**
+ * Create multicast configuration with groups at 'group' address
+ * and ports following 'port', sent from 'interface' address.
+ *
+ * @return
+ *      New configuration, or NULL, if error occured.
+ *
+ * @se
+ *      Prints information about occurred error to stderr.
+ */
+tftp_mcast *tftp_mcast_create(const char *group, const char *port,
+                              const char *interface)
+{
+    tftp_mcast *mcast;
+
+    mcast = calloc(1, sizeof(*mcast));
+    if (mcast == NULL)
+    {
+        perror("tftp server: calloc()");
+        return NULL;
+    }
+
+    mcast->group.sin_family = AF_INET;
+    mcast->group.sin_port   = htons(port != NULL ? atoi(port) :
+                                                   TFTP_MCAST_PORT);
+
+    if (!inet_aton(group, &mcast->group.sin_addr) ||
+        !IN_MULTICAST(ntohl(mcast->group.sin_addr.s_addr)))
+    {
+        fprintf(stderr, "tftp server: invalid multicast group '%s'\n",
+                group);
+        free(mcast);
+        return NULL;
+    }
+
+    mcast->interface.s_addr = inet_addr(interface);
+
+    mcast->event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (mcast->event_fd == -1)
+    {
+        perror("tftp server: eventfd()");
+        free(mcast);
+        return NULL;
+    }
+
+    pthread_mutex_init(&mcast->lock, NULL);
+
+    return mcast;
+}
@@ -0,0 +1,184 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <unistd.h>
+
+#include "include/tftp_metrics.h"
+#include "include/tftp_loop.h"
+#include "include/tftp_cache.h"
+
+/* Counter of tftp_metrics, series of a family follow each other. */
+static const struct {
+    const char  *name;
+    const char  *help;
+    const char  *label;             /* NULL if the series has none */
+    size_t      offset;
+} tftp_counters[] = {
+    { "tftp_requests_total", "Requests received.",
+      "type=\"read\"", offsetof(tftp_metrics, reads) },
+    { "tftp_requests_total", NULL,
+      "type=\"write\"", offsetof(tftp_metrics, writes) },
+    { "tftp_transfers_total", "Finished transfers.",
+      "result=\"completed\"", offsetof(tftp_metrics, completed) },
+    { "tftp_transfers_total", NULL,
+      "result=\"failed\"", offsetof(tftp_metrics, failed) },
+    { "tftp_data_bytes_total", "File data of finished transfers.",
+      "direction=\"sent\"", offsetof(tftp_metrics, bytes_sent) },
+    { "tftp_data_bytes_total", NULL,
+      "direction=\"received\"", offsetof(tftp_metrics, bytes_received) },
+    { "tftp_blocks_total", "DATA packets of finished transfers.",
+      "direction=\"sent\"", offsetof(tftp_metrics, blocks_sent) },
+    { "tftp_blocks_total", NULL,
+      "direction=\"received\"", offsetof(tftp_metrics, blocks_received) },
+    { "tftp_retransmits_total",
+      "DATA and ACK packets resent by finished transfers.",
+      NULL, offsetof(tftp_metrics, retransmits) },
+    { "tftp_timeouts_total",
+      "Retransmission timeouts of finished transfers.",
+      NULL, offsetof(tftp_metrics, timeouts) },
+    { "tftp_duplicates_total", "Duplicate and stale packets ignored.",
+      "packet=\"ack\"", offsetof(tftp_metrics, dup_acks) },
+    { "tftp_duplicates_total", NULL,
+      "packet=\"data\"", offsetof(tftp_metrics, stale_data) },
+    { "tftp_paced_total", "Windows held back by pacing.",
+      NULL, offsetof(tftp_metrics, paced) },
+    { "tftp_cache_lookups_total", "Files read looked up in the cache.",
+      "result=\"hit\"", offsetof(tftp_metrics, cache_hits) },
+    { "tftp_cache_lookups_total", NULL,
+      "result=\"miss\"", offsetof(tftp_metrics, cache_misses) },
+    { "tftp_opens_total", "Files opened for requests.",
+      "path=\"cached\"", offsetof(tftp_metrics, opens_cached) },
+    { "tftp_opens_total", NULL,
+      "path=\"resolved\"", offsetof(tftp_metrics, opens_resolved) },
+    { "tftp_opens_total", NULL,
+      "path=\"provided\"", offsetof(tftp_metrics, opens_provided) },
+};
+
+/* Latency histogram of tftp_metrics. */
+static const struct {
+    const char  *name;
+    const char  *help;
+    size_t      offset;
+} tftp_histograms[] = {
+    { "tftp_rtt_seconds", "Round-trip times measured by transfers.",
+      offsetof(tftp_metrics, rtt) },
+    { "tftp_transfer_duration_seconds", "Durations of finished transfers.",
+      offsetof(tftp_metrics, duration) },
+    { "tftp_cache_lookup_seconds",
+      "Times to get files read from the cache, including reading "
+      "missing ones.", offsetof(tftp_metrics, cache_latency) },
+    { "tftp_disk_write_seconds",
+      "Times of writes and syncs of uploaded files.",
+      offsetof(tftp_metrics, disk_latency) },
+};
+
+/** Print histogram 'h' of loop 'loop' as series of 'name'. */
+static void tftp_histogram_print(FILE *f, const char *name,
+                                 tftp_loop *loop, const tftp_histogram *h)
+{
+    unsigned long   cumulative = 0;
+    unsigned int    i;
+
+    for (i = 0; i < TFTP_HIST_BUCKETS; i++)
+    {
+        cumulative += h->buckets[i];
+        fprintf(f, "%s_bucket{worker=\"%u\",le=\"%g\"} %lu\n",
+                name, loop->worker, (double)(1UL << i) / 1e6, cumulative);
+    }
+
+    fprintf(f, "%s_bucket{worker=\"%u\",le=\"+Inf\"} %lu\n",
+            name, loop->worker, h->count);
+    fprintf(f, "%s_sum{worker=\"%u\"} %g\n",
+            name, loop->worker, h->sum / 1e6);
+    fprintf(f, "%s_count{worker=\"%u\"} %lu\n",
+            name, loop->worker, h->count);
+}
+
+/**
+ * Write metrics of 'n' loops 'loops' and of the file cache 'cache'
+ * (may be NULL) to file 'path' in Prometheus text format. The file
+ * is replaced at once, so a scraper never reads it half written.
+ * Metrics are read while the loops update them, so a value may be
+ * a moment behind another one.
+ *
+ * @return
+ *      Zero on success, or -1, if error occured.
+ *
+ * @se
+ *      Prints information about occurred error to stderr.
+ */
+int tftp_metrics_write(const char *path, tftp_loop **loops, unsigned int n,
+                       tftp_cache *cache)
+{
+    char                    tmp[4096];
+    FILE                    *f;
+    unsigned int            i;
+    unsigned int            j;
+    const char              *m;
+    const tftp_histogram    *h;
+
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+
+    f = fopen(tmp, "w");
+    if (f == NULL)
+    {
+        perror("tftp server: fopen()");
+        return -1;
+    }
+
+    fprintf(f, "# HELP tftp_transfers_active Transfers in progress.\n"
+               "# TYPE tftp_transfers_active gauge\n");
+    for (j = 0; j < n; j++)
+        fprintf(f, "tftp_transfers_active{worker=\"%u\"} %u\n",
+                loops[j]->worker, loops[j]->active);
+
+    for (i = 0; i < sizeof(tftp_counters) / sizeof(tftp_counters[0]); i++)
+    {
+        if (tftp_counters[i].help != NULL)
+            fprintf(f, "# HELP %s %s\n# TYPE %s counter\n",
+                    tftp_counters[i].name, tftp_counters[i].help,
+                    tftp_counters[i].name);
+
+        for (j = 0; j < n; j++)
+        {
+            m = (const char *)&loops[j]->metrics;
+            fprintf(f, "%s{worker=\"%u\"%s%s} %lu\n",
+                    tftp_counters[i].name, loops[j]->worker,
+                    tftp_counters[i].label != NULL ? "," : "",
+                    tftp_counters[i].label != NULL ?
+                    tftp_counters[i].label : "",
+                    *(const unsigned long *)(m + tftp_counters[i].offset));
+        }
+    }
+
+    for (i = 0; i < sizeof(tftp_histograms) / sizeof(tftp_histograms[0]);
+         i++)
+    {
+        fprintf(f, "# HELP %s %s\n# TYPE %s histogram\n",
+                tftp_histograms[i].name, tftp_histograms[i].help,
+                tftp_histograms[i].name);
+
+        for (j = 0; j < n; j++)
+        {
+            m = (const char *)&loops[j]->metrics;
+            h = (const tftp_histogram *)(m + tftp_histograms[i].offset);
+            tftp_histogram_print(f, tftp_histograms[i].name, loops[j], h);
+        }
+    }
+
+    if (cache != NULL)
+        fprintf(f, "# HELP tftp_cache_bytes Size of files in the cache.\n"
+                   "# TYPE tftp_cache_bytes gauge\n"
+                   "tftp_cache_bytes %lu\n",
+                (unsigned long)tftp_cache_used(cache));
+
+    if (fclose(f) || rename(tmp, path))
+    {
+        perror("tftp server: write metrics");
+        unlink(tmp);
+        return -1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,177 @@
+#include <string.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+#include "include/tftp_netascii.h"
+
+#define CR      '\r'
+#define LF      '\n'
+
+/**
+ * Get number of leading bytes of 'data' that are not CR, and not LF
+ * either, if 'lf' is nonzero.
+ *
+ * @return
+ *      Length of the run, 'len' if there is no such byte.
+ */
+static size_t tftp_netascii_span(const uint8_t *data, size_t len, int lf)
+{
+    size_t  i = 0;
+
+#if defined(__SSE2__)
+    __m128i cr   = _mm_set1_epi8(CR);
+    __m128i nl   = _mm_set1_epi8(lf ? LF : CR);
+    __m128i v;
+    int     mask;
+
+    for (; i + 16 <= len; i += 16)
+    {
+        v    = _mm_loadu_si128((const __m128i *)(data + i));
+        mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, cr),
+                                              _mm_cmpeq_epi8(v, nl)));
+        if (mask != 0)
+            return i + __builtin_ctz(mask);
+    }
+#elif defined(__ARM_NEON)
+    uint8x16_t  cr = vdupq_n_u8(CR);
+    uint8x16_t  nl = vdupq_n_u8(lf ? LF : CR);
+    uint8x16_t  v;
+
+    for (; i + 16 <= len; i += 16)
+    {
+        v = vld1q_u8(data + i);
+        if (vmaxvq_u8(vorrq_u8(vceqq_u8(v, cr), vceqq_u8(v, nl))) != 0)
+            break;
+    }
+#endif
+
+    for (; i < len; i++)
+        if (data[i] == CR || (lf && data[i] == LF))
+            break;
+
+    return i;
+}
+
+/**
+ * Translate up to 'len' bytes of 'src' to netascii into block 'dst'
+ * of 'size' bytes. Second byte of CR LF or CR NUL that does not fit
+ * the block is kept in '*carry' and put first into the next block,
+ * '*carry' is -1 if there is no such byte.
+ *
+ * @param used      Location for number of bytes of 'src' translated.
+ *
+ * @return
+ *      Number of bytes put into 'dst'.
+ */
+size_t tftp_netascii_encode(const uint8_t *src, size_t len, uint8_t *dst,
+                            size_t size, int *carry, size_t *used)
+{
+    const uint8_t   *in  = src;
+    const uint8_t   *end = src + len;
+    uint8_t         *out = dst;
+    uint8_t         *out_end = dst + size;
+    size_t          run;
+
+    if (*carry >= 0 && out < out_end)
+    {
+        *out++ = *carry;
+        *carry = -1;
+    }
+
+    while (in < end && out < out_end)
+    {
+        run = end - in < out_end - out ? end - in : out_end - out;
+        run = tftp_netascii_span(in, run, 1);
+        memcpy(out, in, run);
+        out += run;
+        in  += run;
+
+        if (in == end || out == out_end)
+            break;
+
+        *out++ = CR;
+        *carry = *in++ == LF ? LF : '\0';
+
+        if (out < out_end)
+        {
+            *out++ = *carry;
+            *carry = -1;
+        }
+    }
+
+    *used = in - src;
+
+    return out - dst;
+}
+
+/**
+ * Translate block of '*len' bytes of netascii 'data' back in place.
+ * CR ending a block is kept in '*cr' until the next block tells what
+ * it stands for, and put at the end of the last block as is.
+ * The byte preceding 'data' must be writable.
+ *
+ * @return
+ *      Start of the translated data, its length is put to '*len'.
+ */
+uint8_t *tftp_netascii_decode(uint8_t *data, size_t *len, int *cr, int last)
+{
+    uint8_t *start = data;
+    uint8_t *in    = data;
+    uint8_t *end   = data + *len;
+    uint8_t *out   = data;
+    size_t  run;
+
+    /* CR of the previous block */
+    if (*cr && in < end)
+    {
+        *cr = 0;
+
+        if (*in == LF || *in == '\0')
+            *out++ = *in++ == LF ? LF : CR;
+        else
+            *--start = CR;
+    }
+
+    while (in < end)
+    {
+        run = tftp_netascii_span(in, end - in, 0);
+        memmove(out, in, run);
+        out += run;
+        in  += run;
+
+        if (in == end)
+            break;
+
+        if (in + 1 == end)
+        {
+            *cr = 1;
+            break;
+        }
+
+        /* bare CR stays as is */
+        if (in[1] == LF || in[1] == '\0')
+        {
+            *out++ = in[1] == LF ? LF : CR;
+            in += 2;
+        }
+        else
+        {
+            *out++ = *in++;
+        }
+    }
+
+    /* the last block has room for one more byte */
+    if (last && *cr)
+    {
+        *out++ = CR;
+        *cr    = 0;
+    }
+
+    *len = out - start;
+
+    return start;
+}
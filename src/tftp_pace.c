@@ -0,0 +1,80 @@
+#include "include/tftp_pace.h"
+#include "include/tftp_transfer.h"
+
+/** Initialize token bucket 'b' filling with 'rate' bytes per second. */
+void tftp_bucket_init(tftp_bucket *b, unsigned long rate)
+{
+    b->rate = rate;
+    b->due  = 0;
+}
+
+/** Get microseconds 'len' bytes take at the rate of bucket 'b'. */
+static long tftp_bucket_cost(const tftp_bucket *b, size_t len)
+{
+    return (unsigned long)len * 1000000UL / b->rate;
+}
+
+/**
+ * Get time bytes sent 'now' have to wait for the bucket with the next
+ * byte 'due' at, as 'burst' bytes sent ahead of the rate are used up.
+ *
+ * @return
+ *      Microseconds to wait, or zero, if they can be sent now.
+ */
+static long tftp_bucket_wait(const tftp_bucket *b, long due, long now,
+                             size_t burst)
+{
+    long ahead = due - now - tftp_bucket_cost(b, burst);
+
+    return ahead > 0 ? ahead : 0;
+}
+
+/**
+ * Take 'len' bytes of the window read request 't' is about to send
+ * from the bucket of the client and from the server bucket.
+ *
+ * @return
+ *      Zero if the window can be sent now, or microseconds to wait
+ *      before trying again.
+ */
+long tftp_pace(tftp_transfer *t, size_t len)
+{
+    tftp_bucket *server = t->loop->pacer;
+    long        now     = tftp_time_us();
+    long        wait;
+    long        due;
+    long        next;
+    size_t      burst;
+
+    if (t->pace.rate > 0)
+    {
+        wait = tftp_bucket_wait(&t->pace, t->pace.due, now,
+                                TFTP_PACE_BURST);
+        if (wait > 0)
+            return wait;
+    }
+
+    if (server != NULL)
+    {
+        /* small transfers may go further ahead, large ones wait first */
+        burst = t->file_size >= 0 && t->file_size <= TFTP_PACE_SMALL ?
+                TFTP_PACE_SMALL_BURST : TFTP_PACE_BURST;
+        due   = __atomic_load_n(&server->due, __ATOMIC_RELAXED);
+
+        do {
+            wait = tftp_bucket_wait(server, due, now, burst);
+            if (wait > 0)
+                return wait;
+
+            next = (due > now ? due : now) + tftp_bucket_cost(server, len);
+        } while (!__atomic_compare_exchange_n(&server->due, &due, next, 0,
+                                              __ATOMIC_RELAXED,
+                                              __ATOMIC_RELAXED));
+    }
+
+    if (t->pace.rate > 0)
+        t->pace.due = (t->pace.due > now ? t->pace.due : now) +
+                      tftp_bucket_cost(&t->pace, len);
+
+    return 0;
+}
@@ -0,0 +1,165 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fnmatch.h>
+#include <arpa/inet.h>
+
+#include "include/tftp_provider.h"
+
+/* Provider expanding a template, 'provider' goes first. */
+typedef struct tftp_template {
+    tftp_provider   provider;
+    char            *pattern;       /* fnmatch() pattern of names     */
+    char            *text;
+    size_t          len;
+} tftp_template;
+
+/**
+ * Ask 'providers' one after another for file 'name' of 'client'.
+ *
+ * @return
+ *      Zero if a provider has the file, its content is in 'data',
+ *      'len' and 'borrowed', 1 if none of them has it, or -1,
+ *      if error occured.
+ */
+int tftp_provider_get(const tftp_provider *providers,
+                      const struct sockaddr_in *client, const char *name,
+                      uint8_t **data, size_t *len, int *borrowed)
+{
+    const tftp_provider *p;
+    int                 ret = 1;
+
+    for (p = providers; p != NULL && ret == 1; p = p->next)
+        ret = p->get(p, client, name, data, len, borrowed);
+
+    return ret;
+}
+
+/** Expand template 'p' for file 'name' of 'client'. */
+static int tftp_template_get(const tftp_provider *p,
+                             const struct sockaddr_in *client,
+                             const char *name, uint8_t **data, size_t *len,
+                             int *borrowed)
+{
+    const tftp_template *tpl = (const tftp_template *)p;
+    const char          *c;
+    const char          *end = tpl->text + tpl->len;
+    char                addr[INET_ADDRSTRLEN];
+    char                *buf;
+    size_t              size;
+    FILE                *f;
+
+    if (fnmatch(tpl->pattern, name, FNM_PATHNAME))
+        return 1;
+
+    f = open_memstream(&buf, &size);
+    if (f == NULL)
+        return -1;
+
+    inet_ntop(AF_INET, &client->sin_addr, addr, sizeof(addr));
+
+    for (c = tpl->text; c < end; c++)
+    {
+        if (*c != '%' || c + 1 == end)
+        {
+            putc(*c, f);
+            continue;
+        }
+
+        switch (*++c)
+        {
+            case 'a':
+                fputs(addr, f);
+                break;
+            case 'x':
+                fprintf(f, "%08X", ntohl(client->sin_addr.s_addr));
+                break;
+            case 'p':
+                fprintf(f, "%u", ntohs(client->sin_port));
+                break;
+            case 'n':
+                fputs(name, f);
+                break;
+            case '%':
+                putc('%', f);
+                break;
+            default:
+                putc('%', f);
+                putc(*c, f);
+                break;
+        }
+    }
+
+    if (ferror(f))
+    {
+        fclose(f);
+        free(buf);
+        return -1;
+    }
+
+    if (fclose(f))
+        return -1;
+
+    *data     = (uint8_t *)buf;
+    *len      = size;
+    *borrowed = 0;
+
+    return 0;
+}
+
+/**
+ * Create provider of names matching 'pattern' from template file
+ * 'path', which is read at once.
+ *
+ * @return
+ *      New provider, or NULL, if error occured.
+ *
+ * @se
+ *      Prints information about occurred error to stderr.
+ */
+tftp_provider *tftp_template_create(const char *pattern, const char *path)
+{
+    tftp_template   *tpl;
+    FILE            *f;
+    long            size;
+
+    tpl = calloc(1, sizeof(*tpl));
+    if (tpl == NULL)
+    {
+        perror("tftp server: calloc()");
+        return NULL;
+    }
+
+    f = fopen(path, "r");
+    if (f == NULL)
+    {
+        fprintf(stderr, "tftp server: template '%s': %s\n",
+                path, strerror(errno));
+        free(tpl);
+        return NULL;
+    }
+
+    if (fseek(f, 0, SEEK_END) || (size = ftell(f)) < 0 ||
+        fseek(f, 0, SEEK_SET) ||
+        (tpl->text = malloc(size + 1)) == NULL ||
+        fread(tpl->text, 1, size, f) != (size_t)size ||
+        (tpl->pattern = strdup(pattern)) == NULL)
+    {
+        fprintf(stderr, "tftp server: template '%s': %s\n",
+                path, strerror(errno));
+        fclose(f);
+        free(tpl->text);
+        free(tpl);
+        return NULL;
+    }
+
+    fclose(f);
+
+    tpl->len          = size;
+    tpl->provider.get = tftp_template_get;
+
+    return &tpl->provider;
+}
@@ -1,3 +1,5 @@
+#define _GNU_SOURCE
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -8,70 +10,80 @@
 #include <arpa/inet.h>
 #include <netdb.h>
 #include <stdint.h>
-#include <sys/time.h>
 #include <unistd.h>
 #include <signal.h>
+#include <pthread.h>
+#include <sched.h>
 #include <sys/wait.h>
+#include <limits.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/eventfd.h>
 
 #include "include/tftp_server.h"
+#include "include/tftp_loop.h"
+#include "include/tftp_transfer.h"
+#include "include/tftp_writer.h"
+#include "include/tftp_metrics.h"
 
-#define RECV_TIMEOUT            5
-#define RECV_RETRIES            5
-#define TFTP_MAX_PAYLOAD        512
-#define TFTP_MSG_MIN_SIZE       4
-
-enum tftp_opcode {
-    RRQ = 1,
-    WRQ,
-    DATA,
-    ACK,
-    ERROR
-};
+/* Global variable that helps properly close the server. */
+int global_server_socket;
 
-enum tftp_transfer_mode {
-    NETASCII = 1,
-    OCTET
-};
+#define TFTP_MAX_WORKERS        1024
 
-typedef union {
+/* Server with event loop workers, NULL in fork-per-request mode. */
+static tftp_server_data *global_server;
 
-    uint16_t opcode;
+/* Eventfd SIGTERM stops the server with, -1 until it is started. */
+static int global_stop_fd = -1;
 
-    struct {
-        uint16_t    opcode;                                 /* RRQ or WRQ */
-        uint8_t     filename_and_mode[TFTP_MAX_PAYLOAD + 2];/* +2 for mode */
-    } __attribute__((packed)) request;
+/** Write metrics of running workers of the server to its metrics file. */
+static void tftp_server_metrics(tftp_server_data *srv_data)
+{
+    tftp_loop       *loops[TFTP_MAX_WORKERS];
+    unsigned int    n = 0;
+    unsigned int    i;
 
-    struct {
-        uint16_t    opcode;                                 /* DATA */
-        uint16_t    block_number;
-        uint8_t     data[TFTP_MAX_PAYLOAD];
-    } __attribute__((packed)) data;
+    for (i = 0; i < srv_data->n_workers; i++)
+        if (srv_data->workers[i].running)
+            loops[n++] = &srv_data->workers[i].loop;
 
-    struct {
-        uint16_t    opcode;                                 /* ACK */
-        uint16_t    block_number;
-    } __attribute__((packed)) ack;
+    tftp_metrics_write(srv_data->metrics, loops, n, srv_data->cache);
+}
 
-    struct {
-        uint16_t    opcode;                                 /* ERROR */
-        uint16_t    error_code;
-        uint8_t     error_string[TFTP_MAX_PAYLOAD];
-    } __attribute__((packed)) error;
+/**
+ * Write metrics of the server every TFTP_METRICS_INTERVAL seconds
+ * until the server is stopped, the final ones are written by the main
+ * thread. Workers are not disturbed, their metrics are read as they are.
+ */
+static void *tftp_metrics_run(void *arg)
+{
+    tftp_server_data    *srv_data = arg;
+    struct pollfd       stop      = { .fd = srv_data->stop_fd,
+                                      .events = POLLIN };
 
-} __attribute__((packed)) tftp_message;
+    while (poll(&stop, 1, TFTP_METRICS_INTERVAL * 1000) == 0)
+        tftp_server_metrics(srv_data);
 
-/* Global variable that helps properly close the server. */
-int global_server_socket;
+    return NULL;
+}
 
-/** Close tftp server.  */
+/**
+ * Stop tftp server. The handler only signals the stop descriptor,
+ * the main thread reports and shuts the server down once the workers
+ * are stopped.
+ */
 void term_handler()
 {
-    printf("tftp server: shutting down\n");
+    uint64_t    one   = 1;
+    int         saved = errno;
 
-    close(global_server_socket);
+    if (global_stop_fd == -1 ||
+        write(global_stop_fd, &one, sizeof(one)) != sizeof(one))
+        _exit(EXIT_FAILURE);
 
-    exit(EXIT_SUCCESS);
+    errno = saved;
 }
 
 /** Handle error in child proccess */
@@ -84,27 +96,48 @@ void chld_handler()
 }
 
 /**
- * Fill 'ret' structure with appropriate data.
+ * Parse CPU list like "0,2-3" into 'cpus'.
  *
  * @return
- *      Zero on success, or -1, if error occured.
+ *      Number of CPUs in the list, or -1, if the list is invalid.
  */
-int tftp_fill_server_data(tftp_server_data *ret, tftp_server_options *opt)
+static int tftp_parse_cpus(const char *list, int *cpus, int max_cpus)
 {
-    int retval;
+    char    *end;
+    long    first;
+    long    last;
+    int     n = 0;
 
-    retval = conn_info_fill(&ret->udp_conn, opt->addr,
-                            atoi(opt->port), SOCK_DGRAM);
-    if (retval)
-        return retval;
+    while (*list != '\0')
+    {
+        first = last = strtol(list, &end, 10);
+        if (end == list || first < 0)
+            return -1;
 
-    ret->base_directory = opt->dir;
+        if (*end == '-')
+        {
+            list = end + 1;
+            last = strtol(list, &end, 10);
+            if (end == list || last < first)
+                return -1;
+        }
 
-    return retval;
+        for (; first <= last && n < max_cpus; first++)
+            cpus[n++] = first;
+
+        if (*end == ',')
+            end++;
+        else if (*end != '\0')
+            return -1;
+
+        list = end;
+    }
+
+    return n;
 }
 
 /**
- * Send tftp DATA packet to client.
+ * Fill 'ret' structure with appropriate data.
  *
  * @return
  *      Zero on success, or -1, if error occured.
@@ -112,96 +145,157 @@ int tftp_fill_server_data(tftp_server_data *ret, tftp_server_options *opt)
  * @se
  *      Prints information about occurred error to stderr.
  */
-static int tftp_send_data(int s, uint16_t block_number, uint8_t *data,
-                          ssize_t data_len, struct sockaddr_in *sock,
-                          socklen_t slen)
+int tftp_fill_server_data(tftp_server_data *ret, tftp_server_options *opt)
 {
-    tftp_message    msg;
-    int             msg_len;
-    ssize_t         len;
+    int             retval;
+    int             cpus[TFTP_MAX_WORKERS];
+    int             n_cpus = 0;
+    unsigned int    i;
+    char            cwd[PATH_MAX];
+    char            *metrics;
+    tftp_provider   *provider;
+    tftp_archive    *archive;
+    long            start;
 
-    msg.opcode              = htons(DATA);
-    msg.data.block_number   = htons(block_number);
-    msg_len                 = 4 + data_len;                /* +4 for opcode */
-    memcpy(msg.data.data, data, data_len);
+    retval = conn_info_fill(&ret->udp_conn, opt->addr,
+                            atoi(opt->port), SOCK_DGRAM);
+    if (retval)
+        return retval;
+
+    ret->base_directory   = opt->dir;
+    ret->fork_per_request = opt->fork_per_request;
+    ret->cache_size       = (size_t)opt->cache_size * 1024 * 1024;
+    ret->cache            = NULL;
+    ret->mcast            = NULL;
 
-    len = sendto(s, &msg, msg_len, 0, (struct sockaddr *)sock, slen);
-    if (len < 0)
+    if (opt->mcast_addr != NULL)
     {
-        perror("tftp server: sendto()");
+        ret->mcast = tftp_mcast_create(opt->mcast_addr, opt->mcast_port,
+                                       opt->addr);
+        if (ret->mcast == NULL)
+            return -1;
+    }
+
+    if (strcmp(opt->io_engine, "epoll") && strcmp(opt->io_engine, "uring"))
+    {
+        fprintf(stderr, "tftp server: invalid I/O engine '%s'\n",
+                opt->io_engine);
         return -1;
     }
+    ret->use_uring        = !strcmp(opt->io_engine, "uring");
 
-    return 0;
-}
+    if (!strcmp(opt->fsync, "none"))
+        ret->fsync = TFTP_FSYNC_NONE;
+    else if (!strcmp(opt->fsync, "end"))
+        ret->fsync = TFTP_FSYNC_END;
+    else
+    {
+        fprintf(stderr, "tftp server: invalid fsync mode '%s'\n",
+                opt->fsync);
+        return -1;
+    }
 
-/**
- * Send tftp ACK packet to client.
- *
- * @return
- *      Zero on success, or -1, if error occured.
- *
- * @se
- *      Prints information about occurred error to stderr.
- */
-static int tftp_send_ack(int s, uint16_t block_number,
-                         struct sockaddr_in *sock, socklen_t slen)
-{
-    tftp_message    msg;
-    int             msg_len;
-    ssize_t         len;
+    /* children are not seen by the server, so are their metrics */
+    if (opt->metrics != NULL && opt->fork_per_request)
+    {
+        fprintf(stderr, "tftp server: metrics are not available "
+                        "in fork-per-request mode\n");
+        return -1;
+    }
 
-    msg.opcode              = htons(ACK);
-    msg.ack.block_number    = htons(block_number);
-    msg_len                 = sizeof(msg.ack);
+    ret->metrics          = opt->metrics;
+    ret->pacer            = NULL;
+    ret->client_rate      = opt->client_rate * 125000;      /* bytes/s */
 
-    len = sendto(s, &msg, msg_len, 0, (struct sockaddr *)sock, slen);
-    if (len < 0)
+    /* forked children take tokens from the same bucket as workers */
+    if (opt->rate > 0)
     {
-        perror("tftp server: sendto()");
-        return -1;
+        ret->pacer = mmap(NULL, sizeof(*ret->pacer), PROT_READ | PROT_WRITE,
+                          MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+        if (ret->pacer == MAP_FAILED)
+        {
+            perror("tftp server: mmap()");
+            return -1;
+        }
+        tftp_bucket_init(ret->pacer, opt->rate * 125000);
     }
 
-    return 0;
-}
+    /* the server changes to the tftp directory before it writes them */
+    if (opt->metrics != NULL && opt->metrics[0] != '/')
+    {
+        if (getcwd(cwd, sizeof(cwd)) == NULL ||
+            asprintf(&metrics, "%s/%s", cwd, opt->metrics) < 0)
+        {
+            perror("tftp server: metrics file");
+            return -1;
+        }
+        ret->metrics = metrics;
+    }
 
-/**
- * Send tftp ERROR packet to client.
- *
- * @return
- *      Zero on success, or -1, if error occured.
- *
- * @se
- *      Prints information about occurred error to stderr.
- */
-static int tftp_send_error(int s, int error_code, char *error_string,
-                           struct sockaddr_in *sock, socklen_t slen)
-{
-    tftp_message    msg;
-    int             msg_len;
-    ssize_t         len;
+    ret->providers        = NULL;
+    if (opt->archive != NULL)
+    {
+        start   = tftp_time_us();
+        archive = tftp_archive_open(opt->archive);
+        if (archive == NULL)
+            return -1;
+
+        printf("tftp server: archive '%s': %u files indexed in %.1f ms\n",
+               opt->archive, archive->n_members,
+               (tftp_time_us() - start) / 1e3);
+        ret->providers = &archive->provider;
+    }
 
-    if(strlen(error_string) >= TFTP_MAX_PAYLOAD)
+    /* templates are read at once, requests never touch them on disk */
+    for (i = opt->n_templates; i > 0; i--)
     {
-        fprintf(stderr, "tftp server: error string too long\n");
-        return -1;
+        provider = tftp_template_create(opt->templates[i - 1],
+                                        opt->template_files[i - 1]);
+        if (provider == NULL)
+            return -1;
+
+        provider->next = ret->providers;
+        ret->providers = provider;
     }
 
-    msg.opcode              = htons(ERROR);
-    msg.error.error_code    = error_code;
-    msg_len                 = 4 + strlen(error_string) + 1;
-    /* +4 for opcode, +1 for error_code */
+    ret->n_workers        = opt->workers;
+
+    if (ret->n_workers == 0)
+        ret->n_workers = sysconf(_SC_NPROCESSORS_ONLN);
+    if (ret->n_workers > TFTP_MAX_WORKERS)
+        ret->n_workers = TFTP_MAX_WORKERS;
 
-    strcpy((char *)msg.error.error_string, error_string);
+    if (opt->cpus != NULL)
+    {
+        n_cpus = tftp_parse_cpus(opt->cpus, cpus, TFTP_MAX_WORKERS);
+        if (n_cpus <= 0)
+        {
+            fprintf(stderr, "tftp server: invalid CPU list '%s'\n",
+                    opt->cpus);
+            return -1;
+        }
+    }
 
-    len = sendto(s, &msg, msg_len, 0, (struct sockaddr *)sock, slen);
-    if (len < 0)
+    ret->workers = calloc(ret->n_workers, sizeof(*ret->workers));
+    if (ret->workers == NULL)
     {
-        perror("tftp server: sendto()");
+        perror("tftp server: calloc()");
         return -1;
     }
 
-    return 0;
+    for (i = 0; i < ret->n_workers; i++)
+    {
+        ret->workers[i].id  = i;
+        ret->workers[i].cpu = n_cpus ? cpus[i % n_cpus] : -1;
+
+        if (i == 0)
+            ret->workers[i].udp_conn = ret->udp_conn;
+        else if (conn_info_fill(&ret->workers[i].udp_conn, opt->addr,
+                                atoi(opt->port), SOCK_DGRAM))
+            return -1;
+    }
+
+    return retval;
 }
 
 /**
@@ -219,7 +313,7 @@ static ssize_t tftp_recv_message(int s, tftp_message *msg,
     ssize_t len;
 
     len = recvfrom(s, msg, sizeof(*msg), 0, (struct sockaddr *)sock, slen);
-    if (len < 0 && errno != EAGAIN)
+    if (len < 0 && errno != EAGAIN && errno != EINTR)
     {
         perror("tftp server: recvfrom()");
     }
@@ -228,392 +322,175 @@ static ssize_t tftp_recv_message(int s, tftp_message *msg,
 }
 
 /**
- * Create socket to handle client request.
+ * Serve tftp client request on a new port.
+ * The function will run in a child process created by tftp_server_start()
+ * in fork-per-request mode, and runs an event loop with the only transfer.
  *
- * @return
- *      Zero on success, or -1, if error occured.
+ * @param srv_data              Server the request is sent to.
  *
  * @se
- *      Prints information about occurred error to stderr.
- *      If an error occure, causes process termination.
+ *      Prints information about start and end of the transfer.
+ *      Causes process termination.
  */
-static int tftp_socket_create(void)
+static void tftp_handle_request(tftp_message *msg, ssize_t msg_len,
+                                tftp_server_data *srv_data,
+                                struct sockaddr_in *client_sock,
+                                socklen_t slen)
 {
-    int s;
-    struct timeval tv;
-
-    s = socket(AF_INET, SOCK_DGRAM, 0);
-    if (s == -1)
-    {
-        perror("tftp server: socket()");
-        exit(EXIT_FAILURE);
-    }
+    tftp_loop   loop;
+    int         retval;
 
-    tv.tv_sec  = RECV_TIMEOUT;
-    tv.tv_usec = 0;
+    close(global_server_socket);
+    close(global_stop_fd);
+    signal(SIGTERM, SIG_DFL);
 
-    if(setsockopt(s, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv)))
-    {
-        perror("tftp server: setsockopt()");
+    if (tftp_loop_init(&loop, -1, srv_data->base_directory,
+                       srv_data->dir_fd, NULL) ||
+        tftp_loop_set_writer(&loop, srv_data->fsync))
         exit(EXIT_FAILURE);
-    }
 
-    return s;
-}
+    tftp_loop_set_pace(&loop, srv_data->pacer, srv_data->client_rate);
+    tftp_loop_set_providers(&loop, srv_data->providers);
 
-/**
- * Check if the 'filename' is valid.
- *
- * @param filename              Filename from client request.
- * @param base_directory        Server specified directory.
- *
- * @return
- *      Zero on success, or nonzero, if the filename is invalid.
- *
- * @alg
- *      Result consists of three checks:
- *      First check  - if the filename starts with "../",
- *      then it's definetly outside base directory.
- *      Second check - "/../" should not be used.
- *      Third check  - if the filename starts with "/", then
- *      the only acceptable way is the way when filename starts
- *      with fill path to the base directory.
- */
-static int filename_check(char *filename, const char *base_directory)
-{
-    int first_check;
-    int second_check;
-    int third_check;
+    retval = tftp_loop_add_request(&loop, msg, msg_len, client_sock, slen);
+    if (retval == 0)
+        retval = tftp_loop_run(&loop);
 
-    first_check  = (strncmp(filename, "../", 3) == 0);
-    second_check = (strstr(filename, "/../") != NULL);
-    third_check  = (strncmp(filename, base_directory, strlen(base_directory)) &&
-                   filename[0] == '/');
+    tftp_loop_destroy(&loop);
 
-    return first_check || second_check || third_check;
+    exit(retval ? EXIT_FAILURE : EXIT_SUCCESS);
 }
 
 /**
- * Get opcode, filename and mode from tftp request.
+ * Read requests from server socket 's' and serve each one
+ * in a child process until the server is stopped.
  *
- * @param base_directory        Server specified directory.
- * @param msg                   Request from client.
- *
- * @return
- *      Pointer to string with information about
- *      occured error, or NULL otherwise.
+ * @se
+ *      If an error occures in received message, prints
+ *      information about that in stdout and sends back ERROR packet.
  */
-static char* tftp_get_request_data(uint16_t *opcode, char **filename,
-                                   int *mode, const char *base_directory,
-                                   tftp_message *msg, ssize_t msg_len)
+static void tftp_server_fork_loop(tftp_server_data *srv_data, int s)
 {
-    char *request_last_byte;
-    char *mode_string;
-
-    /*
-     *             TFTP request packet structure:
-     *   2 bytes     string    1 byte     string   1 byte
-     *   ------------------------------------------------
-     *  | Opcode |  Filename  |   0  |    Mode    |   0  |
-     *   ------------------------------------------------
-     */
-
-    *filename           = (char *)msg->request.filename_and_mode;
-    request_last_byte   = *filename + msg_len - 2 - 1;
-
-    if (*request_last_byte != '\0')
-        return "invalid filename or mode";
+    ssize_t             msg_len;
+    struct sockaddr_in  client_sock;
+    socklen_t           slen;
+    struct pollfd       fds[2] = { { .fd = s, .events = POLLIN },
+                                   { .fd = srv_data->stop_fd,
+                                     .events = POLLIN } };
 
-    mode_string = strchr(*filename, '\0') + 1;
+    signal(SIGCHLD, (void *) chld_handler);
 
-    if (mode_string > request_last_byte)
-        return "transfer mode not specified";
+    while (1)
+    {
+        tftp_message msg;
 
-    if (filename_check(*filename, base_directory) != 0)
-        return "filename outside base directory";
+        if (poll(fds, 2, -1) < 0)
+        {
+            if (errno != EINTR)
+                perror("tftp server: poll()");
+            continue;
+        }
 
-    *opcode = ntohs(msg->opcode);
-    *mode   = !strcasecmp(mode_string, "netascii") ? NETASCII :
-             (!strcasecmp(mode_string, "octet")    ? OCTET    : 0);
+        if (fds[1].revents != 0)
+            break;
 
-    if (*mode == 0)
-        return "invalid transfer mode";
+        slen    = sizeof(client_sock);
+        msg_len = tftp_recv_message(s, &msg, &client_sock, &slen);
 
-    return NULL;
-}
+        if (msg_len < 0)
+            continue;
 
-/**
- * Send file from file descriptor 'fd' to client.
- *
- * @se
- *      If an server error occure, function will
- *      print information about it to stderr and cause process termination.
- *
- * @return
- *      Pointer to string with information about
- *      occured error, or NULL otherwise.
- */
-static char* tftp_handle_read_request(int s, FILE *fd,
-                                      struct sockaddr_in *client_sock,
-                                      socklen_t slen)
-{
-    tftp_message    msg;
-    ssize_t         msg_len;
-    uint8_t         data[TFTP_MAX_PAYLOAD];
-    ssize_t         data_len;
-    uint16_t        block_number = 0;
-    int             rc;
-    int             countdown;
-
-    do {
-        data_len = fread(data, 1, sizeof(data), fd);
-        block_number++;
-
-        for (countdown = RECV_RETRIES; countdown; countdown--)
+        if (msg_len < TFTP_MSG_MIN_SIZE)
         {
-            rc = tftp_send_data(s, block_number, data, data_len,
-                                client_sock, slen);
-            if (rc)
-            {
-                printf("%s.%u: transfer killed\n",
-                        inet_ntoa(client_sock->sin_addr),
-                        ntohs(client_sock->sin_port));
-                exit(EXIT_FAILURE);
-            }
-
-            msg_len = tftp_recv_message(s, &msg, client_sock, &slen);
-
-            if (msg_len < 0 && errno != EAGAIN)
-            {
-                printf("%s.%u: transfer killed\n",
-                        inet_ntoa(client_sock->sin_addr),
-                        ntohs(client_sock->sin_port));
-                exit(EXIT_FAILURE);
-            }
-            else if (msg_len >= 0 && msg_len < TFTP_MSG_MIN_SIZE)
-                return "message with invalid size received";
-            else
-                break;
+            printf("%s.%u: request with invalid size received\n",
+                    inet_ntoa(client_sock.sin_addr),
+                    ntohs(client_sock.sin_port));
+            tftp_send_error(s, 0, "invalid request size", &client_sock, slen);
+            continue;
         }
 
-        if (!countdown)
+        if (ntohs(msg.opcode) == RRQ || ntohs(msg.opcode) == WRQ)
         {
-            printf("%s.%u: transfer timed out\n",
-                    inet_ntoa(client_sock->sin_addr),
-                    ntohs(client_sock->sin_port));
-            exit(EXIT_FAILURE);
+            if (fork() == 0)
+                tftp_handle_request(&msg, msg_len, srv_data,
+                                    &client_sock, slen);
         }
-
-        if (ntohs(msg.opcode) == ERROR)
+        else
         {
-            printf("%s.%u: error message received: %u %s\n",
-                    inet_ntoa(client_sock->sin_addr),
-                    ntohs(client_sock->sin_port),
-                    ntohs(msg.error.error_code), msg.error.error_string);
-            exit(EXIT_FAILURE);
+            printf("%s.%u: invalid request received: %d\n",
+                    inet_ntoa(client_sock.sin_addr),
+                    ntohs(client_sock.sin_port), ntohs(msg.opcode));
+            tftp_send_error(s, 0, "invalid opcode", &client_sock, slen);
         }
-
-        if (ntohs(msg.opcode) != ACK)
-            return "invalid message during transfer received";
-
-        /* the ack number is too high */
-        if (ntohs(msg.ack.block_number) != block_number)
-            return "invalid ack number received";
-
-    } while (data_len >= TFTP_MAX_PAYLOAD);
-
-    return NULL;
+    }
 }
 
 /**
- * Receive data from client and write it to file descriptor 'fd'.
- *
- * @se
- *      If an server error occure, function will
- *      print information about it to stderr and cause process termination.
+ * Run event loop of a worker on the CPU it is pinned to.
  *
  * @return
- *      Pointer to string with information about
- *      occured error, or NULL otherwise.
+ *      NULL on successful completion, or non-NULL, if error occured.
  */
-static char* tftp_handle_write_request(int s, FILE *fd,
-                                       struct sockaddr_in *client_sock,
-                                       socklen_t slen)
+static void *tftp_worker_run(void *arg)
 {
-    tftp_message        msg;
-    ssize_t             msg_len;
-    uint16_t            block_number = 0;
-    int                 rc;
-    int                 countdown;
+    tftp_worker         *w = arg;
+    cpu_set_t           cpuset;
 
-    rc = tftp_send_ack(s, block_number, client_sock, slen);
-    if (rc)
+    if (w->cpu >= 0)
     {
-        printf("%s.%u: transfer killed\n",
-               inet_ntoa(client_sock->sin_addr),
-               ntohs(client_sock->sin_port));
-        exit(EXIT_FAILURE);
-    }
+        CPU_ZERO(&cpuset);
+        CPU_SET(w->cpu, &cpuset);
 
-    do {
-        for (countdown = RECV_RETRIES; countdown; countdown--)
-        {
-            msg_len = tftp_recv_message(s, &msg, client_sock, &slen);
-
-            if (msg_len < 0 && errno != EAGAIN)
-            {
-                printf("%s.%u: transfer killed\n",
-                        inet_ntoa(client_sock->sin_addr),
-                        ntohs(client_sock->sin_port));
-                exit(EXIT_FAILURE);
-            }
-            else if (msg_len < 0)
-            {
-                rc = tftp_send_ack(s, block_number, client_sock, slen);
-                if (rc)
-                {
-                    printf("%s.%u: transfer killed\n",
-                            inet_ntoa(client_sock->sin_addr),
-                            ntohs(client_sock->sin_port));
-                    exit(EXIT_FAILURE);
-                }
-            }
-            else if (msg_len >= 0 && msg_len < TFTP_MSG_MIN_SIZE)
-                return "message with invalid size received";
-            else
-                break;
-        }
+        if (pthread_setaffinity_np(pthread_self(), sizeof(cpuset), &cpuset))
+            fprintf(stderr, "tftp server: worker %u: could not run "
+                            "on CPU %d\n", w->id, w->cpu);
+    }
 
-        if (!countdown)
-        {
-            printf("%s.%u: transfer timed out\n",
-                    inet_ntoa(client_sock->sin_addr),
-                    ntohs(client_sock->sin_port));
-            exit(EXIT_FAILURE);
-        }
+    if (tftp_loop_init(&w->loop, get_sock(&w->udp_conn),
+                       global_server->base_directory, global_server->dir_fd,
+                       global_server->cache))
+        return w;
 
-        block_number++;
+    /* the first worker serves all multicast sessions */
+    if (global_server->mcast != NULL &&
+        tftp_loop_set_mcast(&w->loop, global_server->mcast, w->id == 0))
+        return w;
 
-        if (ntohs(msg.opcode) == ERROR)  {
-            printf("%s.%u: error message received: %u %s\n",
-                    inet_ntoa(client_sock->sin_addr),
-                    ntohs(client_sock->sin_port),
-                    ntohs(msg.error.error_code), msg.error.error_string);
-            exit(EXIT_FAILURE);
-        }
+    if (tftp_loop_set_stop(&w->loop, global_server->stop_fd))
+        return w;
 
-        if (ntohs(msg.opcode) != DATA)
-            return "invalid message during transfer received";
+    /* loops stay on epoll if the kernel is too old for the ring */
+    if (global_server->use_uring && tftp_loop_set_uring(&w->loop))
+        fprintf(stderr, "tftp server: worker %u: io_uring is not "
+                        "available: %s, using epoll\n", w->id,
+                        strerror(errno));
 
-        if (ntohs(msg.ack.block_number) != block_number)
-            return "invalid block number received";
+    if (tftp_loop_set_writer(&w->loop, global_server->fsync))
+        return w;
 
-        rc = fwrite(msg.data.data, 1, msg_len - 4, fd);     /* +4 for opcode */
-        if (rc < 0)
-        {
-            perror("tftp server: fwrite()");
-            exit(EXIT_FAILURE);
-        }
+    tftp_loop_set_pace(&w->loop, global_server->pacer,
+                       global_server->client_rate);
+    tftp_loop_set_providers(&w->loop, global_server->providers);
 
-        rc = tftp_send_ack(s, block_number, client_sock, slen);
-        if (rc)
-        {
-            printf("%s.%u: transfer killed\n",
-                    inet_ntoa(client_sock->sin_addr),
-                    ntohs(client_sock->sin_port));
-            exit(EXIT_FAILURE);
-        }
+    w->loop.worker = w->id;
+    w->running     = 1;
 
-    } while ((size_t)msg_len >= sizeof(msg.data));
-    /* since msg_len is non-negative, we can safely cast it to size_t */
+    if (tftp_loop_run(&w->loop))
+        return w;
 
     return NULL;
 }
 
-/**
- * Opens new socket on new port to handle tftp client request.
- * The function will run in a child process created by tftp_server_start().
- *
- * @param base_directory        Server specified directory.
- *
- * @se
- *      Prints information about start and end of the transfer.
- *      If an error occure, function will:
- *      Print information about it to stderr,
- *      send string to client containing error description,
- *      cause process termination.
- */
-void tftp_handle_request(tftp_message *msg, ssize_t msg_len,
-                         const char *base_directory,
-                         struct sockaddr_in *client_sock,
-                         socklen_t slen)
-{
-    int         s;
-    int         mode;
-    char        *filename;
-    char        *error_string;
-    uint16_t    opcode;
-    FILE        *fd;
-
-    s = tftp_socket_create();
-
-    error_string = tftp_get_request_data(&opcode, &filename, &mode,
-                                         base_directory, msg, msg_len);
-    if (error_string != NULL)
-    {
-        printf("%s.%u: %s\n",
-                inet_ntoa(client_sock->sin_addr),
-                ntohs(client_sock->sin_port),
-                error_string);
-        tftp_send_error(s, 0, error_string, client_sock, slen);
-        close(s);
-        exit(EXIT_FAILURE);
-    }
-
-    fd = fopen(filename, opcode == RRQ ? "r" : "w");
-    if (fd == NULL)
-    {
-        perror("tftp server: fopen()");
-        tftp_send_error(s, errno, strerror(errno), client_sock, slen);
-        close(s);
-        exit(EXIT_FAILURE);
-    }
-
-    printf("%s.%u: request received: %s '%s' %s\n",
-            inet_ntoa(client_sock->sin_addr), ntohs(client_sock->sin_port),
-            opcode == RRQ   ? "get"   : "put", filename,
-            mode   == OCTET ? "oktet" : "netascii");
-
-    if (opcode == RRQ)
-        error_string = tftp_handle_read_request(s, fd, client_sock, slen);
-    else if (opcode == WRQ)
-        error_string = tftp_handle_write_request(s, fd, client_sock, slen);
-
-    if (error_string != NULL)
-    {
-        printf("%s.%u: %s\n",
-               inet_ntoa(client_sock->sin_addr),
-               ntohs(client_sock->sin_port),
-               error_string);
-        tftp_send_error(s, 0, error_string, client_sock, slen);
-        fclose(fd);
-        close(s);
-        exit(EXIT_FAILURE);
-    }
-
-    printf("%s.%u: '%s' transfer completed\n",
-            inet_ntoa(client_sock->sin_addr),
-            ntohs(client_sock->sin_port),
-            filename);
-
-    fclose(fd);
-    close(s);
-}
-
 /**
  * Start tftp server on ip, port and directory specified in
  * 'srv_data' structure.
- * Server stops by sending signal SIGTERM to it.
+ * All transfers are multiplexed by event loops of worker threads,
+ * the calling thread runs the first worker. Each worker has its own
+ * socket on the server port, and the kernel spreads requests across
+ * them by SO_REUSEPORT. In fork-per-request mode the first worker
+ * socket is used to accept requests.
+ * Server stops by sending signal SIGTERM to it: the function returns
+ * once the workers are stopped, reported and their metrics written.
  *
  * @se
  *      Prints information about occurred error to stderr.
@@ -624,64 +501,132 @@ int tftp_server_start(tftp_server_data *srv_data)
 {
     int                 s;
     int                 retval;
-    ssize_t             msg_len;
-    struct sockaddr_in  client_sock;
-    socklen_t           slen;
+    int                 reuse = 1;
+    unsigned int        i;
+    tftp_worker         *w;
+    pthread_t           metrics_thread;
+    sigset_t            sigterm;
 
     s      = get_sock(&srv_data->udp_conn);
-    slen   = sizeof(client_sock);
 
-    retval = chdir(srv_data->base_directory);
-    if (retval)
+    /* requested files are resolved beneath the directory opened once */
+    srv_data->dir_fd = open(srv_data->base_directory,
+                            O_PATH | O_DIRECTORY | O_CLOEXEC);
+    if (srv_data->dir_fd == -1)
     {
-        perror("tftp server: chdir()");
-        return retval;
+        perror("tftp server: open()");
+        return -1;
     }
 
-    retval = socket_bind(&srv_data->udp_conn);
+    retval = fchdir(srv_data->dir_fd);
     if (retval)
+    {
+        perror("tftp server: fchdir()");
         return retval;
+    }
+
+    if (srv_data->fork_per_request)
+        srv_data->n_workers = 1;
+
+    for (i = 0; i < srv_data->n_workers; i++)
+    {
+        w = &srv_data->workers[i];
+
+        if (srv_data->n_workers > 1 &&
+            setsockopt(get_sock(&w->udp_conn), SOL_SOCKET, SO_REUSEPORT,
+                       &reuse, sizeof(reuse)))
+        {
+            perror("tftp server: setsockopt()");
+            return -1;
+        }
+
+        retval = socket_bind(&w->udp_conn);
+        if (retval)
+            return retval;
+    }
 
     global_server_socket = s;
 
-    signal(SIGCHLD, (void *) chld_handler);
+    srv_data->stop_fd = eventfd(0, EFD_CLOEXEC);
+    if (srv_data->stop_fd == -1)
+    {
+        perror("tftp server: eventfd()");
+        return -1;
+    }
+    global_stop_fd = srv_data->stop_fd;
+
     signal(SIGTERM, (void *) term_handler);
 
     printf("tftp server: listening on %d\n", get_port(&srv_data->udp_conn));
 
-    while (1)
+    if (srv_data->fork_per_request)
     {
-        tftp_message msg;
+        tftp_server_fork_loop(srv_data, s);
+        printf("tftp server: shutting down\n");
+        close(s);
+        return 0;
+    }
 
-        msg_len = tftp_recv_message(s, &msg, &client_sock, &slen);
+    /* SIGTERM is handled by the thread running the first worker */
+    sigemptyset(&sigterm);
+    sigaddset(&sigterm, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &sigterm, NULL);
 
-        if (msg_len < 0)
-            continue;
+    /* a single copy of a file is shared by transfers of all workers */
+    if (srv_data->cache_size > 0)
+    {
+        srv_data->cache = tftp_cache_create(srv_data->cache_size, ".");
+        if (srv_data->cache == NULL)
+            return -1;
+    }
 
-        if (msg_len < TFTP_MSG_MIN_SIZE)
+    global_server = srv_data;
+
+    for (i = 1; i < srv_data->n_workers; i++)
+    {
+        w = &srv_data->workers[i];
+
+        retval = pthread_create(&w->thread, NULL, tftp_worker_run, w);
+        if (retval)
         {
-            printf("%s.%u: request with invalid size received\n",
-                    inet_ntoa(client_sock.sin_addr),
-                    ntohs(client_sock.sin_port));
-            tftp_send_error(s, 0, "invalid request size", &client_sock, slen);
-            continue;
+            fprintf(stderr, "tftp server: pthread_create(): %s\n",
+                    strerror(retval));
+            return -1;
         }
+    }
 
-        if (ntohs(msg.opcode) == RRQ || ntohs(msg.opcode) == WRQ)
+    if (srv_data->metrics != NULL)
+    {
+        retval = pthread_create(&metrics_thread, NULL, tftp_metrics_run,
+                                srv_data);
+        if (retval)
         {
-            if (fork() == 0)
-            {
-                tftp_handle_request(&msg, msg_len, srv_data->base_directory,
-                                    &client_sock, slen);
-                exit(EXIT_SUCCESS);
-            }
-        }
-        else
-        {
-            printf("%s.%u: invalid request received: %d\n",
-                    inet_ntoa(client_sock.sin_addr),
-                    ntohs(client_sock.sin_port), ntohs(msg.opcode));
-            tftp_send_error(s, 0, "invalid opcode", &client_sock, slen);
+            fprintf(stderr, "tftp server: pthread_create(): %s\n",
+                    strerror(retval));
+            return -1;
         }
     }
+
+    pthread_sigmask(SIG_UNBLOCK, &sigterm, NULL);
+
+    if (tftp_worker_run(&srv_data->workers[0]))
+        return -1;
+
+    for (i = 1; i < srv_data->n_workers; i++)
+        pthread_join(srv_data->workers[i].thread, NULL);
+    if (srv_data->metrics != NULL)
+        pthread_join(metrics_thread, NULL);
+
+    for (i = 0; i < srv_data->n_workers; i++)
+        if (srv_data->workers[i].running)
+            tftp_loop_report(&srv_data->workers[i].loop);
+
+    if (srv_data->metrics != NULL)
+        tftp_server_metrics(srv_data);
+
+    printf("tftp server: shutting down\n");
+
+    close(s);
+
+    return 0;
 }
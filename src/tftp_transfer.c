@@ -0,0 +1,1615 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#include "include/tftp_transfer.h"
+#include "include/tftp_netascii.h"
+
+#define RECV_TIMEOUT            5
+#define RECV_RETRIES            5
+
+/* IPv4, UDP and TFTP DATA headers subtracted from the path MTU. */
+#define TFTP_DATA_OVERHEAD      (20 + 8 + 4)
+
+/* Retransmission timeout bounds in microseconds (RFC 6298 estimator). */
+#define TFTP_RTO_MIN            200L
+#define TFTP_RTO_INITIAL        1000000L
+#define TFTP_RTO_MAX            (RECV_TIMEOUT * 1000000L)
+
+/* Timeouts allowed by RFC 2349, in seconds. */
+#define TFTP_MIN_TIMEOUT        1
+#define TFTP_MAX_TIMEOUT        255
+
+/** Queue tftp ACK packet to client in the send queue of 'loop'. */
+static void tftp_send_ack(tftp_loop *loop, uint16_t block_number,
+                          struct sockaddr_in *sock, socklen_t slen)
+{
+    tftp_message    *msg = tftp_loop_packet(loop, sizeof(msg->ack));
+
+    msg->opcode              = htons(ACK);
+    msg->ack.block_number    = htons(block_number);
+
+    tftp_loop_queue(loop, sizeof(msg->ack), sock, slen);
+}
+
+/** Get TFTP error code of the failure of a file operation with 'err'. */
+static int tftp_errno_code(int err)
+{
+    switch (err)
+    {
+        case ENOENT:
+            return TFTP_ERR_NOT_FOUND;
+        case EACCES:
+        case EPERM:
+            return TFTP_ERR_ACCESS;
+        case ENOSPC:
+        case EDQUOT:
+            return TFTP_ERR_DISK_FULL;
+        case EEXIST:
+            return TFTP_ERR_EXISTS;
+        default:
+            return TFTP_ERR_UNDEFINED;
+    }
+}
+
+/**
+ * Send tftp ERROR packet to client.
+ *
+ * @return
+ *      Zero on success, or -1, if error occured.
+ *
+ * @se
+ *      Prints information about occurred error to stderr.
+ */
+int tftp_send_error(int s, int error_code, char *error_string,
+                           struct sockaddr_in *sock, socklen_t slen)
+{
+    tftp_message    msg;
+    int             msg_len;
+    ssize_t         len;
+
+    if(strlen(error_string) >= TFTP_MAX_PAYLOAD)
+    {
+        fprintf(stderr, "tftp server: error string too long\n");
+        return -1;
+    }
+
+    msg.opcode              = htons(ERROR);
+    msg.error.error_code    = htons(error_code);
+    msg_len                 = 4 + strlen(error_string) + 1;
+    /* +4 for opcode, +1 for error_code */
+
+    strcpy((char *)msg.error.error_string, error_string);
+
+    len = sendto(s, &msg, msg_len, 0, (struct sockaddr *)sock, slen);
+    if (len < 0 && errno != EAGAIN)
+    {
+        perror("tftp server: sendto()");
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * Append option 'name' with numeric 'value' to OACK options list 'buf'.
+ *
+ * @return
+ *      New length of the options list.
+ */
+static int tftp_oack_append(uint8_t *buf, int len, const char *name,
+                            unsigned long value)
+{
+    len += sprintf((char *)buf + len, "%s", name) + 1;     /* +1 for '\0' */
+    len += sprintf((char *)buf + len, "%lu", value) + 1;
+
+    return len;
+}
+
+/**
+ * Append multicast option of transfer 't' to OACK options list 'buf':
+ * group address, port and whether the client is the master (RFC 2090).
+ *
+ * @return
+ *      New length of the options list.
+ */
+static int tftp_oack_append_mcast(uint8_t *buf, int len, tftp_transfer *t)
+{
+    len += sprintf((char *)buf + len, "multicast") + 1;    /* +1 for '\0' */
+    len += sprintf((char *)buf + len, "%s,%u,%d",
+                   inet_ntoa(t->session->group.sin_addr),
+                   ntohs(t->session->group.sin_port),
+                   t->session->master == t) + 1;
+
+    return len;
+}
+
+/**
+ * Queue tftp OACK packet with options accepted for transfer 't'
+ * to its client in the send queue of the transfer loop.
+ */
+static void tftp_send_oack(tftp_transfer *t)
+{
+    tftp_options    *opts = &t->opts;
+    tftp_message    *msg  = tftp_loop_packet(t->loop, sizeof(*msg));
+    int             opts_len = 0;
+
+    /*
+     *             TFTP OACK packet structure:
+     *   2 bytes   string    1 byte   string   1 byte
+     *   ---------------------------------------------
+     *  | Opcode |  opt1   |   0  |  value1  |   0  | ...
+     *   ---------------------------------------------
+     */
+
+    msg->opcode = htons(OACK);
+
+    if (opts->accepted & TFTP_OPT_BLKSIZE)
+        opts_len = tftp_oack_append(msg->oack.options, opts_len,
+                                    "blksize", opts->blksize);
+    if (opts->accepted & TFTP_OPT_WINDOWSIZE)
+        opts_len = tftp_oack_append(msg->oack.options, opts_len,
+                                    "windowsize", opts->windowsize);
+    if (opts->accepted & TFTP_OPT_TIMEOUT)
+        opts_len = tftp_oack_append(msg->oack.options, opts_len,
+                                    "timeout", opts->timeout);
+    if (opts->accepted & TFTP_OPT_TSIZE)
+        opts_len = tftp_oack_append(msg->oack.options, opts_len,
+                                    "tsize", opts->tsize);
+    if (opts->accepted & TFTP_OPT_MULTICAST)
+        opts_len = tftp_oack_append_mcast(msg->oack.options, opts_len, t);
+
+    tftp_loop_queue(t->loop, 2 + opts_len,                 /* +2 for opcode */
+                    &t->client_sock, t->slen);
+}
+
+/**
+ * Initialize retransmission timer of a transfer.
+ * Negotiated timeout option bounds the backoff instead of RECV_TIMEOUT.
+ */
+static void tftp_rto_init(tftp_rto *rto, tftp_options *opts)
+{
+    rto->srtt   = 0;
+    rto->rttvar = 0;
+    rto->max    = opts->timeout ? opts->timeout * 1000000L : TFTP_RTO_MAX;
+    rto->rto    = TFTP_RTO_INITIAL < rto->max ? TFTP_RTO_INITIAL : rto->max;
+}
+
+/**
+ * Update retransmission timer with round-trip time sample 'rtt'.
+ * Samples must not be taken from retransmitted packets (Karn's algorithm).
+ */
+static void tftp_rto_sample(tftp_rto *rto, long rtt)
+{
+    long delta;
+
+    if (rto->srtt == 0)
+    {
+        rto->srtt   = rtt > 0 ? rtt : 1;
+        rto->rttvar = rtt / 2;
+    }
+    else
+    {
+        delta        = rto->srtt > rtt ? rto->srtt - rtt : rtt - rto->srtt;
+        rto->rttvar += (delta - rto->rttvar) / 4;
+        rto->srtt   += (rtt - rto->srtt) / 8;
+    }
+
+    rto->rto = rto->srtt + 4 * rto->rttvar;
+    if (rto->rto < TFTP_RTO_MIN)
+        rto->rto = TFTP_RTO_MIN;
+    if (rto->rto > rto->max)
+        rto->rto = rto->max;
+}
+
+/**
+ * Double retransmission timeout after it expired.
+ *
+ * @return
+ *      Nonzero if the timeout has already reached its upper bound,
+ *      so the expiration counts as a retry.
+ */
+static int tftp_rto_backoff(tftp_rto *rto)
+{
+    if (rto->rto >= rto->max)
+        return 1;
+
+    rto->rto = rto->rto * 2 < rto->max ? rto->rto * 2 : rto->max;
+
+    return 0;
+}
+
+/**
+ * Check if the 'filename' is valid.
+ *
+ * @param filename              Filename from client request.
+ * @param base_directory        Server specified directory.
+ *
+ * @return
+ *      Zero on success, or nonzero, if the filename is invalid.
+ *
+ * @alg
+ *      Result consists of three checks:
+ *      First check  - if the filename starts with "../",
+ *      then it's definetly outside base directory.
+ *      Second check - "/../" should not be used.
+ *      Third check  - if the filename starts with "/", then
+ *      the only acceptable way is the way when filename starts
+ *      with fill path to the base directory.
+ */
+static int filename_check(char *filename, const char *base_directory)
+{
+    int first_check;
+    int second_check;
+    int third_check;
+
+    first_check  = (strncmp(filename, "../", 3) == 0);
+    second_check = (strstr(filename, "/../") != NULL);
+    third_check  = (strncmp(filename, base_directory, strlen(base_directory)) &&
+                   filename[0] == '/');
+
+    return first_check || second_check || third_check;
+}
+
+/**
+ * Get path of requested 'filename' relative to 'base_directory'.
+ * Absolute names start with the base directory, as filename_check()
+ * makes sure.
+ *
+ * @return
+ *      Relative path, or NULL, if 'filename' only starts with the
+ *      same characters, like "/srv/tftp2/a" with "/srv/tftp".
+ */
+static const char *tftp_relative_path(const char *filename,
+                                      const char *base_directory)
+{
+    size_t len = strlen(base_directory);
+
+    if (filename[0] != '/')
+        return filename;
+
+    if (filename[len] != '/' && filename[len] != '\0' &&
+        (len == 0 || base_directory[len - 1] != '/'))
+        return NULL;
+
+    for (filename += len; *filename == '/'; filename++)
+        ;
+
+    return *filename != '\0' ? filename : ".";
+}
+
+/**
+ * Get MTU of the path to client.
+ *
+ * @return
+ *      Path MTU, or -1, if it could not be determined.
+ */
+static int tftp_path_mtu(struct sockaddr_in *client_sock, socklen_t slen)
+{
+    int         s;
+    int         mtu;
+    socklen_t   mtu_len = sizeof(mtu);
+
+    s = socket(AF_INET, SOCK_DGRAM, 0);
+    if (s == -1)
+        return -1;
+
+    if (connect(s, (struct sockaddr *)client_sock, slen) ||
+        getsockopt(s, IPPROTO_IP, IP_MTU, &mtu, &mtu_len))
+        mtu = -1;
+
+    close(s);
+
+    return mtu;
+}
+
+/**
+ * Parse option 'name' with value 'value' from tftp request into 'opts'.
+ * Unknown options and options with invalid values are ignored,
+ * so the client falls back to the default behaviour for them.
+ */
+static void tftp_option_parse(tftp_options *opts, const char *name,
+                              const char *value)
+{
+    char            *end;
+    unsigned long   num;
+
+    /* group is assigned by the server, so the client sends no value */
+    if (!strcasecmp(name, "multicast") && *value == '\0')
+    {
+        opts->accepted |= TFTP_OPT_MULTICAST;
+        return;
+    }
+
+    num = strtoul(value, &end, 10);
+    if (*value == '\0' || *end != '\0')
+        return;
+
+    if (!strcasecmp(name, "blksize") && num >= TFTP_MIN_BLKSIZE)
+    {
+        opts->blksize   = num > TFTP_MAX_BLKSIZE ? TFTP_MAX_BLKSIZE : num;
+        opts->accepted |= TFTP_OPT_BLKSIZE;
+    }
+    else if (!strcasecmp(name, "windowsize") && num >= 1)
+    {
+        opts->windowsize = num > TFTP_MAX_WINDOWSIZE ?
+                           TFTP_MAX_WINDOWSIZE : num;
+        opts->accepted  |= TFTP_OPT_WINDOWSIZE;
+    }
+    else if (!strcasecmp(name, "timeout") &&
+             num >= TFTP_MIN_TIMEOUT && num <= TFTP_MAX_TIMEOUT)
+    {
+        opts->timeout   = num;
+        opts->accepted |= TFTP_OPT_TIMEOUT;
+    }
+    else if (!strcasecmp(name, "tsize"))
+    {
+        /* file size is filled in for read requests once it is opened */
+        opts->tsize     = num;
+        opts->accepted |= TFTP_OPT_TSIZE;
+    }
+}
+
+/**
+ * Get opcode, filename, mode and options from tftp request.
+ *
+ * @param base_directory        Server specified directory.
+ * @param msg                   Request from client.
+ *
+ * @return
+ *      Pointer to string with information about
+ *      occured error, or NULL otherwise.
+ */
+static char* tftp_get_request_data(uint16_t *opcode, char **filename,
+                                   int *mode, tftp_options *opts,
+                                   const char *base_directory,
+                                   tftp_message *msg, ssize_t msg_len)
+{
+    char *request_last_byte;
+    char *mode_string;
+    char *option;
+    char *value;
+
+    /*
+     *             TFTP request packet structure:
+     *   2 bytes     string    1 byte     string   1 byte
+     *   ------------------------------------------------
+     *  | Opcode |  Filename  |   0  |    Mode    |   0  |
+     *   ------------------------------------------------
+     *
+     * Mode may be followed by options as defined in RFC 2347:
+     *     string   1 byte   string   1 byte
+     *   ------------------------------------
+     *  |  opt1   |   0  |  value1  |   0  | ...
+     *   ------------------------------------
+     */
+
+    *filename           = (char *)msg->request.filename_and_mode;
+    request_last_byte   = *filename + msg_len - 2 - 1;
+
+    if (*request_last_byte != '\0')
+        return "invalid filename or mode";
+
+    mode_string = strchr(*filename, '\0') + 1;
+
+    if (mode_string > request_last_byte)
+        return "transfer mode not specified";
+
+    if (filename_check(*filename, base_directory) != 0)
+        return "filename outside base directory";
+
+    *opcode = ntohs(msg->opcode);
+    *mode   = !strcasecmp(mode_string, "netascii") ? NETASCII :
+             (!strcasecmp(mode_string, "octet")    ? OCTET    : 0);
+
+    if (*mode == 0)
+        return "invalid transfer mode";
+
+    opts->accepted = 0;
+    opts->blksize    = TFTP_MAX_PAYLOAD;
+    opts->windowsize = 1;
+    opts->timeout    = 0;
+    opts->tsize      = 0;
+
+    for (option = strchr(mode_string, '\0') + 1;
+         option <= request_last_byte;
+         option = strchr(value, '\0') + 1)
+    {
+        value = strchr(option, '\0') + 1;
+
+        if (value > request_last_byte)
+            return "option value not specified";
+
+        tftp_option_parse(opts, option, value);
+    }
+
+    return NULL;
+}
+
+/**
+ * Translate block 'i' of the window of netascii read request 't' into
+ * 'dst', going on from where block 'i' - 1 ended, and keep where block
+ * 'i' + 1 starts.
+ *
+ * @return
+ *      Length of the block, or -1, if error occured.
+ */
+static ssize_t tftp_text_block(tftp_transfer *t, uint16_t i, uint8_t *dst)
+{
+    uint16_t        blksize = t->opts.blksize;
+    tftp_text_pos   *pos    = &t->text_pos[i - 1];
+    const uint8_t   *src;
+    ssize_t         len;
+    size_t          used;
+
+    /* a block never takes more of the file than its own size */
+    if (t->map != NULL)
+    {
+        src = t->map + pos->offset;
+        len = t->file_size - pos->offset < blksize ?
+              t->file_size - pos->offset : blksize;
+    }
+    else
+    {
+        if (t->text_buf == NULL &&
+            (t->text_buf = malloc(blksize)) == NULL)
+            return -1;
+
+        src = t->text_buf;
+        len = pread(fileno(t->fd), t->text_buf, blksize, pos->offset);
+        if (len < 0)
+            return -1;
+    }
+
+    pos[1].carry  = pos->carry;
+    len           = tftp_netascii_encode(src, len, dst, blksize,
+                                         &pos[1].carry, &used);
+    pos[1].offset = pos->offset + used;
+
+    return len;
+}
+
+/**
+ * Queue window of up to windowsize DATA packets following the last
+ * acknowledged block of a read request to client, so the whole window
+ * leaves with a single sendmmsg() call. Packets of a mapped file point
+ * right into the mapping, and packets of blocks read ahead by io_uring
+ * point into the read-ahead buffer, otherwise blocks are read into
+ * the send queue. Netascii text is translated into the send queue
+ * block by block.
+ *
+ * @return
+ *      Zero on success, or -1, if error occured.
+ *
+ * @se
+ *      Prints information about occurred error to stderr.
+ */
+static int tftp_send_window(tftp_transfer *t)
+{
+    tftp_loop           *loop    = t->loop;
+    uint16_t            blksize  = t->opts.blksize;
+    struct sockaddr_in  *dest    = &t->client_sock;
+    socklen_t           slen     = t->slen;
+    tftp_message        *msg;
+    const uint8_t       *data;
+    ssize_t             data_len;
+    off_t               offset;
+    uint16_t            i;
+
+    /* DATA of a multicast session goes to all clients at once */
+    if (t->session != NULL)
+    {
+        dest = &t->session->group;
+        slen = sizeof(t->session->group);
+    }
+
+    t->last_sent = 0;
+
+    /* text of a window goes on from the last acknowledged block */
+    if (t->text)
+    {
+        if (t->text_pos == NULL)
+        {
+            t->text_pos = malloc(((size_t)t->opts.windowsize + 1) *
+                                 sizeof(*t->text_pos));
+            if (t->text_pos == NULL)
+            {
+                perror("tftp server: malloc()");
+                return -1;
+            }
+
+            t->text_pos[0].offset = 0;
+            t->text_pos[0].carry  = -1;
+            t->text_base          = t->block_number;
+        }
+
+        t->text_pos[0] = t->text_pos[t->block_number - t->text_base];
+        t->text_base   = t->block_number;
+    }
+
+    for (i = 1; i <= t->opts.windowsize && !t->last_sent; i++)
+    {
+        /* a window starts at the last acknowledged block after a loss */
+        offset = ((off_t)t->block_number + i - 1) * blksize;
+
+        if (t->text)
+        {
+            msg      = tftp_loop_packet(loop, 4 + blksize);
+            data     = NULL;
+            data_len = tftp_text_block(t, i, msg->data.data);
+            if (data_len < 0)
+            {
+                perror("tftp server: read()");
+                return -1;
+            }
+        }
+        else if (t->map != NULL)
+        {
+            data_len = offset >= t->file_size ? 0 :
+                       (t->file_size - offset < blksize ?
+                        t->file_size - offset : blksize);
+            data     = t->map + offset;
+
+            msg = tftp_loop_packet(loop, 4);
+        }
+        else if ((data = tftp_uring_block(t, t->block_number + i,
+                                          &data_len)) != NULL)
+        {
+            msg = tftp_loop_packet(loop, 4);
+        }
+        else
+        {
+            msg      = tftp_loop_packet(loop, 4 + blksize);
+            data_len = pread(fileno(t->fd), msg->data.data, blksize, offset);
+            if (data_len < 0)
+            {
+                perror("tftp server: pread()");
+                return -1;
+            }
+        }
+
+        msg->opcode            = htons(DATA);
+        msg->data.block_number = htons((uint16_t)(t->block_number + i));
+
+        t->blocks++;
+        if (t->block_number + i > t->highest_sent)
+        {
+            t->highest_sent  = t->block_number + i;
+            t->bytes        += data_len;
+        }
+        else
+        {
+            t->retransmits++;
+        }
+
+        if (data != NULL)
+            tftp_loop_queue_data(loop, 4, data, data_len, dest, slen);
+        else
+            tftp_loop_queue(loop, 4 + data_len,            /* +4 for opcode */
+                            dest, slen);
+
+        t->last_sent = data_len < blksize;
+    }
+
+    t->window_len = i - 1;
+
+    if (!t->last_sent)
+        tftp_uring_read_ahead(t, t->block_number + i);
+
+    return 0;
+}
+
+/**
+ * Acknowledge 'block_number' of write request 't', or send OACK instead
+ * of ACK for block 0 if options were negotiated.
+ */
+static void tftp_send_write_ack(tftp_transfer *t, uint16_t block_number)
+{
+    if (block_number == 0 && t->opts.accepted)
+        tftp_send_oack(t);
+    else
+        tftp_send_ack(t->loop, block_number, &t->client_sock, t->slen);
+}
+
+/**
+ * Stop transfer after a server error. Client gets no ERROR packet,
+ * as the server could not talk to it or serve it anymore.
+ *
+ * @se
+ *      Prints information about the transfer end.
+ */
+static void tftp_transfer_kill(tftp_transfer *t)
+{
+    printf("%s.%u: transfer killed\n",
+            inet_ntoa(t->client_sock.sin_addr),
+            ntohs(t->client_sock.sin_port));
+
+    t->state = TFTP_TRANSFER_FAILED;
+}
+
+/**
+ * Take round-trip time sample of transfer 't' from its last measured
+ * transmission, and add it to the metrics of the loop.
+ */
+static void tftp_rtt_sample(tftp_transfer *t)
+{
+    long rtt = tftp_time_us() - t->sent_at;
+
+    tftp_rto_sample(&t->rto, rtt);
+    tftp_histogram_add(&t->loop->metrics.rtt, rtt);
+
+    t->rtt_samples++;
+    t->rtt_sum += rtt;
+}
+
+/** Get size of the window following the last acknowledged block. */
+static size_t tftp_window_bytes(tftp_transfer *t)
+{
+    off_t offset = (off_t)t->block_number * t->opts.blksize;
+    off_t len    = (off_t)t->opts.windowsize * t->opts.blksize;
+
+    if (t->file_size >= 0 && t->file_size - offset < len)
+        len = t->file_size > offset ? t->file_size - offset : 0;
+
+    return len;
+}
+
+/**
+ * Send OACK or the window following the last acknowledged block
+ * of a read request and restart retransmission timer. Window that
+ * is over the rate of the client or of the server waits on the timer.
+ *
+ * @return
+ *      Zero on success, or -1, if error occured.
+ */
+static int tftp_read_send(tftp_transfer *t)
+{
+    int     rc = 0;
+    long    wait;
+
+    if (!t->negotiating)
+    {
+        wait = tftp_pace(t, tftp_window_bytes(t));
+        if (wait > 0)
+        {
+            t->paced = 1;
+            t->loop->stats.paced++;
+            t->loop->metrics.paced++;
+            tftp_timer_arm(t->loop, &t->timer, wait);
+            return 0;
+        }
+    }
+
+    t->paced = 0;
+    t->sends++;
+
+    if (t->negotiating)
+    {
+        tftp_send_oack(t);
+        tftp_uring_read_ahead(t, t->block_number + 1);
+    }
+    else
+    {
+        rc = tftp_send_window(t);
+    }
+
+    tftp_timer_arm(t->loop, &t->timer, t->rto.rto);
+
+    return rc;
+}
+
+/**
+ * Handle ACK of read request 't' that acknowledges no new blocks.
+ * Client repeats the ACK of the last block it received in order when
+ * the window following it is lost, so the window is resent right away
+ * instead of on the timeout, but only once. Resending it on each
+ * duplicate would double every later window along with the ACKs
+ * (Sorcerer's Apprentice Syndrome), so duplicates caused by
+ * retransmissions of the previous window are ignored.
+ */
+static void tftp_read_duplicate(tftp_transfer *t)
+{
+    t->loop->stats.dup_acks++;
+    t->loop->metrics.dup_acks++;
+
+    if (t->stale_acks > 0)
+    {
+        t->stale_acks--;
+        return;
+    }
+
+    if (t->rewound)
+        return;
+
+    t->rewound       = 1;
+    t->retransmitted = 1;
+    t->loop->stats.fast_resends++;
+
+    if (tftp_read_send(t))
+        tftp_transfer_kill(t);
+}
+
+/**
+ * Handle message from client reading a file.
+ *
+ * @return
+ *      Pointer to string with information about
+ *      occured error, or NULL otherwise.
+ */
+static char* tftp_read_input(tftp_transfer *t, tftp_message *msg)
+{
+    uint16_t    ack_number;
+    uint16_t    last_block;
+    int         completed;
+
+    if (ntohs(msg->opcode) != ACK)
+        return "invalid message during transfer received";
+
+    /* only the master client of a multicast session acknowledges */
+    if (t->session != NULL && t->session->master != t)
+        return NULL;
+
+    /*
+     * Client acknowledges the last block it received in order,
+     * so the next window starts right after it (RFC 7440).
+     */
+    ack_number = ntohs(msg->ack.block_number);
+
+    if (ack_number == (uint16_t)t->block_number && !t->negotiating)
+    {
+        tftp_read_duplicate(t);
+        return NULL;
+    }
+
+    if (t->session != NULL)
+    {
+        /*
+         * Master client may have got blocks beyond the window from
+         * the group while it was not the master (RFC 2090).
+         */
+        last_block = t->file_size / t->opts.blksize + 1;
+        if (ack_number > last_block)
+            return "invalid ack number received";
+
+        completed = ack_number == last_block;
+    }
+    else
+    {
+        if ((uint16_t)(ack_number - t->block_number) > t->window_len)
+        {
+            /* delayed ACK of an earlier window */
+            if ((uint16_t)(t->block_number - ack_number) < 0x8000)
+            {
+                t->loop->stats.dup_acks++;
+                t->loop->metrics.dup_acks++;
+                return NULL;
+            }
+
+            return "invalid ack number received";
+        }
+
+        /* the whole window including the last block is acknowledged */
+        completed = t->last_sent &&
+                    (uint16_t)(ack_number - t->block_number) == t->window_len;
+    }
+
+    if (!t->retransmitted)
+        tftp_rtt_sample(t);
+
+    if (completed)
+    {
+        t->state = TFTP_TRANSFER_COMPLETED;
+        return NULL;
+    }
+
+    /* blocks of a session never roll over, unicast ones do after 65535 */
+    if (t->session != NULL)
+        t->block_number = ack_number;
+    else
+        t->block_number += (uint16_t)(ack_number - t->block_number);
+    t->negotiating   = 0;
+    t->rewound       = 0;
+    t->retransmitted = 0;
+    t->stale_acks    = t->sends - 1;
+    t->sends         = 0;
+    t->countdown     = RECV_RETRIES;
+    t->sent_at       = tftp_time_us();
+
+    if (tftp_read_send(t))
+        tftp_transfer_kill(t);
+
+    return NULL;
+}
+
+/**
+ * Write block of 'len' bytes of 'data' to the file of write request 't'.
+ * Loop using io_uring submits the write, and loop with a writer thread
+ * buffers the block, so it is acknowledged before it is written.
+ *
+ * @return
+ *      Zero on success, or -1, if error occured.
+ */
+static int tftp_write_block(tftp_transfer *t, const uint8_t *data,
+                            size_t len)
+{
+    if (t->loop->uring != NULL)
+    {
+        /*
+         * Zero block is left as a hole, file gets its size at the end.
+         * Holes are not punched out of preallocated files.
+         */
+        if (len > 0 && !t->preallocated && tftp_writer_zero(data, len))
+        {
+            t->io.offset += len;
+            t->loop->stats.zero_skipped += len;
+            return 0;
+        }
+
+        return tftp_uring_write(t, data, len);
+    }
+
+    if (t->loop->writer != NULL)
+        return tftp_writer_append(t, data, len);
+
+    return fwrite(data, 1, len, t->fd) == len ? 0 : -1;
+}
+
+/**
+ * Finish writing the file of write request 't' after its last block
+ * is received: write buffered blocks and sync the file if the loop
+ * asks for it.
+ *
+ * @return
+ *      Zero if the file is written, 1 if writes are in progress and
+ *      tftp_transfer_written() is called once they complete, or -1,
+ *      if error occured.
+ */
+static int tftp_write_end(tftp_transfer *t)
+{
+    tftp_loop *loop = t->loop;
+
+    if (loop->writer != NULL && tftp_writer_flush(t))
+        return -1;
+
+    if (t->io.writes > 0)
+        return 1;
+
+    /* zero blocks at the end of the file are not written */
+    if ((loop->writer != NULL || loop->uring != NULL) &&
+        ftruncate(fileno(t->fd), t->io.offset))
+        return -1;
+
+    if (loop->fsync == TFTP_FSYNC_NONE || t->synced)
+        return 0;
+
+    t->synced = 1;
+
+    /* ring can be out of sync slots, then the loop syncs the file */
+    if (loop->uring != NULL && tftp_uring_sync(t) == 0)
+        return 1;
+
+    if (loop->writer != NULL)
+        return tftp_writer_sync(t) ? -1 : 1;
+
+    return fflush(t->fd) || fdatasync(fileno(t->fd)) ? -1 : 0;
+}
+
+/**
+ * Handle message from client writing a file.
+ *
+ * @return
+ *      Pointer to string with information about
+ *      occured error, or NULL otherwise.
+ */
+static char* tftp_write_input(tftp_transfer *t, tftp_message *msg,
+                              ssize_t msg_len)
+{
+    uint16_t    received;
+    ssize_t     data_len;
+    uint8_t     *data;
+    size_t      len;
+    int         rc;
+
+    if (ntohs(msg->opcode) != DATA)
+        return "invalid message during transfer received";
+
+    /* client repeats the last block until it is acknowledged */
+    if (t->io.draining)
+        return NULL;
+
+    received = ntohs(msg->data.block_number);
+    data_len = msg_len - 4;                                 /* +4 for opcode */
+
+    t->countdown = RECV_RETRIES;
+
+    if (received != (uint16_t)(t->block_number + 1))
+    {
+        /*
+         * Block received already is delayed, or client repeats
+         * the window as its ACK is lost. It is not acknowledged again,
+         * or client would send the rest twice (Sorcerer's Apprentice
+         * Syndrome), the ACK is resent on the timeout.
+         */
+        if (received == (uint16_t)t->block_number ||
+            ((uint16_t)(received - t->block_number) > t->opts.windowsize &&
+             (uint16_t)(t->block_number - received) < 0x8000))
+        {
+            t->loop->stats.stale_data++;
+            t->loop->metrics.stale_data++;
+            return NULL;
+        }
+
+        if ((uint16_t)(received - t->block_number) > t->opts.windowsize)
+            return "invalid block number received";
+
+        /*
+         * A block of the window was lost, acknowledge the last block
+         * received in order once, so client resends the rest
+         * (RFC 7440).
+         */
+        if (t->rewound)
+        {
+            tftp_timer_arm(t->loop, &t->timer, t->rto.rto);
+            return NULL;
+        }
+
+        t->window_len = 0;
+        t->rewound    = 1;
+        t->sent_at    = 0;
+    }
+    else
+    {
+        /* the first block of a window answers the previous ACK */
+        if (t->sent_at)
+            tftp_rtt_sample(t);
+
+        t->block_number++;
+        t->window_len++;
+        t->rewound = 0;
+        t->sent_at = 0;
+        t->blocks++;
+        t->bytes  += data_len;
+
+        data = msg->data.data;
+        len  = data_len;
+        if (t->mode == NETASCII)
+            data = tftp_netascii_decode(data, &len, &t->cr,
+                                        data_len < t->opts.blksize);
+
+        if (tftp_write_block(t, data, len))
+        {
+            perror("tftp server: write()");
+            tftp_transfer_kill(t);
+            return NULL;
+        }
+
+        /* acknowledge each full window and the last block */
+        if (t->window_len < t->opts.windowsize &&
+            data_len >= t->opts.blksize)
+        {
+            tftp_timer_arm(t->loop, &t->timer, t->rto.rto);
+            return NULL;
+        }
+
+        /* the last block is acknowledged once the file is written */
+        if (data_len < t->opts.blksize)
+        {
+            rc = tftp_write_end(t);
+            if (rc < 0)
+            {
+                perror("tftp server: write()");
+                tftp_transfer_kill(t);
+                return NULL;
+            }
+
+            if (rc > 0)
+            {
+                t->io.draining = 1;
+                tftp_timer_cancel(t->loop, &t->timer);
+                return NULL;
+            }
+        }
+
+        if (data_len < t->opts.blksize)
+            t->state = TFTP_TRANSFER_COMPLETED;
+
+        t->window_len = 0;
+        t->sent_at    = tftp_time_us();
+    }
+
+    tftp_send_ack(t->loop, t->block_number, &t->client_sock, t->slen);
+    tftp_timer_arm(t->loop, &t->timer, t->rto.rto);
+
+    return NULL;
+}
+
+/**
+ * Get regular file of a read request from the loop file cache, or map
+ * it into memory if it is not cached. Files that can not be mapped,
+ * like empty files and pipes, are read with pread().
+ * Mapped file must not be truncated while it is served.
+ */
+static void tftp_read_map(tftp_transfer *t, const char *filename)
+{
+    struct stat st;
+    int         hit;
+    long        start;
+
+    t->file_size = -1;
+
+    if (fstat(fileno(t->fd), &st) || !S_ISREG(st.st_mode))
+        return;
+
+    t->file_size = st.st_size;
+    if (t->file_size == 0)
+        return;
+
+    if (t->loop->cache != NULL)
+    {
+        start     = tftp_time_us();
+        t->cached = tftp_cache_get(t->loop->cache, filename,
+                                   fileno(t->fd), &st, &hit);
+        tftp_histogram_add(&t->loop->metrics.cache_latency,
+                           tftp_time_us() - start);
+        if (hit)
+        {
+            t->loop->stats.cache_hits++;
+            t->loop->metrics.cache_hits++;
+        }
+        else
+        {
+            t->loop->stats.cache_misses++;
+            t->loop->metrics.cache_misses++;
+        }
+
+        if (t->cached != NULL)
+        {
+            t->map = t->cached->data;
+            return;
+        }
+    }
+
+    /*
+     * Loop using io_uring reads blocks ahead instead of faulting them
+     * in, but blocks of netascii text do not map to blocks of the file.
+     */
+    if (!t->text && tftp_uring_reserve(t) == 0)
+        return;
+
+    t->map = mmap(NULL, t->file_size, PROT_READ, MAP_SHARED,
+                  fileno(t->fd), 0);
+    if (t->map == MAP_FAILED)
+    {
+        t->map = NULL;
+        return;
+    }
+
+    madvise(t->map, t->file_size, MADV_SEQUENTIAL);
+}
+
+/**
+ * Get file of read request 't' from the providers of its loop.
+ * Netascii content is translated as it is sent, like text read from
+ * a file.
+ *
+ * @return
+ *      Zero if a provider has the file, 1 if none of them has it,
+ *      or -1, if error occured.
+ */
+static int tftp_read_provided(tftp_transfer *t, const char *name)
+{
+    uint8_t *data;
+    size_t  len;
+    int     borrowed;
+    int     ret;
+
+    ret = tftp_provider_get(t->loop->providers, &t->client_sock, name,
+                            &data, &len, &borrowed);
+    if (ret != 0)
+        return ret;
+
+    t->provided  = 1;
+    t->borrowed  = borrowed;
+    t->file_size = len;
+    t->map       = data;
+    t->text      = t->mode == NETASCII;
+
+    return 0;
+}
+
+/**
+ * Free transfer 't' that failed to be created, with its file: generated
+ * content it owns, or the file opened.
+ */
+static void tftp_transfer_free(tftp_transfer *t)
+{
+    if (t->provided)
+    {
+        if (!t->borrowed)
+            free(t->map);
+    }
+    else
+    {
+        fclose(t->fd);
+    }
+
+    free(t->filename);
+    free(t);
+}
+
+/**
+ * Parse request from client and open requested file.
+ *
+ * @se
+ *      Prints information about the request.
+ *      If the request could not be served, function will:
+ *      Print information about it, send string to client
+ *      containing error description.
+ *
+ * @return
+ *      New transfer, or NULL, if the request is rejected.
+ */
+tftp_transfer *tftp_transfer_create(tftp_loop *loop, tftp_message *msg,
+                                    ssize_t msg_len,
+                                    struct sockaddr_in *client_sock,
+                                    socklen_t slen)
+{
+    int             mtu;
+    int             ret;
+    int             err;
+    int             fd;
+    int             cached = 0;
+    char            *filename;
+    const char      *name;
+    char            *error_string;
+    tftp_transfer   *t;
+
+    t = calloc(1, sizeof(*t));
+    if (t == NULL)
+    {
+        perror("tftp server: calloc()");
+        return NULL;
+    }
+
+    t->loop        = loop;
+    t->client_sock = *client_sock;
+    t->slen        = slen;
+    t->io.ahead    = -1;
+    t->io.reading  = -1;
+    t->started_at  = tftp_time_us();
+
+    tftp_bucket_init(&t->pace, loop->client_rate);
+
+    error_string = tftp_get_request_data(&t->opcode, &filename, &t->mode,
+                                         &t->opts, loop->base_directory,
+                                         msg, msg_len);
+    if (error_string != NULL)
+    {
+        printf("%s.%u: %s\n",
+                inet_ntoa(client_sock->sin_addr),
+                ntohs(client_sock->sin_port),
+                error_string);
+        tftp_send_error(loop->xfer_sock, 0, error_string, client_sock, slen);
+        free(t);
+        return NULL;
+    }
+
+    name = tftp_relative_path(filename, loop->base_directory);
+
+    /* generated files are looked up first and never touch the disk */
+    ret = name != NULL && t->opcode == RRQ ? tftp_read_provided(t, name) : 1;
+    if (ret == -1)
+    {
+        err = errno;
+        perror("tftp server: provider");
+        tftp_send_error(loop->xfer_sock, tftp_errno_code(err),
+                        strerror(err), client_sock, slen);
+        free(t);
+        return NULL;
+    }
+
+    if (t->provided)
+        loop->metrics.opens_provided++;
+    else
+    {
+        if (name == NULL)
+        {
+            errno = EXDEV;
+            fd    = -1;
+        }
+        else
+            fd = tftp_dir_open(&loop->dir, name,
+                               t->opcode == RRQ ? O_RDONLY :
+                               O_WRONLY | O_CREAT | O_TRUNC, &cached);
+
+        /* symbolic links may still lead out of the directory */
+        if (fd == -1 && errno == EXDEV)
+        {
+            printf("%s.%u: filename outside base directory\n",
+                    inet_ntoa(client_sock->sin_addr),
+                    ntohs(client_sock->sin_port));
+            tftp_send_error(loop->xfer_sock, 0,
+                            "filename outside base directory",
+                            client_sock, slen);
+            free(t);
+            return NULL;
+        }
+
+        if (fd != -1)
+        {
+            t->fd = fdopen(fd, t->opcode == RRQ ? "r" : "w");
+            if (t->fd == NULL)
+                close(fd);
+        }
+
+        if (fd == -1 || t->fd == NULL)
+        {
+            /* the first message to stderr may change errno */
+            err = errno;
+            perror("tftp server: open()");
+            tftp_send_error(loop->xfer_sock, tftp_errno_code(err),
+                            strerror(err), client_sock, slen);
+            free(t);
+            return NULL;
+        }
+
+        if (cached)
+            loop->metrics.opens_cached++;
+        else
+            loop->metrics.opens_resolved++;
+    }
+
+    t->filename = strdup(filename);
+    if (t->filename == NULL)
+    {
+        perror("tftp server: strdup()");
+        tftp_transfer_free(t);
+        return NULL;
+    }
+
+    if (t->opcode == RRQ && !t->provided)
+    {
+        t->text = t->mode == NETASCII;
+        tftp_read_map(t, name);
+    }
+
+    /*
+     * Client asks for the size of the file it reads with tsize 0.
+     * Size of netascii text is not known until all of it is sent.
+     */
+    if ((t->opts.accepted & TFTP_OPT_TSIZE) && t->opcode == RRQ)
+    {
+        if (t->file_size >= 0 && !t->text)
+            t->opts.tsize = t->file_size;
+        else
+            t->opts.accepted &= ~TFTP_OPT_TSIZE;
+    }
+
+    /*
+     * Client writing a file tells its size with tsize, so the file is
+     * laid out at once instead of growing block by block. The file
+     * takes the size right away, as holes can only be punched below
+     * the end of the file, and gets the size written at the end.
+     */
+    if ((t->opts.accepted & TFTP_OPT_TSIZE) && t->opcode == WRQ &&
+        t->opts.tsize > 0)
+        t->preallocated = fallocate(fileno(t->fd), 0, 0,
+                                    t->opts.tsize) == 0;
+
+    if ((t->opts.accepted & TFTP_OPT_TSIZE) && t->opcode == WRQ &&
+        t->opts.tsize > 0 && !t->preallocated &&
+        (errno == ENOSPC || errno == EFBIG))
+    {
+        printf("%s.%u: no room for %lu bytes of '%s'\n",
+                inet_ntoa(client_sock->sin_addr),
+                ntohs(client_sock->sin_port), t->opts.tsize, filename);
+        tftp_send_error(loop->xfer_sock, TFTP_ERR_DISK_FULL,
+                        "disk full or allocation exceeded",
+                        client_sock, slen);
+        tftp_transfer_free(t);
+        return NULL;
+    }
+
+    /* Blocks larger than the path MTU would be fragmented. */
+    if (t->opts.accepted & TFTP_OPT_BLKSIZE)
+    {
+        mtu = tftp_path_mtu(client_sock, slen);
+        if (mtu - TFTP_DATA_OVERHEAD >= TFTP_MIN_BLKSIZE &&
+            t->opts.blksize > mtu - TFTP_DATA_OVERHEAD)
+            t->opts.blksize = mtu - TFTP_DATA_OVERHEAD;
+    }
+
+    /* Window of blocks of the size taken must fit the send queue. */
+    if (t->opts.windowsize > TFTP_LOOP_TX_BUFFER / t->opts.blksize)
+        t->opts.windowsize = TFTP_LOOP_TX_BUFFER / t->opts.blksize;
+
+    printf("%s.%u: request received: %s '%s' %s\n",
+            inet_ntoa(client_sock->sin_addr), ntohs(client_sock->sin_port),
+            t->opcode == RRQ   ? "get"   : "put", filename,
+            t->mode   == OCTET ? "oktet" : "netascii");
+
+    /* Client falls back to unicast if multicast is not acknowledged. */
+    if ((t->opts.accepted & TFTP_OPT_MULTICAST) && tftp_mcast_join(t))
+        t->opts.accepted &= ~TFTP_OPT_MULTICAST;
+
+    t->state = TFTP_TRANSFER_RUNNING;
+    tftp_rto_init(&t->rto, &t->opts);
+
+    return t;
+}
+
+/**
+ * Send the first packet of the transfer: OACK, the first window of
+ * a read request, or ACK for block 0 of a write request.
+ *
+ * @return
+ *      State of the transfer.
+ */
+int tftp_transfer_start(tftp_transfer *t)
+{
+    int rc = 0;
+
+    /*
+     * If options were negotiated, client acknowledges OACK
+     * with ACK for block 0 before the first DATA packet.
+     */
+    t->negotiating = t->opcode == RRQ && t->opts.accepted != 0;
+    t->countdown   = RECV_RETRIES;
+    t->sent_at     = tftp_time_us();
+
+    /* client listens to the group until it becomes the master client */
+    if (t->session != NULL && t->session->master != t)
+    {
+        tftp_send_oack(t);
+        return t->state;
+    }
+
+    if (t->opcode == RRQ)
+    {
+        rc = tftp_read_send(t);
+    }
+    else
+    {
+        tftp_send_write_ack(t, 0);
+        tftp_timer_arm(t->loop, &t->timer, t->rto.rto);
+    }
+
+    if (rc)
+        tftp_transfer_kill(t);
+
+    return t->state;
+}
+
+/**
+ * Feed transfer with message received from its client.
+ *
+ * @se
+ *      If the message breaks the transfer, function will:
+ *      Print information about it, send string to client
+ *      containing error description.
+ *
+ * @return
+ *      State of the transfer.
+ */
+int tftp_transfer_input(tftp_transfer *t, tftp_message *msg,
+                        ssize_t msg_len)
+{
+    char *error_string;
+
+    if (msg_len < TFTP_MSG_MIN_SIZE)
+    {
+        error_string = "message with invalid size received";
+    }
+    else if (ntohs(msg->opcode) == ERROR)
+    {
+        printf("%s.%u: error message received: %u %.*s\n",
+                inet_ntoa(t->client_sock.sin_addr),
+                ntohs(t->client_sock.sin_port),
+                ntohs(msg->error.error_code),
+                (int)msg_len - 4, msg->error.error_string);
+        t->state = TFTP_TRANSFER_FAILED;
+        return t->state;
+    }
+    else if (t->opcode == RRQ)
+    {
+        error_string = tftp_read_input(t, msg);
+    }
+    else
+    {
+        error_string = tftp_write_input(t, msg, msg_len);
+    }
+
+    if (error_string != NULL)
+    {
+        printf("%s.%u: %s\n",
+               inet_ntoa(t->client_sock.sin_addr),
+               ntohs(t->client_sock.sin_port),
+               error_string);
+        tftp_send_error(t->loop->xfer_sock, 0, error_string,
+                        &t->client_sock, t->slen);
+        t->state = TFTP_TRANSFER_FAILED;
+    }
+
+    return t->state;
+}
+
+/**
+ * Handle expiration of the transfer retransmission timer:
+ * resend the last window or acknowledgement, or send the window
+ * that waited for tokens.
+ *
+ * @return
+ *      State of the transfer.
+ */
+int tftp_transfer_timeout(tftp_transfer *t)
+{
+    int rc = 0;
+
+    /* the window waited for tokens, it is not a retransmission */
+    if (t->paced)
+    {
+        if (!t->retransmitted)
+            t->sent_at = tftp_time_us();
+
+        if (tftp_read_send(t))
+            tftp_transfer_kill(t);
+
+        return t->state;
+    }
+
+    if (tftp_rto_backoff(&t->rto) && --t->countdown == 0)
+    {
+        printf("%s.%u: transfer timed out\n",
+                inet_ntoa(t->client_sock.sin_addr),
+                ntohs(t->client_sock.sin_port));
+        t->state = TFTP_TRANSFER_FAILED;
+        return t->state;
+    }
+
+    t->retransmitted = 1;
+    t->timeouts++;
+
+    if (t->opcode == RRQ)
+    {
+        /* resent DATA is counted when it is queued */
+        if (t->negotiating)
+            t->retransmits++;
+
+        rc = tftp_read_send(t);
+    }
+    else
+    {
+        t->retransmits++;
+        t->window_len = 0;
+        t->sent_at    = 0;
+
+        tftp_send_write_ack(t, t->block_number);
+        tftp_timer_arm(t->loop, &t->timer, t->rto.rto);
+    }
+
+    if (rc)
+        tftp_transfer_kill(t);
+
+    return t->state;
+}
+
+/**
+ * Make client of transfer 't' the master client of its multicast
+ * session: send it OACK, so that it acknowledges the last block
+ * it has received in order.
+ */
+void tftp_transfer_promote(tftp_transfer *t)
+{
+    t->negotiating   = 1;
+    t->rewound       = 0;
+    t->retransmitted = 0;
+    t->sends         = 0;
+    t->stale_acks    = 0;
+    t->countdown     = RECV_RETRIES;
+    t->sent_at       = tftp_time_us();
+
+    tftp_read_send(t);
+}
+
+/**
+ * Handle completion of a write or sync of write request 't' submitted
+ * to io_uring or the writer with 'error' errno, or zero, if it
+ * succeeded. Once the last block is written, it is acknowledged.
+ *
+ * @return
+ *      State of the transfer.
+ */
+int tftp_transfer_written(tftp_transfer *t, int error)
+{
+    int rc;
+
+    t->io.writes--;
+
+    if (error)
+    {
+        fprintf(stderr, "tftp server: write(): %s\n", strerror(error));
+        tftp_transfer_kill(t);
+        return t->state;
+    }
+
+    if (!t->io.draining || t->io.writes > 0)
+        return t->state;
+
+    rc = tftp_write_end(t);
+    if (rc < 0)
+    {
+        perror("tftp server: fdatasync()");
+        tftp_transfer_kill(t);
+    }
+    else if (rc == 0)
+    {
+        tftp_send_ack(t->loop, t->block_number, &t->client_sock, t->slen);
+        t->state = TFTP_TRANSFER_COMPLETED;
+    }
+
+    return t->state;
+}
+
+/**
+ * Free transfer. The transfer must be removed from its loop.
+ *
+ * @se
+ *      Prints information about completed transfer.
+ */
+void tftp_transfer_destroy(tftp_transfer *t)
+{
+    double seconds;
+
+    tftp_timer_cancel(t->loop, &t->timer);
+
+    if (t->state == TFTP_TRANSFER_COMPLETED)
+    {
+        seconds = (tftp_time_us() - t->started_at) / 1e6;
+        printf("%s.%u: '%s' transfer completed: %lu bytes in %.3f s, "
+               "%.1f MiB/s, %u packets resent, %u timeouts, RTT %ld us\n",
+                inet_ntoa(t->client_sock.sin_addr),
+                ntohs(t->client_sock.sin_port),
+                t->filename, t->bytes, seconds,
+                seconds > 0 ? t->bytes / seconds / (1024 * 1024) : 0,
+                t->retransmits, t->timeouts,
+                t->rtt_samples ? t->rtt_sum / t->rtt_samples : 0);
+    }
+
+    if (t->session != NULL)
+        tftp_mcast_leave(t);
+
+    tftp_uring_release(t);
+    tftp_writer_release(t);
+
+    if (t->map != NULL)
+    {
+        /* queued packets may still point into the file content */
+        tftp_loop_flush(t->loop);
+
+        if (t->cached != NULL)
+            tftp_cache_put(t->loop->cache, t->cached);
+        else if (t->provided && !t->borrowed)
+            free(t->map);
+        else if (!t->provided)
+            munmap(t->map, t->file_size);
+    }
+
+    if (t->fd != NULL)
+        fclose(t->fd);
+    free(t->text_pos);
+    free(t->text_buf);
+    free(t->filename);
+    free(t);
+}
@@ -0,0 +1,955 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+
+#include "include/tftp_uring.h"
+#include "include/tftp_transfer.h"
+
+/* Operation of a completion, the rest of user_data is its index. */
+#define TFTP_URING_RECV         0
+#define TFTP_URING_POLL         1
+#define TFTP_URING_SEND         2
+#define TFTP_URING_READ         3
+#define TFTP_URING_WRITE        4
+#define TFTP_URING_CANCEL       5
+#define TFTP_URING_SYNC         6
+
+/* Registered buffers. */
+#define TFTP_URING_RX_BUF       0
+#define TFTP_URING_AHEAD_BUF    1
+
+#define TFTP_URING_RX_GROUP     0       /* provided buffer group */
+
+/* Received message follows its header and the client address. */
+#define TFTP_URING_RX_SIZE      (sizeof(struct io_uring_recvmsg_out) + \
+                                 sizeof(struct sockaddr_in) + \
+                                 sizeof(tftp_message))
+
+#define tftp_uring_data(op, index) ((uint64_t)(index) << 8 | (op))
+
+static int tftp_uring_setup(unsigned int entries, struct io_uring_params *p)
+{
+    return syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int tftp_uring_enter(tftp_uring *u, unsigned int min_complete,
+                            struct timespec *ts)
+{
+    struct io_uring_getevents_arg   arg;
+    unsigned int                    to_submit;
+
+    memset(&arg, 0, sizeof(arg));
+    arg.ts = (uint64_t)(uintptr_t)ts;
+
+    to_submit = *u->sq_tail - __atomic_load_n(u->sq_head, __ATOMIC_ACQUIRE);
+
+    return syscall(__NR_io_uring_enter, u->fd, to_submit, min_complete,
+                   IORING_ENTER_EXT_ARG |
+                   (min_complete ? IORING_ENTER_GETEVENTS : 0),
+                   &arg, sizeof(arg));
+}
+
+/**
+ * Get free submission queue entry for operation 'op' with 'index',
+ * submitting queued entries if the queue is full.
+ *
+ * @return
+ *      Entry to fill in, or NULL, if the queue stays full.
+ */
+static struct io_uring_sqe *tftp_uring_sqe(tftp_uring *u, int op,
+                                           unsigned int index)
+{
+    unsigned int        tail = *u->sq_tail;
+    struct io_uring_sqe *sqe;
+
+    if (tail - __atomic_load_n(u->sq_head, __ATOMIC_ACQUIRE) ==
+        u->sq_entries)
+    {
+        tftp_uring_enter(u, 0, NULL);
+        if (tail - __atomic_load_n(u->sq_head, __ATOMIC_ACQUIRE) ==
+            u->sq_entries)
+            return NULL;
+    }
+
+    sqe = &u->sqes[tail & u->sq_mask];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->user_data = tftp_uring_data(op, index);
+
+    u->sq_array[tail & u->sq_mask] = tail & u->sq_mask;
+    __atomic_store_n(u->sq_tail, tail + 1, __ATOMIC_RELEASE);
+
+    u->inflight++;
+
+    return sqe;
+}
+
+/**
+ * Move completions from the completion queue to the ring of completions
+ * to be handled. Completions of sends are only counted, their packets
+ * are gone.
+ */
+static void tftp_uring_reap(tftp_loop *loop)
+{
+    tftp_uring          *u    = loop->uring;
+    unsigned int        head = *u->cq_head;
+    unsigned int        tail = __atomic_load_n(u->cq_tail, __ATOMIC_ACQUIRE);
+    struct io_uring_cqe *cqe;
+
+    for (; head != tail; head++)
+    {
+        cqe = &u->cqes[head & u->cq_mask];
+        if (!(cqe->flags & IORING_CQE_F_MORE))
+            u->inflight--;
+
+        /*
+         * Completions are either of operations that complete once,
+         * or hold receive buffers, so the ring never fills.
+         */
+        if ((cqe->user_data & 0xff) != TFTP_URING_SEND)
+        {
+            u->done[u->done_tail++ % u->done_size] =
+                (tftp_uring_done){ cqe->user_data, cqe->res, cqe->flags };
+            continue;
+        }
+
+        u->sends--;
+
+        if (cqe->res >= 0)
+            loop->stats.tx_packets++;
+        else if (cqe->res != -EAGAIN)
+            fprintf(stderr, "tftp server: sendmsg(): %s\n",
+                    strerror(-cqe->res));
+    }
+
+    __atomic_store_n(u->cq_head, head, __ATOMIC_RELEASE);
+}
+
+/**
+ * Post multishot receive on socket 'i' of the loop. Receive ends when
+ * all buffers are taken, it is posted again once a buffer is returned.
+ */
+static void tftp_uring_recv(tftp_loop *loop, int i)
+{
+    tftp_uring          *u = loop->uring;
+    struct io_uring_sqe *sqe;
+
+    if (u->rx_armed[i] || u->rx_socks[i] == -1 ||
+        u->rx_out == TFTP_URING_RX_BUFS)
+        return;
+
+    sqe = tftp_uring_sqe(u, TFTP_URING_RECV, i);
+    if (sqe == NULL)
+        return;
+
+    sqe->opcode    = IORING_OP_RECVMSG;
+    sqe->fd        = u->rx_socks[i];
+    sqe->addr      = (uintptr_t)&u->rx_msg;
+    sqe->len       = 1;
+    sqe->ioprio    = IORING_RECV_MULTISHOT;
+    sqe->flags     = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = TFTP_URING_RX_GROUP;
+
+    u->rx_armed[i] = 1;
+}
+
+/** Give receive buffer 'bid' back to the kernel. */
+static void tftp_uring_rx_put(tftp_loop *loop, unsigned int bid)
+{
+    tftp_uring          *u = loop->uring;
+    struct io_uring_buf *buf;
+
+    buf = &u->rx_ring->bufs[u->rx_tail & (TFTP_URING_RX_BUFS - 1)];
+    buf->addr = (uintptr_t)(u->rx + bid * TFTP_URING_RX_SIZE);
+    buf->len  = TFTP_URING_RX_SIZE;
+    buf->bid  = bid;
+
+    __atomic_store_n(&u->rx_ring->tail, ++u->rx_tail, __ATOMIC_RELEASE);
+
+    u->rx_out--;
+    tftp_uring_recv(loop, 0);
+    tftp_uring_recv(loop, 1);
+}
+
+/** Post wait for 'fd' to become readable. */
+static void tftp_uring_poll(tftp_loop *loop, int fd)
+{
+    struct io_uring_sqe *sqe;
+
+    sqe = tftp_uring_sqe(loop->uring, TFTP_URING_POLL, fd);
+    if (sqe == NULL)
+        return;
+
+    sqe->opcode        = IORING_OP_POLL_ADD;
+    sqe->fd            = fd;
+    sqe->poll32_events = POLLIN;
+}
+
+/**
+ * Submit reads ahead requested since the last flush. They are
+ * submitted after the queued packets are sent, as the packets may
+ * point into the halves the reads fill.
+ */
+static void tftp_uring_submit_reads(tftp_loop *loop)
+{
+    tftp_uring          *u = loop->uring;
+    tftp_transfer       *t;
+    tftp_uring_xfer     *io;
+    struct io_uring_sqe *sqe;
+    int                 h;
+
+    while ((t = u->reads) != NULL)
+    {
+        io       = &t->io;
+        h        = io->reading;
+        u->reads = io->read_next;
+        io->queued = 0;
+
+        sqe = tftp_uring_sqe(u, TFTP_URING_READ, io->ahead);
+        if (sqe == NULL)
+        {
+            io->reading = -1;
+            continue;
+        }
+
+        sqe->opcode    = u->fixed ? IORING_OP_READ_FIXED : IORING_OP_READ;
+        sqe->fd        = fileno(t->fd);
+        sqe->addr      = (uintptr_t)(u->ahead +
+                         (2 * io->ahead + h) * TFTP_URING_AHEAD_SIZE);
+        sqe->len       = io->size[h];
+        sqe->off       = ((off_t)io->block[h] - 1) * t->opts.blksize;
+        sqe->buf_index = TFTP_URING_AHEAD_BUF;
+    }
+}
+
+/**
+ * Send all queued packets of the loop through the ring. Packets that
+ * do not fit into the socket buffer are dropped, retransmission timers
+ * of their transfers resend them.
+ *
+ * @se
+ *      Prints information about occurred error to stderr.
+ */
+void tftp_uring_flush(tftp_loop *loop)
+{
+    tftp_uring          *u  = loop->uring;
+    tftp_batch          *tx = &loop->tx;
+    struct io_uring_sqe *sqe;
+    unsigned int        i;
+
+    for (i = 0; i < tx->len; i++)
+    {
+        sqe = tftp_uring_sqe(u, TFTP_URING_SEND, 0);
+        if (sqe == NULL)
+            break;
+
+        sqe->opcode = IORING_OP_SENDMSG;
+        sqe->fd     = loop->xfer_sock;
+        sqe->addr   = (uintptr_t)&tx->hdrs[i].msg_hdr;
+        sqe->len    = 1;
+
+        u->sends++;
+    }
+
+    /* the queue is reused once the kernel is done with the packets */
+    while (u->sends > 0)
+    {
+        if (tftp_uring_enter(u, 1, NULL) < 0 && errno != EINTR)
+        {
+            perror("tftp server: io_uring_enter()");
+            break;
+        }
+
+        loop->stats.tx_calls++;
+        tftp_uring_reap(loop);
+    }
+
+    tx->len  = 0;
+    tx->used = 0;
+
+    tftp_uring_submit_reads(loop);
+}
+
+/** Handle completion of receive on socket 'i' of the loop. */
+static void tftp_uring_received(tftp_loop *loop, int i, int res,
+                                uint32_t flags)
+{
+    tftp_uring                  *u = loop->uring;
+    struct io_uring_recvmsg_out *out;
+    struct sockaddr_in          *client_sock;
+    tftp_message                *msg;
+    unsigned int                bid;
+
+    if (!(flags & IORING_CQE_F_MORE))
+        u->rx_armed[i] = 0;
+
+    if (!(flags & IORING_CQE_F_BUFFER))
+    {
+        if (res != -ENOBUFS && res != -ECANCELED && res != -EINTR)
+            fprintf(stderr, "tftp server: recvmsg(): %s\n", strerror(-res));
+        if (res != -ECANCELED)
+            tftp_uring_recv(loop, i);
+        return;
+    }
+
+    bid = flags >> IORING_CQE_BUFFER_SHIFT;
+    u->rx_out++;
+
+    out         = (struct io_uring_recvmsg_out *)
+                  (u->rx + bid * TFTP_URING_RX_SIZE);
+    client_sock = (struct sockaddr_in *)(out + 1);
+    msg         = (tftp_message *)(client_sock + 1);
+
+    if (res >= 0 && !(out->flags & MSG_TRUNC))
+    {
+        loop->stats.rx_packets++;
+
+        if (u->rx_socks[i] == loop->listen_sock)
+            tftp_loop_request(loop, msg, out->payloadlen, client_sock,
+                              out->namelen);
+        else
+            tftp_loop_input(loop, msg, out->payloadlen, client_sock,
+                            out->namelen);
+    }
+
+    /* the message stays in the buffer until it is written to a file */
+    if (!u->rx_held[bid])
+        tftp_uring_rx_put(loop, bid);
+
+    tftp_uring_recv(loop, i);
+}
+
+/** Handle completion of read ahead into slot 'slot'. */
+static void tftp_uring_read_done(tftp_loop *loop, unsigned int slot, int res)
+{
+    tftp_uring      *u = loop->uring;
+    tftp_transfer   *t = u->ahead_owner[slot];
+
+    /* transfer finished while the read was in progress */
+    if (t == NULL)
+    {
+        u->ahead_free |= 1U << slot;
+        return;
+    }
+
+    /* blocks that could not be read are read with pread() */
+    t->io.len[t->io.reading] = res < 0 ? -1 : res;
+    t->io.reading = -1;
+}
+
+/** Handle completion of write from receive buffer 'slot'. */
+static void tftp_uring_write_done(tftp_loop *loop, unsigned int slot,
+                                  int res)
+{
+    tftp_uring      *u = loop->uring;
+    tftp_transfer   *t = u->rx_writer[slot];
+    int             error;
+
+    error = res < 0 ? -res :
+            ((size_t)res < u->rx_write_len[slot] ? ENOSPC : 0);
+
+    tftp_histogram_add(&loop->metrics.disk_latency,
+                       tftp_time_us() - u->rx_write_at[slot]);
+
+    u->rx_held[slot]   = 0;
+    u->rx_writer[slot] = NULL;
+    tftp_uring_rx_put(loop, slot);
+
+    if (t != NULL && tftp_transfer_written(t, error) != TFTP_TRANSFER_RUNNING)
+        tftp_loop_finish(loop, t);
+}
+
+/** Handle completion of sync of the file of slot 'slot' owner. */
+static void tftp_uring_sync_done(tftp_loop *loop, unsigned int slot, int res)
+{
+    tftp_uring      *u = loop->uring;
+    tftp_transfer   *t = u->sync_owner[slot];
+
+    u->sync_owner[slot] = NULL;
+
+    tftp_histogram_add(&loop->metrics.disk_latency,
+                       tftp_time_us() - u->sync_at[slot]);
+
+    if (t != NULL &&
+        tftp_transfer_written(t, res < 0 ? -res : 0) != TFTP_TRANSFER_RUNNING)
+        tftp_loop_finish(loop, t);
+}
+
+/**
+ * Submit queued operations, wait for completions up to 'ts'
+ * (forever, if it is NULL) and handle them.
+ *
+ * @return
+ *      Number of handled completions, or -1, if error occured.
+ */
+int tftp_uring_wait(tftp_loop *loop, struct timespec *ts)
+{
+    tftp_uring      *u = loop->uring;
+    tftp_uring_done done;
+    int             n = 0;
+
+    /* completions reaped by the last flush are handled right away */
+    if (tftp_uring_enter(u, u->done_head == u->done_tail, ts) < 0 &&
+        errno != ETIME)
+        return -1;
+
+    loop->stats.rx_calls++;
+
+    /* handlers flushing packets may reap more completions */
+    tftp_uring_reap(loop);
+
+    while (u->done_head != u->done_tail)
+    {
+        done = u->done[u->done_head++ % u->done_size];
+        n++;
+
+        switch (done.user_data & 0xff)
+        {
+            case TFTP_URING_RECV:
+                tftp_uring_received(loop, done.user_data >> 8, done.res,
+                                    done.flags);
+                break;
+
+            case TFTP_URING_POLL:
+                /* the loop is stopped once, the poll is not renewed */
+                if ((int)(done.user_data >> 8) == loop->stop_fd)
+                {
+                    loop->stopped = 1;
+                    break;
+                }
+
+                if (loop->cache != NULL &&
+                    (int)(done.user_data >> 8) == loop->cache->inotify_fd)
+                    tftp_cache_notify(loop->cache);
+                else if (loop->mcast_owner)
+                    tftp_mcast_accept(loop);
+
+                if (done.res != -ECANCELED)
+                    tftp_uring_poll(loop, done.user_data >> 8);
+                break;
+
+            case TFTP_URING_READ:
+                tftp_uring_read_done(loop, done.user_data >> 8, done.res);
+                break;
+
+            case TFTP_URING_WRITE:
+                tftp_uring_write_done(loop, done.user_data >> 8, done.res);
+                break;
+
+            case TFTP_URING_SYNC:
+                tftp_uring_sync_done(loop, done.user_data >> 8, done.res);
+                break;
+        }
+    }
+
+    return n;
+}
+
+/**
+ * Take read-ahead slot for read request 't', if its window fits
+ * into a half of the slot.
+ *
+ * @return
+ *      Zero on success, or -1, if blocks are to be read otherwise.
+ */
+int tftp_uring_reserve(tftp_transfer *t)
+{
+    tftp_uring      *u  = t->loop->uring;
+    tftp_uring_xfer *io = &t->io;
+    int             slot;
+
+    if (u == NULL || u->ahead_free == 0 ||
+        (size_t)t->opts.windowsize * t->opts.blksize > TFTP_URING_AHEAD_SIZE)
+        return -1;
+
+    slot = __builtin_ctz(u->ahead_free);
+    u->ahead_free &= ~(1U << slot);
+    u->ahead_owner[slot] = t;
+
+    io->ahead   = slot;
+    io->len[0]  = -1;
+    io->len[1]  = -1;
+
+    return 0;
+}
+
+/**
+ * Find 'block' of read request 't' among the blocks read ahead.
+ *
+ * @param len       Location for length of the block.
+ *
+ * @return
+ *      Block data, or NULL, if the block was not read ahead.
+ */
+const uint8_t *tftp_uring_block(tftp_transfer *t, uint64_t block,
+                                ssize_t *len)
+{
+    tftp_uring_xfer *io      = &t->io;
+    uint16_t        blksize  = t->opts.blksize;
+    ssize_t         offset;
+    int             h;
+
+    if (io->ahead < 0)
+        return NULL;
+
+    for (h = 0; h < 2; h++)
+    {
+        if (h == io->reading || io->len[h] < 0 || block < io->block[h] ||
+            block - io->block[h] >= (uint64_t)io->size[h] / blksize)
+            continue;
+
+        offset = (ssize_t)(block - io->block[h]) * blksize;
+
+        if (offset + blksize <= io->len[h])
+            *len = blksize;
+        else if (io->len[h] < io->size[h])     /* the file ends here */
+            *len = offset < io->len[h] ? io->len[h] - offset : 0;
+        else
+            continue;
+
+        return t->loop->uring->ahead +
+               (2 * io->ahead + h) * TFTP_URING_AHEAD_SIZE + offset;
+    }
+
+    return NULL;
+}
+
+/**
+ * Read blocks of read request 't' that follow the half holding 'block',
+ * the first block after the window just sent, into the other half,
+ * so they are in memory before the client asks for them.
+ */
+void tftp_uring_read_ahead(tftp_transfer *t, uint64_t block)
+{
+    tftp_uring      *u       = t->loop->uring;
+    tftp_uring_xfer *io      = &t->io;
+    uint16_t        blksize  = t->opts.blksize;
+    uint64_t        next     = block;
+    ssize_t         len;
+    int             h;
+
+    if (io->ahead < 0 || io->reading >= 0)
+        return;
+
+    /* start after the end of the half the window is sent from */
+    for (h = 0; h < 2; h++)
+        if (io->len[h] >= 0 && block - 1 >= io->block[h] &&
+            block - 1 - io->block[h] < (uint64_t)io->size[h] / blksize)
+        {
+            if (io->len[h] < io->size[h])
+                return;
+            next = io->block[h] + io->size[h] / blksize;
+            break;
+        }
+
+    if (tftp_uring_block(t, next, &len) != NULL)
+        return;
+
+    /* reuse the half that does not hold the window */
+    h = h < 2 ? !h : (io->len[0] < 0 ? 0 : 1);
+
+    io->reading  = h;
+    io->block[h] = next;
+    io->size[h]  = TFTP_URING_AHEAD_SIZE / blksize * blksize;
+    io->len[h]   = -1;
+
+    io->queued    = 1;
+    io->read_next = u->reads;
+    u->reads      = t;
+}
+
+/**
+ * Write 'len' bytes of 'data' received by write request 't' at the end
+ * of its file. Data is written right from the receive buffer, which is
+ * not reused until the write completes.
+ *
+ * @return
+ *      Zero on success, or -1, if error occured.
+ */
+int tftp_uring_write(tftp_transfer *t, const uint8_t *data, size_t len)
+{
+    tftp_loop           *loop = t->loop;
+    tftp_uring          *u    = loop->uring;
+    unsigned int        slot;
+    struct io_uring_sqe *sqe;
+
+    slot = (data - u->rx) / TFTP_URING_RX_SIZE;
+
+    if (len > 0)
+    {
+        sqe = tftp_uring_sqe(u, TFTP_URING_WRITE, slot);
+        if (sqe == NULL)
+        {
+            errno = EBUSY;
+            return -1;
+        }
+
+        sqe->opcode    = u->fixed ? IORING_OP_WRITE_FIXED : IORING_OP_WRITE;
+        sqe->fd        = fileno(t->fd);
+        sqe->addr      = (uintptr_t)data;
+        sqe->len       = len;
+        sqe->off       = t->io.offset;
+        sqe->buf_index = TFTP_URING_RX_BUF;
+
+        u->rx_held[slot]      = 1;
+        u->rx_writer[slot]    = t;
+        u->rx_write_len[slot] = len;
+        u->rx_write_at[slot]  = tftp_time_us();
+        t->io.writes++;
+    }
+
+    t->io.offset += len;
+
+    return 0;
+}
+
+/**
+ * Submit sync of the data written to the file of write request 't'.
+ * Submitted writes of the file are completed already.
+ *
+ * @return
+ *      Zero on success, or -1, if too many files are being synced.
+ */
+int tftp_uring_sync(tftp_transfer *t)
+{
+    tftp_uring          *u = t->loop->uring;
+    struct io_uring_sqe *sqe;
+    unsigned int        slot;
+
+    for (slot = 0; slot < TFTP_URING_SYNCS; slot++)
+        if (u->sync_owner[slot] == NULL)
+            break;
+
+    if (slot == TFTP_URING_SYNCS)
+        return -1;
+
+    sqe = tftp_uring_sqe(u, TFTP_URING_SYNC, slot);
+    if (sqe == NULL)
+        return -1;
+
+    sqe->opcode      = IORING_OP_FSYNC;
+    sqe->fd          = fileno(t->fd);
+    sqe->fsync_flags = IORING_FSYNC_DATASYNC;
+
+    u->sync_owner[slot] = t;
+    u->sync_at[slot]    = tftp_time_us();
+    t->io.writes++;
+
+    return 0;
+}
+
+/**
+ * Detach finishing transfer 't' from its operations in progress,
+ * they complete without it.
+ */
+void tftp_uring_release(tftp_transfer *t)
+{
+    tftp_uring      *u  = t->loop->uring;
+    tftp_uring_xfer *io = &t->io;
+    tftp_transfer   **pt;
+    unsigned int    i;
+
+    if (u == NULL)
+        return;
+
+    for (i = 0; i < TFTP_URING_RX_BUFS; i++)
+        if (u->rx_writer[i] == t)
+            u->rx_writer[i] = NULL;
+
+    for (i = 0; i < TFTP_URING_SYNCS; i++)
+        if (u->sync_owner[i] == t)
+            u->sync_owner[i] = NULL;
+
+    /* the kernel takes the file before it is closed */
+    if (io->writes > 0)
+        tftp_uring_enter(u, 0, NULL);
+
+    if (io->queued)
+    {
+        for (pt = &u->reads; *pt != t; pt = &(*pt)->io.read_next)
+            ;
+        *pt = io->read_next;
+        io->reading = -1;
+    }
+
+    if (io->ahead >= 0)
+    {
+        u->ahead_owner[io->ahead] = NULL;
+        if (io->reading < 0)
+            u->ahead_free |= 1U << io->ahead;
+    }
+}
+
+/** Free ring and buffers of 'u'. */
+static void tftp_uring_free(tftp_uring *u)
+{
+    if (u->sqes != NULL)
+        munmap(u->sqes, u->sqes_size);
+    if (u->ring != NULL)
+        munmap(u->ring, u->ring_size);
+    if (u->fd != -1)
+        close(u->fd);
+
+    free(u->rx_ring);
+    free(u->rx);
+    free(u->ahead);
+    free(u->done);
+    free(u);
+}
+
+/**
+ * Map rings of io_uring 'u' set up with 'p'.
+ *
+ * @return
+ *      Zero on success, or -1, if error occured.
+ */
+static int tftp_uring_map(tftp_uring *u, struct io_uring_params *p)
+{
+    uint8_t *ring;
+    size_t  cq_size;
+
+    u->ring_size = p->sq_off.array + p->sq_entries * sizeof(unsigned int);
+    cq_size      = p->cq_off.cqes +
+                   p->cq_entries * sizeof(struct io_uring_cqe);
+    if (cq_size > u->ring_size)
+        u->ring_size = cq_size;
+
+    ring = mmap(NULL, u->ring_size, PROT_READ | PROT_WRITE,
+                MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQ_RING);
+    if (ring == MAP_FAILED)
+        return -1;
+    u->ring = ring;
+
+    u->sqes_size = p->sq_entries * sizeof(struct io_uring_sqe);
+    u->sqes = mmap(NULL, u->sqes_size, PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQES);
+    if (u->sqes == MAP_FAILED)
+    {
+        u->sqes = NULL;
+        return -1;
+    }
+
+    u->sq_head    = (unsigned int *)(ring + p->sq_off.head);
+    u->sq_tail    = (unsigned int *)(ring + p->sq_off.tail);
+    u->sq_mask    = *(unsigned int *)(ring + p->sq_off.ring_mask);
+    u->sq_entries = p->sq_entries;
+    u->sq_array   = (unsigned int *)(ring + p->sq_off.array);
+    u->cq_head    = (unsigned int *)(ring + p->cq_off.head);
+    u->cq_tail    = (unsigned int *)(ring + p->cq_off.tail);
+    u->cq_mask    = *(unsigned int *)(ring + p->cq_off.ring_mask);
+    u->cqes       = (struct io_uring_cqe *)(ring + p->cq_off.cqes);
+
+    return 0;
+}
+
+/**
+ * Register ring of receive buffers and post receives on the sockets
+ * of the loop.
+ *
+ * @return
+ *      Zero on success, or -1, if the kernel can not receive into
+ *      provided buffers (errno is set to ENOSYS then).
+ */
+static int tftp_uring_rx_create(tftp_loop *loop)
+{
+    tftp_uring              *u = loop->uring;
+    struct io_uring_buf_reg reg;
+    struct timespec         ts = { 0, 0 };
+    tftp_uring_done         *done;
+    unsigned int            i;
+
+    if (posix_memalign((void **)&u->rx_ring, sysconf(_SC_PAGESIZE),
+                       TFTP_URING_RX_BUFS * sizeof(struct io_uring_buf)))
+    {
+        u->rx_ring = NULL;
+        return -1;
+    }
+
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr    = (uintptr_t)u->rx_ring;
+    reg.ring_entries = TFTP_URING_RX_BUFS;
+    reg.bgid         = TFTP_URING_RX_GROUP;
+
+    /* provided buffer rings came with 5.19 */
+    if (syscall(__NR_io_uring_register, u->fd, IORING_REGISTER_PBUF_RING,
+                &reg, 1))
+    {
+        errno = ENOSYS;
+        return -1;
+    }
+
+    u->rx_ring->tail = 0;
+    u->rx_out        = TFTP_URING_RX_BUFS;
+
+    memset(&u->rx_msg, 0, sizeof(u->rx_msg));
+    u->rx_msg.msg_namelen = sizeof(struct sockaddr_in);
+
+    for (i = 0; i < TFTP_URING_RX_BUFS; i++)
+        tftp_uring_rx_put(loop, i);
+
+    /* multishot receive came with 6.0, older kernels reject it at once */
+    if (tftp_uring_enter(u, 1, &ts) < 0 && errno != ETIME)
+        return -1;
+
+    tftp_uring_reap(loop);
+    for (i = u->done_head; i != u->done_tail; i++)
+    {
+        done = &u->done[i % u->done_size];
+        if ((done->user_data & 0xff) == TFTP_URING_RECV &&
+            done->res == -EINVAL)
+        {
+            errno = ENOSYS;
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * Switch 'loop' from epoll to io_uring: set up the ring, register
+ * buffers and post receives on the loop sockets.
+ *
+ * @return
+ *      Zero on success, or -1, if the kernel lacks io_uring
+ *      features the engine needs.
+ */
+int tftp_uring_create(tftp_loop *loop)
+{
+    tftp_uring              *u;
+    struct io_uring_params  p;
+    struct iovec            bufs[2];
+
+    u = calloc(1, sizeof(*u));
+    if (u == NULL)
+        return -1;
+
+    /* completions are only needed when the loop asks for them (6.1) */
+    memset(&p, 0, sizeof(p));
+    p.flags = IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_DEFER_TASKRUN;
+
+    u->fd = tftp_uring_setup(TFTP_URING_ENTRIES, &p);
+    if (u->fd == -1 && errno == EINVAL)
+    {
+        memset(&p, 0, sizeof(p));
+        u->fd = tftp_uring_setup(TFTP_URING_ENTRIES, &p);
+    }
+    if (u->fd == -1)
+    {
+        free(u);
+        return -1;
+    }
+
+    /* timed waits and completions kept on overflow came with 5.11 */
+    if (!(p.features & IORING_FEAT_EXT_ARG) ||
+        !(p.features & IORING_FEAT_NODROP) ||
+        !(p.features & IORING_FEAT_SINGLE_MMAP) || tftp_uring_map(u, &p))
+    {
+        tftp_uring_free(u);
+        errno = ENOSYS;
+        return -1;
+    }
+
+    u->done_size  = p.cq_entries;
+    u->done       = calloc(u->done_size, sizeof(*u->done));
+    u->ahead      = malloc(2 * TFTP_URING_AHEAD_SLOTS * TFTP_URING_AHEAD_SIZE);
+    u->ahead_free = (uint32_t)((1ULL << TFTP_URING_AHEAD_SLOTS) - 1);
+    u->rx         = malloc(TFTP_URING_RX_BUFS * TFTP_URING_RX_SIZE);
+    if (u->done == NULL || u->ahead == NULL || u->rx == NULL)
+    {
+        tftp_uring_free(u);
+        return -1;
+    }
+
+    /* pinning the buffers may exceed RLIMIT_MEMLOCK, they work unpinned */
+    bufs[TFTP_URING_RX_BUF].iov_base    = u->rx;
+    bufs[TFTP_URING_RX_BUF].iov_len     = TFTP_URING_RX_BUFS *
+                                          TFTP_URING_RX_SIZE;
+    bufs[TFTP_URING_AHEAD_BUF].iov_base = u->ahead;
+    bufs[TFTP_URING_AHEAD_BUF].iov_len  = 2 * TFTP_URING_AHEAD_SLOTS *
+                                          TFTP_URING_AHEAD_SIZE;
+
+    u->fixed = syscall(__NR_io_uring_register, u->fd,
+                       IORING_REGISTER_BUFFERS, bufs, 2) == 0;
+
+    loop->uring = u;
+
+    u->rx_socks[0] = loop->listen_sock;
+    u->rx_socks[1] = loop->xfer_sock;
+    if (tftp_uring_rx_create(loop))
+    {
+        loop->uring = NULL;
+        tftp_uring_free(u);
+        return -1;
+    }
+
+    if (loop->cache != NULL)
+        tftp_uring_poll(loop, loop->cache->inotify_fd);
+    if (loop->mcast_owner)
+        tftp_uring_poll(loop, loop->mcast->event_fd);
+    if (loop->stop_fd != -1)
+        tftp_uring_poll(loop, loop->stop_fd);
+
+    return 0;
+}
+
+/**
+ * Cancel operations in progress and free the ring of 'loop'.
+ * Transfers of the loop must be finished.
+ */
+void tftp_uring_destroy(tftp_loop *loop)
+{
+    tftp_uring          *u = loop->uring;
+    struct io_uring_sqe *sqe;
+    unsigned int        i;
+    int                 fds[3];
+
+    for (i = 0; i < 2; i++)
+    {
+        if (!u->rx_armed[i])
+            continue;
+
+        sqe = tftp_uring_sqe(u, TFTP_URING_CANCEL, 0);
+        if (sqe == NULL)
+            break;
+
+        sqe->opcode = IORING_OP_ASYNC_CANCEL;
+        sqe->addr   = tftp_uring_data(TFTP_URING_RECV, i);
+    }
+
+    fds[0] = loop->cache != NULL ? loop->cache->inotify_fd : -1;
+    fds[1] = loop->mcast_owner ? loop->mcast->event_fd : -1;
+    fds[2] = loop->stopped ? -1 : loop->stop_fd;
+
+    for (i = 0; i < 3; i++)
+    {
+        if (fds[i] == -1 ||
+            (sqe = tftp_uring_sqe(u, TFTP_URING_CANCEL, 0)) == NULL)
+            continue;
+
+        sqe->opcode = IORING_OP_ASYNC_CANCEL;
+        sqe->addr   = tftp_uring_data(TFTP_URING_POLL, fds[i]);
+    }
+
+    /* the kernel must be done with the buffers before they are freed */
+    while (u->inflight > 0)
+    {
+        if (tftp_uring_enter(u, 1, NULL) < 0 && errno != EINTR)
+            break;
+
+        tftp_uring_reap(loop);
+        u->done_head = u->done_tail;
+    }
+
+    loop->uring = NULL;
+    tftp_uring_free(u);
+}
@@ -0,0 +1,490 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/eventfd.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+#include "include/tftp_writer.h"
+#include "include/tftp_transfer.h"
+
+/**
+ * Check if 'len' bytes of 'data' are all zero. Blocks of flash dumps
+ * are mostly zero, so 64 bytes are checked at once.
+ *
+ * @return
+ *      Nonzero if the data is zero.
+ */
+int tftp_writer_zero(const uint8_t *data, size_t len)
+{
+    size_t  i = 0;
+
+#if defined(__SSE2__)
+    __m128i acc = _mm_setzero_si128();
+
+    for (; i + 64 <= len; i += 64)
+    {
+        acc = _mm_or_si128(acc, _mm_loadu_si128((const __m128i *)(data + i)));
+        acc = _mm_or_si128(acc,
+                           _mm_loadu_si128((const __m128i *)(data + i + 16)));
+        acc = _mm_or_si128(acc,
+                           _mm_loadu_si128((const __m128i *)(data + i + 32)));
+        acc = _mm_or_si128(acc,
+                           _mm_loadu_si128((const __m128i *)(data + i + 48)));
+
+        /* data blocks differ from zero early */
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(acc, _mm_setzero_si128())) !=
+            0xffff)
+            return 0;
+    }
+#elif defined(__ARM_NEON)
+    uint8x16_t acc = vdupq_n_u8(0);
+
+    for (; i + 64 <= len; i += 64)
+    {
+        acc = vorrq_u8(acc, vld1q_u8(data + i));
+        acc = vorrq_u8(acc, vld1q_u8(data + i + 16));
+        acc = vorrq_u8(acc, vld1q_u8(data + i + 32));
+        acc = vorrq_u8(acc, vld1q_u8(data + i + 48));
+
+        if (vmaxvq_u8(acc) != 0)
+            return 0;
+    }
+#endif
+
+    for (; i < len; i++)
+        if (data[i] != 0)
+            return 0;
+
+    return 1;
+}
+
+/**
+ * Write 'len' bytes of 'data' to file 'fd' at 'offset'.
+ *
+ * @return
+ *      Zero on success, or errno of the failed call.
+ */
+static int tftp_writer_pwrite(int fd, const uint8_t *data, size_t len,
+                              off_t offset)
+{
+    size_t  done = 0;
+    ssize_t n;
+
+    while (done < len)
+    {
+        n = pwrite(fd, data + done, len - done, offset + done);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0)
+            return errno;
+        if (n == 0)
+            return ENOSPC;
+
+        done += n;
+    }
+
+    return 0;
+}
+
+/**
+ * Write chunk 'w' to its file. Zero file system blocks of the chunk
+ * are not written, they are left as holes, or punched out of the file
+ * if it is preallocated.
+ *
+ * @return
+ *      Zero on success, or errno of the failed call.
+ */
+static int tftp_writer_write(tftp_write *w)
+{
+    size_t  start = 0;          /* of data not written yet */
+    size_t  pos   = 0;
+    size_t  zero;
+    int     error;
+
+    while (pos < w->len)
+    {
+        /* only whole blocks can be holes */
+        if ((w->offset + pos) % TFTP_WRITER_HOLE)
+        {
+            pos += TFTP_WRITER_HOLE - (w->offset + pos) % TFTP_WRITER_HOLE;
+            continue;
+        }
+
+        for (zero = pos; zero + TFTP_WRITER_HOLE <= w->len &&
+             tftp_writer_zero(w->data + zero, TFTP_WRITER_HOLE);
+             zero += TFTP_WRITER_HOLE)
+            ;
+
+        if (zero == pos)
+        {
+            pos += TFTP_WRITER_HOLE;
+            continue;
+        }
+
+        error = tftp_writer_pwrite(w->fd, w->data + start, pos - start,
+                                   w->offset + start);
+        if (error)
+            return error;
+
+        if (w->punch &&
+            fallocate(w->fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+                      w->offset + pos, zero - pos) && errno != EOPNOTSUPP)
+            return errno;
+
+        w->holes += zero - pos;
+        start = pos = zero;
+    }
+
+    if (start < w->len)
+    {
+        error = tftp_writer_pwrite(w->fd, w->data + start, w->len - start,
+                                   w->offset + start);
+        if (error)
+            return error;
+    }
+
+    if (w->sync && fdatasync(w->fd))
+        return errno;
+
+    return 0;
+}
+
+/** Write queued chunks until the writer is stopped. */
+static void *tftp_writer_run(void *arg)
+{
+    tftp_writer *writer = arg;
+    tftp_write  *w;
+    uint64_t    one = 1;
+    long        start;
+
+    pthread_mutex_lock(&writer->lock);
+
+    while (1)
+    {
+        while (writer->queue == NULL && !writer->stop)
+            pthread_cond_wait(&writer->queued, &writer->lock);
+
+        if (writer->queue == NULL)
+            break;
+
+        w = writer->queue;
+        writer->queue = w->next;
+        if (writer->queue == NULL)
+            writer->queue_tail = &writer->queue;
+        writer->busy = w;
+
+        pthread_mutex_unlock(&writer->lock);
+        start      = tftp_time_us();
+        w->error   = tftp_writer_write(w);
+        w->latency = tftp_time_us() - start;
+        pthread_mutex_lock(&writer->lock);
+
+        writer->busy     = NULL;
+        writer->pending -= w->len;
+
+        w->next            = NULL;
+        *writer->done_tail = w;
+        writer->done_tail  = &w->next;
+
+        pthread_cond_broadcast(&writer->idle);
+
+        if (write(writer->event_fd, &one, sizeof(one)) != sizeof(one))
+            perror("tftp server: write()");
+    }
+
+    pthread_mutex_unlock(&writer->lock);
+
+    return NULL;
+}
+
+/**
+ * Create writer and start its thread.
+ *
+ * @return
+ *      New writer, or NULL, if error occured.
+ *
+ * @se
+ *      Prints information about occurred error to stderr.
+ */
+tftp_writer *tftp_writer_create(void)
+{
+    tftp_writer *writer;
+    int         rc;
+
+    writer = calloc(1, sizeof(*writer));
+    if (writer == NULL)
+    {
+        perror("tftp server: calloc()");
+        return NULL;
+    }
+
+    writer->queue_tail = &writer->queue;
+    writer->done_tail  = &writer->done;
+
+    writer->event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (writer->event_fd == -1)
+    {
+        perror("tftp server: eventfd()");
+        free(writer);
+        return NULL;
+    }
+
+    pthread_mutex_init(&writer->lock, NULL);
+    pthread_cond_init(&writer->queued, NULL);
+    pthread_cond_init(&writer->idle, NULL);
+
+    rc = pthread_create(&writer->thread, NULL, tftp_writer_run, writer);
+    if (rc)
+    {
+        fprintf(stderr, "tftp server: pthread_create(): %s\n",
+                strerror(rc));
+        close(writer->event_fd);
+        free(writer);
+        return NULL;
+    }
+
+    return writer;
+}
+
+/**
+ * Stop writer thread and free the writer. Transfers using the writer
+ * must be finished.
+ */
+void tftp_writer_destroy(tftp_writer *writer)
+{
+    tftp_write *w;
+
+    pthread_mutex_lock(&writer->lock);
+    writer->stop = 1;
+    pthread_cond_signal(&writer->queued);
+    pthread_mutex_unlock(&writer->lock);
+
+    pthread_join(writer->thread, NULL);
+
+    while ((w = writer->done) != NULL)
+    {
+        writer->done = w->next;
+        free(w);
+    }
+
+    pthread_cond_destroy(&writer->idle);
+    pthread_cond_destroy(&writer->queued);
+    pthread_mutex_destroy(&writer->lock);
+    close(writer->event_fd);
+    free(writer);
+}
+
+/**
+ * Hand chunk 'w' of transfer 't' to the writer, or write it right away
+ * if the loop has buffered too much already.
+ *
+ * @return
+ *      Zero on success, or -1, if error occured.
+ */
+static int tftp_writer_queue(tftp_transfer *t, tftp_write *w)
+{
+    tftp_writer *writer = t->loop->writer;
+    int         error;
+    long        start;
+
+    pthread_mutex_lock(&writer->lock);
+
+    if (writer->pending + w->len <= TFTP_WRITER_BUDGET)
+    {
+        writer->pending    += w->len;
+        *writer->queue_tail = w;
+        writer->queue_tail  = &w->next;
+        pthread_cond_signal(&writer->queued);
+        pthread_mutex_unlock(&writer->lock);
+
+        t->io.writes++;
+        return 0;
+    }
+
+    pthread_mutex_unlock(&writer->lock);
+
+    /* disk can not keep up, client waits for it like without the writer */
+    start = tftp_time_us();
+    error = tftp_writer_write(w);
+    tftp_histogram_add(&t->loop->metrics.disk_latency,
+                       tftp_time_us() - start);
+    t->loop->stats.written_in_place += w->len - w->holes;
+    t->loop->stats.zero_skipped     += w->holes;
+    free(w);
+
+    errno = error;
+    return error ? -1 : 0;
+}
+
+/**
+ * Append 'len' bytes of 'data' received by write request 't' to the
+ * chunk of the file being gathered, and hand the chunk to the writer
+ * once it is full.
+ *
+ * @return
+ *      Zero on success, or -1, if error occured.
+ */
+int tftp_writer_append(tftp_transfer *t, const uint8_t *data, size_t len)
+{
+    tftp_write  *w = t->wbuf;
+
+    if (w != NULL && w->len + len > TFTP_WRITER_CHUNK &&
+        tftp_writer_flush(t))
+        return -1;
+
+    if (t->wbuf == NULL)
+    {
+        w = malloc(sizeof(*w) + (len > TFTP_WRITER_CHUNK ?
+                                 len : TFTP_WRITER_CHUNK));
+        if (w == NULL)
+            return -1;
+
+        memset(w, 0, sizeof(*w));
+        w->t      = t;
+        w->fd     = fileno(t->fd);
+        w->offset = t->io.offset;
+        w->punch  = t->preallocated;
+        t->wbuf   = w;
+    }
+
+    memcpy(w->data + w->len, data, len);
+    w->len       += len;
+    t->io.offset += len;
+
+    return w->len >= TFTP_WRITER_CHUNK ? tftp_writer_flush(t) : 0;
+}
+
+/**
+ * Hand the chunk gathered by write request 't' to the writer.
+ *
+ * @return
+ *      Zero on success, or -1, if error occured.
+ */
+int tftp_writer_flush(tftp_transfer *t)
+{
+    tftp_write *w = t->wbuf;
+
+    if (w == NULL)
+        return 0;
+
+    t->wbuf = NULL;
+
+    return tftp_writer_queue(t, w);
+}
+
+/**
+ * Ask the writer to sync the file of write request 't' once
+ * the chunks queued before are written.
+ *
+ * @return
+ *      Zero on success, or -1, if error occured.
+ */
+int tftp_writer_sync(tftp_transfer *t)
+{
+    tftp_write *w;
+
+    w = calloc(1, sizeof(*w));
+    if (w == NULL)
+        return -1;
+
+    w->t    = t;
+    w->fd   = fileno(t->fd);
+    w->sync = 1;
+
+    return tftp_writer_queue(t, w);
+}
+
+/** Pass chunks written by the writer of 'loop' to their transfers. */
+void tftp_writer_complete(tftp_loop *loop)
+{
+    tftp_writer *writer = loop->writer;
+    tftp_write  *w;
+    uint64_t    count;
+
+    if (read(writer->event_fd, &count, sizeof(count)) != sizeof(count))
+        return;
+
+    /*
+     * Chunks are taken one by one, as finishing a transfer releases
+     * the chunks it has in the list.
+     */
+    while (1)
+    {
+        pthread_mutex_lock(&writer->lock);
+        w = writer->done;
+        if (w != NULL)
+        {
+            writer->done = w->next;
+            if (writer->done == NULL)
+                writer->done_tail = &writer->done;
+        }
+        pthread_mutex_unlock(&writer->lock);
+
+        if (w == NULL)
+            break;
+
+        loop->stats.written_behind += w->len - w->holes;
+        loop->stats.zero_skipped   += w->holes;
+        tftp_histogram_add(&loop->metrics.disk_latency, w->latency);
+
+        if (w->t != NULL &&
+            tftp_transfer_written(w->t, w->error) != TFTP_TRANSFER_RUNNING)
+            tftp_loop_finish(loop, w->t);
+
+        free(w);
+    }
+}
+
+/**
+ * Forget chunks of finishing transfer 't', waiting for the chunk
+ * being written, so that the file can be closed.
+ */
+void tftp_writer_release(tftp_transfer *t)
+{
+    tftp_writer *writer = t->loop->writer;
+    tftp_write  **pw;
+    tftp_write  *w;
+
+    free(t->wbuf);
+    t->wbuf = NULL;
+
+    if (writer == NULL || t->io.writes == 0)
+        return;
+
+    pthread_mutex_lock(&writer->lock);
+
+    for (pw = &writer->queue; (w = *pw) != NULL; )
+    {
+        if (w->t != t)
+        {
+            pw = &w->next;
+            continue;
+        }
+
+        *pw = w->next;
+        writer->pending -= w->len;
+        free(w);
+    }
+    writer->queue_tail = pw;
+
+    while (writer->busy != NULL && writer->busy->t == t)
+        pthread_cond_wait(&writer->idle, &writer->lock);
+
+    for (w = writer->done; w != NULL; w = w->next)
+        if (w->t == t)
+            w->t = NULL;
+
+    pthread_mutex_unlock(&writer->lock);
+}